@@ -0,0 +1,264 @@
+#include "alarm_engine.h"
+
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QDateTime>
+#include <QDebug>
+
+#include "cms_api.h"
+
+AlarmEngine::AlarmEngine(QObject *parent)
+    : QObject(parent)
+{
+
+}
+
+AlarmEngine::~AlarmEngine()
+{
+
+}
+
+void AlarmEngine::addRule(const AlarmRule &rule)
+{
+    RuleState state;
+    state.rule = rule;
+    rules_.append(state);
+}
+
+void AlarmEngine::clearRules()
+{
+    rules_.clear();
+}
+
+int AlarmEngine::ruleCount() const
+{
+    return rules_.size();
+}
+
+bool AlarmEngine::overTemperatureThreshold(int channel, float *threshold) const
+{
+    // the lowest one if a channel has several
+    bool found = false;
+    for (int i = 0; i < rules_.size(); i++) {
+        const AlarmRule &rule = rules_.at(i).rule;
+        if (rule.type != AlarmRule::OVER_TEMPERATURE || rule.channel != channel) {
+            continue;
+        }
+        if (found == false || rule.threshold < *threshold) {
+            *threshold = rule.threshold;
+        }
+        found = true;
+    }
+    return found;
+}
+
+void AlarmEngine::loadDefaultRules()
+{
+    AlarmRule door_rule;
+    door_rule.type = AlarmRule::DOOR_OPEN;
+    door_rule.hold_off_sec = 2 * 60;
+    addRule(door_rule);
+
+    AlarmRule compressor_rule;
+    compressor_rule.type = AlarmRule::COMPRESSOR_STUCK_ON;
+    compressor_rule.hold_off_sec = 3 * 60 * 60;
+    addRule(compressor_rule);
+}
+
+bool AlarmEngine::loadRules(QString file_path)
+{
+    QFile rules_file(file_path);
+    if (rules_file.open(QFile::ReadOnly) == false) {
+        qDebug() << "[ALARM] open rules file failed:" << file_path;
+        return false;
+    }
+
+    QJsonParseError parse_error;
+    QJsonDocument rules_doc = QJsonDocument::fromJson(rules_file.readAll(), &parse_error);
+    if (parse_error.error != QJsonParseError::NoError) {
+        qDebug() << "[ALARM] parse rules file failed:" << parse_error.errorString();
+        return false;
+    }
+
+    // e.g. {"rules": [{"type": "over", "channel": 1, "threshold": 8, "hysteresis": 1, "hold_off_sec": 60}]}
+    static const QMap<QString, AlarmRule::Type> types = {
+        { "over",       AlarmRule::OVER_TEMPERATURE },
+        { "under",      AlarmRule::UNDER_TEMPERATURE },
+        { "rate",       AlarmRule::RATE_OF_CHANGE },
+        { "door",       AlarmRule::DOOR_OPEN },
+        { "compressor", AlarmRule::COMPRESSOR_STUCK_ON }
+    };
+
+    clearRules();
+    foreach (QJsonValue value, rules_doc.object().value("rules").toArray()) {
+        QJsonObject rule_obj = value.toObject();
+        QString type = rule_obj.value("type").toString();
+        if (types.contains(type) == false) {
+            qDebug() << "[ALARM] unknown rule type:" << type;
+            continue;
+        }
+
+        AlarmRule rule;
+        rule.type = types.value(type);
+        rule.channel = rule_obj.value("channel").toInt();
+        rule.threshold = rule_obj.value("threshold").toDouble();
+        rule.hysteresis = rule_obj.value("hysteresis").toDouble();
+        rule.hold_off_sec = rule_obj.value("hold_off_sec").toInt();
+        rule.window_sec = rule_obj.value("window_sec").toInt(60);
+        addRule(rule);
+    }
+    qDebug() << "[ALARM]" << rules_.size() << "rules loaded from" << file_path;
+    return true;
+}
+
+void AlarmEngine::evaluate(const TemperatureSample &sample)
+{
+    for (int i = 0; i < rules_.size(); i++) {
+        RuleState &state = rules_[i];
+        const AlarmRule &rule = state.rule;
+
+        float value = 0;
+        if (measure(&state, sample, &value) == false) {
+            continue;
+        }
+
+        // raise and clear levels are apart by the hysteresis
+        bool raise = false;
+        bool clear = false;
+        switch (rule.type) {
+        case AlarmRule::OVER_TEMPERATURE:
+            raise = (value > rule.threshold);
+            clear = (value <= rule.threshold - rule.hysteresis);
+            break;
+        case AlarmRule::UNDER_TEMPERATURE:
+            raise = (value < rule.threshold);
+            clear = (value >= rule.threshold + rule.hysteresis);
+            break;
+        case AlarmRule::RATE_OF_CHANGE:
+            raise = (qAbs(value) > rule.threshold);
+            clear = (qAbs(value) <= rule.threshold - rule.hysteresis);
+            break;
+        default:
+            raise = (value > 0);
+            clear = (raise == false);
+            break;
+        }
+
+        if (state.active) {
+            if (clear) {
+                state.active = false;
+                state.pending_since = -1;
+                notify(state, sample, value, false);
+            }
+            continue;
+        }
+
+        // the condition has to hold for the whole hold-off
+        if (raise == false) {
+            state.pending_since = -1;
+            continue;
+        }
+        if (state.pending_since < 0) {
+            state.pending_since = sample.timestamp;
+        }
+        if (sample.timestamp - state.pending_since >= rule.hold_off_sec * 1000LL) {
+            state.active = true;
+            notify(state, sample, value, true);
+        }
+    }
+}
+
+int AlarmEngine::activeCount() const
+{
+    int count = 0;
+    foreach (const RuleState &state, rules_) {
+        count += (state.active)? 1 : 0;
+    }
+    return count;
+}
+
+QString AlarmEngine::eventCode(AlarmRule::Type type)
+{
+    switch (type) {
+    case AlarmRule::OVER_TEMPERATURE:
+        return Event_ALARM_OVER_TEMP;
+    case AlarmRule::UNDER_TEMPERATURE:
+        return Event_ALARM_UNDER_TEMP;
+    case AlarmRule::RATE_OF_CHANGE:
+        return Event_ALARM_TEMP_RATE;
+    case AlarmRule::DOOR_OPEN:
+        return Event_ALARM_DOOR_OPEN;
+    case AlarmRule::COMPRESSOR_STUCK_ON:
+        return Event_ALARM_CP_STUCK_ON;
+    }
+    return QString();
+}
+
+bool AlarmEngine::measure(RuleState *state, const TemperatureSample &sample, float *value) const
+{
+    const AlarmRule &rule = state->rule;
+
+    switch (rule.type) {
+    case AlarmRule::DOOR_OPEN:
+        *value = (sample.state & SAMPLE_STATE_DOOR)? 1 : 0;
+        return true;
+    case AlarmRule::COMPRESSOR_STUCK_ON:
+        *value = (sample.state & SAMPLE_STATE_CP)? 1 : 0;
+        return true;
+    default:
+        break;
+    }
+
+    if (rule.channel < 1 || rule.channel > TP_CHANNEL_COUNT) {
+        return false;
+    }
+    float temperature = sample.temperature[rule.channel - 1];
+    if (rule.type != AlarmRule::RATE_OF_CHANGE) {
+        *value = temperature;
+        return true;
+    }
+
+    // slope against the oldest sample in the window, a single sample pair
+    // is too noisy with 0.1 degree resolution
+    qint64 window_ms = qMax(1, rule.window_sec) * 1000LL;
+    state->history.enqueue(qMakePair(sample.timestamp, temperature));
+    while (sample.timestamp - state->history.head().first > window_ms) {
+        state->history.dequeue();
+    }
+    qint64 span_ms = sample.timestamp - state->history.head().first;
+    if (span_ms < window_ms / 2) {
+        return false;
+    }
+    *value = (temperature - state->history.head().second) * 60000.0 / span_ms;
+    return true;
+}
+
+void AlarmEngine::notify(const RuleState &state, const TemperatureSample &sample, float value, bool raised)
+{
+    const AlarmRule &rule = state.rule;
+    QString event_code = eventCode(rule.type);
+
+    QMap<QString, QString> parameters;
+    parameters.insert("state", (raised)? "raised" : "cleared");
+    if (rule.type == AlarmRule::DOOR_OPEN || rule.type == AlarmRule::COMPRESSOR_STUCK_ON) {
+        parameters.insert("hold_off_sec", QString::number(rule.hold_off_sec));
+    }
+    else {
+        parameters.insert("channel", QString::number(rule.channel));
+        parameters.insert("value", QString::number(value, 'f', 1));
+        parameters.insert("threshold", QString::number(rule.threshold, 'f', 1));
+    }
+    parameters.insert("sample_time", QDateTime::fromMSecsSinceEpoch(sample.timestamp).toString(Qt::ISODate));
+    parameters.insert("detect_latency_ms", QString::number(QDateTime::currentMSecsSinceEpoch() - sample.timestamp));
+
+    qDebug() << "[ALARM]" << event_code << parameters;
+
+    if (raised) {
+        emit alarmRaised(event_code, parameters);
+    }
+    else {
+        emit alarmCleared(event_code, parameters);
+    }
+}
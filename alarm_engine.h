@@ -0,0 +1,76 @@
+#ifndef ALARM_ENGINE_H
+#define ALARM_ENGINE_H
+
+#include <QObject>
+#include <QVector>
+#include <QQueue>
+#include <QPair>
+#include <QMap>
+
+#include "sample_store.h"
+
+// one alarm condition, channel is 1-based and only used by temperature rules
+struct AlarmRule
+{
+    enum Type {
+        OVER_TEMPERATURE,
+        UNDER_TEMPERATURE,
+        RATE_OF_CHANGE,         // threshold in degrees per minute
+        DOOR_OPEN,
+        COMPRESSOR_STUCK_ON
+    };
+
+    Type type = OVER_TEMPERATURE;
+    int channel = 0;
+    float threshold = 0;
+    float hysteresis = 0;
+    int hold_off_sec = 0;       // condition must last this long before raising
+    int window_sec = 60;        // rate of change window
+};
+
+// Evaluates alarm rules on every decoded TPAL sample, so an alarm is raised
+// one sample period after the condition (plus its hold-off) is met.
+class AlarmEngine : public QObject
+{
+    Q_OBJECT
+
+public:
+    AlarmEngine(QObject *parent = nullptr);
+    ~AlarmEngine();
+
+    void addRule(const AlarmRule &rule);
+    void clearRules();
+    int ruleCount() const;
+
+    // channel is 1-based, false if no over-temperature rule watches it
+    bool overTemperatureThreshold(int channel, float *threshold) const;
+
+    // door left open and compressor stuck on, temperature rules depend on the machine
+    void loadDefaultRules();
+    bool loadRules(QString file_path);
+
+    void evaluate(const TemperatureSample &sample);
+    int activeCount() const;
+
+    static QString eventCode(AlarmRule::Type type);
+
+Q_SIGNALS:
+    void alarmRaised(QString event_code, QMap<QString, QString> parameters);
+    void alarmCleared(QString event_code, QMap<QString, QString> parameters);
+
+private:
+    struct RuleState {
+        AlarmRule rule;
+        bool active = false;
+        qint64 pending_since = -1;
+        QQueue<QPair<qint64, float> > history;  // rate of change window
+    };
+
+    bool measure(RuleState *state, const TemperatureSample &sample, float *value) const;
+    void notify(const RuleState &state, const TemperatureSample &sample, float value, bool raised);
+
+private:
+    QVector<RuleState> rules_;
+};
+
+#endif // ALARM_ENGINE_H
@@ -0,0 +1,187 @@
+#include "anomaly_detector.h"
+
+#include <QFile>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QDateTime>
+#include <QDebug>
+
+#include <math.h>
+
+#include "cms_api.h"
+
+// a longer gap only moves the averages by this much
+#define ANOMALY_MAX_STEP_MIN    10.0
+
+AnomalyDetector::AnomalyDetector(QObject *parent)
+    : QObject(parent)
+{
+
+}
+
+AnomalyDetector::~AnomalyDetector()
+{
+
+}
+
+bool AnomalyDetector::loadConfig(QString file_path)
+{
+    QFile config_file(file_path);
+    if (config_file.open(QFile::ReadOnly) == false) {
+        qDebug() << "[ANOMALY] open config file failed:" << file_path;
+        return false;
+    }
+
+    QJsonParseError parse_error;
+    QJsonObject config_obj = QJsonDocument::fromJson(config_file.readAll(), &parse_error).object();
+    if (parse_error.error != QJsonParseError::NoError) {
+        qDebug() << "[ANOMALY] parse config file failed:" << parse_error.errorString();
+        return false;
+    }
+
+    fast_tau_min_ = qMax(1.0, config_obj.value("fast_tau_min").toDouble(fast_tau_min_));
+    slow_tau_min_ = qMax(fast_tau_min_, config_obj.value("slow_tau_min").toDouble(slow_tau_min_));
+    warmup_min_ = qMax(0.0, config_obj.value("warmup_min").toDouble(warmup_min_));
+    drift_k_ = config_obj.value("drift_k").toDouble(drift_k_);
+    drift_h_ = config_obj.value("drift_h").toDouble(drift_h_);
+    min_sigma_ = qMax(0.01, config_obj.value("min_sigma").toDouble(min_sigma_));
+    duty_tau_min_ = qMax(1.0, config_obj.value("duty_tau_min").toDouble(duty_tau_min_));
+    duty_k_ = config_obj.value("duty_k").toDouble(duty_k_);
+    duty_h_ = config_obj.value("duty_h").toDouble(duty_h_);
+    reset();
+    return true;
+}
+
+void AnomalyDetector::reset()
+{
+    for (int i = 0; i < TP_CHANNEL_COUNT; i++) {
+        channels_[i] = Detector();
+    }
+    duty_ = Detector();
+    first_timestamp_ = -1;
+    last_timestamp_ = -1;
+}
+
+void AnomalyDetector::evaluate(const TemperatureSample &sample)
+{
+    double duty = (sample.state & SAMPLE_STATE_CP)? 1.0 : 0.0;
+
+    // the first sample seeds the averages
+    if (first_timestamp_ < 0) {
+        for (int i = 0; i < TP_CHANNEL_COUNT; i++) {
+            channels_[i].fast = sample.temperature[i];
+            channels_[i].slow = sample.temperature[i];
+            channels_[i].variance = min_sigma_ * min_sigma_;
+        }
+        duty_.fast = duty;
+        duty_.slow = duty;
+        first_timestamp_ = sample.timestamp;
+        last_timestamp_ = sample.timestamp;
+        return;
+    }
+
+    double dt_min = (sample.timestamp - last_timestamp_) / 60000.0;
+    if (dt_min <= 0) {
+        return;
+    }
+    dt_min = qMin(dt_min, ANOMALY_MAX_STEP_MIN);
+    last_timestamp_ = sample.timestamp;
+
+    for (int i = 0; i < TP_CHANNEL_COUNT; i++) {
+        Detector &detector = channels_[i];
+        bool was_active = detector.active;
+        if (update(&detector, sample.temperature[i], dt_min, fast_tau_min_, drift_k_, drift_h_, min_sigma_, true)) {
+            notify(detector, i + 1, sample, detector.active && was_active == false);
+        }
+    }
+
+    bool was_active = duty_.active;
+    if (update(&duty_, duty, dt_min, duty_tau_min_, duty_k_, duty_h_, 0, false)) {
+        notify(duty_, 0, sample, duty_.active && was_active == false);
+    }
+}
+
+int AnomalyDetector::activeCount() const
+{
+    int count = (duty_.active)? 1 : 0;
+    for (int i = 0; i < TP_CHANNEL_COUNT; i++) {
+        count += (channels_[i].active)? 1 : 0;
+    }
+    return count;
+}
+
+bool AnomalyDetector::update(Detector *detector, double value, double dt_min, double fast_tau_min, double k, double h, double min_sigma, bool two_sided)
+{
+    // time based smoothing factors, independent of the sampling rate
+    double fast_alpha = 1.0 - exp(-dt_min / fast_tau_min);
+    double slow_alpha = 1.0 - exp(-dt_min / slow_tau_min_);
+
+    detector->fast += fast_alpha * (value - detector->fast);
+
+    // the baseline must not learn the fault while it is reported
+    if (detector->active == false) {
+        double diff = value - detector->slow;
+        detector->slow += slow_alpha * diff;
+        detector->variance = (1.0 - slow_alpha) * (detector->variance + slow_alpha * diff * diff);
+    }
+
+    if ((last_timestamp_ - first_timestamp_) / 60000.0 < warmup_min_) {
+        return false;
+    }
+
+    double z = detector->fast - detector->slow;
+    if (min_sigma > 0) {
+        z /= qMax(sqrt(detector->variance), min_sigma);
+    }
+    detector->cusum_up = qMax(0.0, detector->cusum_up + (z - k) * dt_min);
+    detector->cusum_down = (two_sided)? qMax(0.0, detector->cusum_down + (-z - k) * dt_min) : 0.0;
+
+    if (detector->active) {
+        // clear once the sum of the reported direction has halved
+        double cusum = (detector->direction > 0)? detector->cusum_up : detector->cusum_down;
+        if (cusum < h / 2) {
+            detector->active = false;
+            detector->cusum_up = 0;
+            detector->cusum_down = 0;
+            return true;
+        }
+        return false;
+    }
+
+    if (detector->cusum_up > h || detector->cusum_down > h) {
+        detector->active = true;
+        detector->direction = (detector->cusum_up > h)? 1 : -1;
+        return true;
+    }
+    return false;
+}
+
+void AnomalyDetector::notify(const Detector &detector, int channel, const TemperatureSample &sample, bool raised)
+{
+    QString event_code = (channel > 0)? Event_ANOMALY_TEMP_DRIFT : Event_ANOMALY_DUTY_CYCLE;
+
+    QMap<QString, QString> parameters;
+    parameters.insert("state", (raised)? "raised" : "cleared");
+    if (channel > 0) {
+        parameters.insert("channel", QString::number(channel));
+        parameters.insert("direction", (detector.direction > 0)? "up" : "down");
+        parameters.insert("value", QString::number(detector.fast, 'f', 2));
+        parameters.insert("baseline", QString::number(detector.slow, 'f', 2));
+        parameters.insert("sigma", QString::number(qMax(sqrt(detector.variance), min_sigma_), 'f', 2));
+    }
+    else {
+        parameters.insert("duty", QString::number(detector.fast, 'f', 3));
+        parameters.insert("baseline", QString::number(detector.slow, 'f', 3));
+    }
+    parameters.insert("cusum", QString::number((detector.direction > 0)? detector.cusum_up : detector.cusum_down, 'f', 1));
+    parameters.insert("sample_time", QDateTime::fromMSecsSinceEpoch(sample.timestamp).toString(Qt::ISODate));
+
+    qDebug() << "[ANOMALY]" << event_code << parameters;
+
+    if (raised) {
+        emit anomalyRaised(event_code, parameters);
+    }
+    else {
+        emit anomalyCleared(event_code, parameters);
+    }
+}
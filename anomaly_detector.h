@@ -0,0 +1,70 @@
+#ifndef ANOMALY_DETECTOR_H
+#define ANOMALY_DETECTOR_H
+
+#include <QObject>
+#include <QMap>
+
+#include "sample_store.h"
+
+// Early warning of slow drift, before a threshold alarm trips. Per channel
+// a fast EWMA of the temperature is compared with a slow baseline EWMA, the
+// difference in baseline sigmas feeds a two-sided CUSUM. The compressor duty
+// cycle gets the same treatment upwards only, a frosting evaporator or a
+// weak fan makes the compressor run longer. Constant memory, O(1) a sample.
+//
+// CUSUM terms are weighted by the minutes between samples, so thresholds
+// do not depend on the sampling rate.
+class AnomalyDetector : public QObject
+{
+    Q_OBJECT
+
+public:
+    AnomalyDetector(QObject *parent = nullptr);
+    ~AnomalyDetector();
+
+    // JSON file, e.g. {"fast_tau_min": 30, "slow_tau_min": 1440, "warmup_min": 120,
+    // "drift_k": 0.5, "drift_h": 30, "min_sigma": 0.2, "duty_tau_min": 60, "duty_k": 0.1, "duty_h": 60}
+    bool loadConfig(QString file_path);
+    void reset();
+
+    void evaluate(const TemperatureSample &sample);
+    int activeCount() const;
+
+Q_SIGNALS:
+    void anomalyRaised(QString event_code, QMap<QString, QString> parameters);
+    void anomalyCleared(QString event_code, QMap<QString, QString> parameters);
+
+private:
+    struct Detector {
+        double fast = 0;
+        double slow = 0;
+        double variance = 0;    // of the samples around the slow baseline
+        double cusum_up = 0;
+        double cusum_down = 0;
+        bool active = false;
+        int direction = 0;      // 1 up, -1 down while active
+    };
+
+    // min_sigma 0 leaves the difference unscaled, for the duty cycle
+    bool update(Detector *detector, double value, double dt_min, double fast_tau_min, double k, double h, double min_sigma, bool two_sided);
+    void notify(const Detector &detector, int channel, const TemperatureSample &sample, bool raised);
+
+private:
+    // time constants and CUSUM parameters
+    double fast_tau_min_ = 30;
+    double slow_tau_min_ = 24 * 60;
+    double warmup_min_ = 120;
+    double drift_k_ = 0.5;      // sigmas of slack
+    double drift_h_ = 30;       // sigma minutes to raise
+    double min_sigma_ = 0.2;    // degrees, the sensor resolution is 0.1
+    double duty_tau_min_ = 60;
+    double duty_k_ = 0.1;       // duty cycle fraction of slack
+    double duty_h_ = 60;        // fraction minutes to raise
+
+    Detector channels_[TP_CHANNEL_COUNT];
+    Detector duty_;
+    qint64 first_timestamp_ = -1;
+    qint64 last_timestamp_ = -1;
+};
+
+#endif // ANOMALY_DETECTOR_H
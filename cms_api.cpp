@@ -8,15 +8,35 @@
 #include <QJsonObject>
 #include <QJsonArray>
 #include <QJsonDocument>
+#include <QElapsedTimer>
+
+#include "file_download.h"
+#include "http_cache.h"
+#include "scan_cache.h"
+#include "metrics.h"
+#include "telemetry_payload.h"
+
+// no HTTP status means the CMS was never reached, a rejection has one
+static bool isNetworkFailure(QNetworkReply *reply)
+{
+    return reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).isValid() == false;
+}
 
 CmsApi::CmsApi(QObject *parent)
     : QObject(parent)
 {
     network_manager_ = new QNetworkAccessManager(this);
+    http_cache_ = new HttpCache();
+    scan_cache_ = new ScanCache();
+
+    file_download_ = new FileDownload(network_manager_, this);
+    connect(file_download_, SIGNAL(progress(qint64,qint64)), this, SIGNAL(downloadProgress(qint64,qint64)));
 }
 
 CmsApi::~CmsApi()
 {
+    delete scan_cache_;
+    delete http_cache_;
 }
 
 void CmsApi::setDebugEnabled(bool enabled)
@@ -24,6 +44,47 @@ void CmsApi::setDebugEnabled(bool enabled)
     debug_enabled_ = enabled;
 }
 
+bool CmsApi::isDebugEnabled() const
+{
+    return debug_enabled_;
+}
+
+void CmsApi::setCacheDir(QString dir)
+{
+    http_cache_->setDir(dir);
+    scan_cache_->setFile(dir.isEmpty()? QString() : QString("%1/scan_index.bin").arg(dir));
+}
+
+int CmsApi::prefetchScanCodes(QString machine_code, int max_count)
+{
+    // codes due within the next quarter of the day, the most scanned first
+    QStringList barcodes = scan_cache_->hotCodes(ScanCache::BARCODE, max_count, 6 * 60 * 60);
+    QStringList love_codes = scan_cache_->hotCodes(ScanCache::LOVE_CODE, max_count - barcodes.size(), 6 * 60 * 60);
+
+    int count = 0;
+    bool offline = false;
+    QByteArray infos;
+    for (int i = 0; i < barcodes.size() && offline == false; i++) {
+        if (fetchBarcodeInfos(machine_code, barcodes.at(i), &infos, &offline)) {
+            scan_cache_->insert(ScanCache::BARCODE, barcodes.at(i), infos);
+            count++;
+        }
+    }
+    for (int i = 0; i < love_codes.size() && offline == false; i++) {
+        if (fetchLoveCode(machine_code, love_codes.at(i), &infos, &offline)) {
+            scan_cache_->insert(ScanCache::LOVE_CODE, love_codes.at(i), infos);
+            count++;
+        }
+    }
+    scan_cache_->save();
+    return count;
+}
+
+void CmsApi::setDownloadRateLimit(qint64 bytes_per_sec)
+{
+    file_download_->setRateLimit(bytes_per_sec);
+}
+
 bool CmsApi::getUrlFileData(QString url, QByteArray *out_ba)
 {
     QTimer tmr;
@@ -54,16 +115,55 @@ bool CmsApi::getUrlFileData(QString url, QByteArray *out_ba)
     return true;
 }
 
-bool CmsApi::getToken(QString machine_code, QByteArray *token)
+bool CmsApi::getUrlFileData(QString url, QString file_path, QByteArray sha256_hex)
+{
+    // one download at a time, a second call may come from inside the loop below
+    if (file_download_->isRunning()) {
+        if (debug_enabled_)
+            qDebug() << "[CmsApi] getUrlFileData Error: busy, downloading another file";
+        return false;
+    }
+
+    QEventLoop loop;
+    connect(file_download_, SIGNAL(finished(bool)), &loop, SLOT(quit()));
+    if (file_download_->start(url, file_path, sha256_hex) == false) {
+        if (debug_enabled_)
+            qDebug() << "[CmsApi] getUrlFileData Error:" << file_download_->errorString();
+        return false;
+    }
+    loop.exec();
+
+    // no error left behind means the file is complete and verified
+    if (file_download_->errorString().isEmpty() == false) {
+        if (debug_enabled_)
+            qDebug() << "[CmsApi] getUrlFileData Error:" << file_download_->errorString();
+        return false;
+    }
+    return true;
+}
+
+bool CmsApi::getToken(QString machine_code, QByteArray *token, bool *offline)
 {
     if (debug_enabled_)
         qDebug() << "[CmsApi] getToken start...";
 
+    // post request and wait for reply
+    QEventLoop loop;
+    QNetworkReply *reply = requestToken(machine_code);
+    connect(reply, SIGNAL(finished()), &loop, SLOT(quit()));
+    loop.exec();
+
+    bool result = readToken(reply, token, offline);
+    delete reply;
+    return result;
+}
+
+QNetworkReply *CmsApi::requestToken(QString machine_code)
+{
     QUrl service_url = QUrl(url_token);
     QNetworkRequest request(service_url);
 
     QByteArray request_data;
-    QByteArray reply_data;
 
     // set request parameters
     QJsonObject request_obj;
@@ -74,15 +174,11 @@ bool CmsApi::getToken(QString machine_code, QByteArray *token)
     request.setHeader(QNetworkRequest::ContentTypeHeader, "application/json" );
     request.setHeader(QNetworkRequest::ContentLengthHeader, QByteArray::number(request_data.size()));
 
-    // post and wait for reply
-    QEventLoop loop;
-    QNetworkReply *reply = nullptr;
-
-    // post request and wait for reply
-    reply = network_manager_->post(request, request_data);
-    connect(reply, SIGNAL(finished()), &loop, SLOT(quit()));
-    loop.exec();
+    return network_manager_->post(request, request_data);
+}
 
+bool CmsApi::readToken(QNetworkReply *reply, QByteArray *token, bool *offline)
+{
     // check reply status
     if (reply == nullptr) {
         return false;
@@ -90,16 +186,17 @@ bool CmsApi::getToken(QString machine_code, QByteArray *token)
     if (reply->error() != QNetworkReply::NoError) {
         if (debug_enabled_)
             qDebug() << "[CmsApi] getToken Error:" << reply->error();
-        delete reply;
+        if (offline != nullptr) {
+            *offline = isNetworkFailure(reply);
+        }
         return false;
     }
 
-    // check reply data is valid
-    reply_data.append(reply->readAll());
-    if (QString(reply_data).indexOf('{') >= 0) {
+    // check reply data is valid, an error comes back as JSON
+    QByteArray reply_data = reply->readAll();
+    if (reply_data.isEmpty() || QString(reply_data).indexOf('{') >= 0) {
         if (debug_enabled_)
             qDebug() << "[CmsApi] getToken Error:" << QString(reply_data);
-        delete reply;
         return false;
     }
 
@@ -107,7 +204,48 @@ bool CmsApi::getToken(QString machine_code, QByteArray *token)
     token->append(reply_data.data(), reply_data.size());
     if (debug_enabled_)
         qDebug() << "[CmsApi] getToken success ( size:" << token->size() << ")";
-    delete reply;
+    return true;
+}
+
+bool CmsApi::lookupCached(QString machine_code, const QNetworkRequest &request, const QByteArray &request_data, QByteArray *reply_data, bool *fresh)
+{
+    HttpCacheEntry cached;
+    if (http_cache_->lookup(HttpCache::key(machine_code, request.url(), request_data), &cached) == false) {
+        return false;
+    }
+
+    *fresh = HttpCache::isFresh(cached);
+    if (*fresh) {
+        Metrics::increment(Metrics::CMS_CACHE_HITS);
+    }
+    *reply_data = cached.body;
+    return true;
+}
+
+QNetworkReply *CmsApi::postWithToken(QString machine_code, QNetworkRequest request, const QByteArray &request_data, const QByteArray &token)
+{
+    setBearer(token, &request);
+
+    HttpCacheEntry cached;
+    if (http_cache_->lookup(HttpCache::key(machine_code, request.url(), request_data), &cached)) {
+        HttpCache::addValidators(cached, &request);
+    }
+    return network_manager_->post(request, request_data);
+}
+
+bool CmsApi::readCachedReply(QString machine_code, QNetworkReply *reply, const QByteArray &request_data, QByteArray *reply_data, bool *revalidated)
+{
+    if (reply->error() != QNetworkReply::NoError) {
+        if (debug_enabled_)
+            qDebug() << "[CmsApi] QNetworkReply Error:" << reply->error();
+        return false;
+    }
+
+    HttpCacheEntry response;
+    HttpCache::readResponse(reply, &response);
+    reply_data->clear();
+    reply_data->append(reply->readAll());
+    *revalidated = storeReply(HttpCache::key(machine_code, reply->request().url(), request_data), response, reply_data);
     return true;
 }
 
@@ -119,18 +257,13 @@ bool CmsApi::getVendorInfos(QString machine_code, QByteArray *infos)
     QByteArray request_data;
     QByteArray reply_data;
 
-    // set request header
-    if (setRequestHeader(machine_code, &request) == false) {
-        return false;
-    }
-
     // set request parameters
     QJsonObject request_obj;
     request_data = QJsonDocument(request_obj).toJson();
     request.setHeader(QNetworkRequest::ContentLengthHeader, QByteArray::number(request_data.size()));
 
-    // post and wait for reply
-    if (postAndWaitForReply(request, request_data, &reply_data) == false) {
+    // served from the cache while fresh, otherwise a conditional post
+    if (postCached(machine_code, request, request_data, &reply_data) == false) {
         return false;
     }
 
@@ -156,19 +289,14 @@ bool CmsApi::getMachineInfos(QString machine_code, QByteArray *infos)
     QByteArray request_data;
     QByteArray reply_data;
 
-    // set request header
-    if (setRequestHeader(machine_code, &request) == false) {
-        return false;
-    }
-
     // set request parameters
     QJsonObject request_obj;
     request_obj.insert("machine_code", machine_code);
     request_data = QJsonDocument(request_obj).toJson();
     request.setHeader(QNetworkRequest::ContentLengthHeader, QByteArray::number(request_data.size()));
 
-    // post and wait for reply
-    if (postAndWaitForReply(request, request_data, &reply_data) == false) {
+    // served from the cache while fresh, otherwise a conditional post
+    if (postCached(machine_code, request, request_data, &reply_data) == false) {
         return false;
     }
 
@@ -224,7 +352,7 @@ bool CmsApi::getRemoteCommand(QString machine_code, QByteArray *cmds)
     return true;
 }
 
-bool CmsApi::updateMonitoringInfos(QString machine_code, QMap<QString, QByteArray> info_map)
+bool CmsApi::updateMonitoringInfos(QString machine_code, const TelemetryPayload &payload)
 {
     QUrl service_url = QUrl(url_temp);
     QNetworkRequest request(service_url);
@@ -238,13 +366,7 @@ bool CmsApi::updateMonitoringInfos(QString machine_code, QMap<QString, QByteArra
     }
 
     // set request parameters
-    QJsonObject request_obj;
-    request_obj.insert("machine_code", machine_code);
-    QList<QString> keys = info_map.keys();
-    foreach (QString key, keys) {
-        request_obj.insert(key, QString::fromUtf8(info_map.value(key)));
-    }
-    request_data = QJsonDocument(request_obj).toJson();
+    request_data = monitoringRequestData(machine_code, payload);
     request.setHeader(QNetworkRequest::ContentLengthHeader, QByteArray::number(request_data.size()));
 
     // post and wait for reply
@@ -344,6 +466,28 @@ bool CmsApi::updateSettlementInfos(QString machine_code, QMap<QString, QByteArra
 }
 
 bool CmsApi::getBarcodeInfos(QString machine_code, QString barcode, QByteArray *infos)
+{
+    if (scan_cache_->lookup(ScanCache::BARCODE, barcode, infos)) {
+        Metrics::increment(Metrics::SCAN_CACHE_HITS);
+        return true;
+    }
+    Metrics::increment(Metrics::SCAN_CACHE_MISSES);
+
+    bool offline = false;
+    if (fetchBarcodeInfos(machine_code, barcode, infos, &offline)) {
+        scan_cache_->insert(ScanCache::BARCODE, barcode, *infos);
+        return true;
+    }
+
+    // the CMS is unreachable, an expired entry beats no answer
+    if (offline && scan_cache_->lookup(ScanCache::BARCODE, barcode, infos, true)) {
+        Metrics::increment(Metrics::SCAN_CACHE_STALE);
+        return true;
+    }
+    return false;
+}
+
+bool CmsApi::fetchBarcodeInfos(QString machine_code, QString barcode, QByteArray *infos, bool *offline)
 {
     QUrl service_url = QUrl(url_barcode);
     QNetworkRequest request(service_url);
@@ -351,8 +495,9 @@ bool CmsApi::getBarcodeInfos(QString machine_code, QString barcode, QByteArray *
     QByteArray request_data;
     QByteArray reply_data;
 
-    // set request header
-    if (setRequestHeader(machine_code, &request) == false) {
+    // set request header, the scan cache keeps the result
+    *offline = false;
+    if (setRequestHeader(machine_code, &request, offline) == false) {
         return false;
     }
 
@@ -363,7 +508,7 @@ bool CmsApi::getBarcodeInfos(QString machine_code, QString barcode, QByteArray *
     request.setHeader(QNetworkRequest::ContentLengthHeader, QByteArray::number(request_data.size()));
 
     // post and wait for reply
-    if (postAndWaitForReply(request, request_data, &reply_data) == false) {
+    if (postAndWaitForReply(request, request_data, &reply_data, nullptr, offline) == false) {
         return false;
     }
 
@@ -439,18 +584,13 @@ bool CmsApi::getVersionInfos(QString machine_code, QByteArray *infos)
     QByteArray request_data;
     QByteArray reply_data;
 
-    // set request header
-    if (setRequestHeader(machine_code, &request) == false) {
-        return false;
-    }
-
     // set request parameters
     QJsonObject request_obj;
     request_data = QJsonDocument(request_obj).toJson();
     request.setHeader(QNetworkRequest::ContentLengthHeader, QByteArray::number(request_data.size()));
 
-    // post and wait for reply
-    if (postAndWaitForReply(request, request_data, &reply_data) == false) {
+    // served from the cache while fresh, otherwise a conditional post
+    if (postCached(machine_code, request, request_data, &reply_data) == false) {
         return false;
     }
 
@@ -505,6 +645,11 @@ bool CmsApi::updateVersionInfos(QString machine_code, QString fw_ver, QString sw
 }
 
 bool CmsApi::updateEventInfos(QString machine_code, QString event_code)
+{
+    return updateEventInfos(machine_code, event_code, QMap<QString, QString>());
+}
+
+bool CmsApi::updateEventInfos(QString machine_code, QString event_code, QMap<QString, QString> parameters)
 {
     QUrl service_url = QUrl(url_event_log);
     QNetworkRequest request(service_url);
@@ -520,6 +665,13 @@ bool CmsApi::updateEventInfos(QString machine_code, QString event_code)
     // set request parameters
     QJsonObject request_obj;
     request_obj.insert("event_code", event_code);
+    QJsonObject parameter_obj;
+    foreach(QString para_name, parameters.keys()) {
+        parameter_obj.insert(para_name, parameters.value(para_name));
+    }
+    if (parameter_obj.isEmpty() == false) {
+        request_obj.insert("parameter", parameter_obj);
+    }
     request_data = QJsonDocument(request_obj).toJson();
     request.setHeader(QNetworkRequest::ContentLengthHeader, QByteArray::number(request_data.size()));
 
@@ -585,6 +737,28 @@ bool CmsApi::updateMachineLog(QString machine_code, QString log_code, QMap<QStri
 }
 
 bool CmsApi::queryLoveCode(QString machine_code, QString love_code, QByteArray *infos)
+{
+    if (scan_cache_->lookup(ScanCache::LOVE_CODE, love_code, infos)) {
+        Metrics::increment(Metrics::SCAN_CACHE_HITS);
+        return true;
+    }
+    Metrics::increment(Metrics::SCAN_CACHE_MISSES);
+
+    bool offline = false;
+    if (fetchLoveCode(machine_code, love_code, infos, &offline)) {
+        scan_cache_->insert(ScanCache::LOVE_CODE, love_code, *infos);
+        return true;
+    }
+
+    // the CMS is unreachable, an expired entry beats no answer
+    if (offline && scan_cache_->lookup(ScanCache::LOVE_CODE, love_code, infos, true)) {
+        Metrics::increment(Metrics::SCAN_CACHE_STALE);
+        return true;
+    }
+    return false;
+}
+
+bool CmsApi::fetchLoveCode(QString machine_code, QString love_code, QByteArray *infos, bool *offline)
 {
     QUrl service_url = QUrl(url_love_code_query);
     QNetworkRequest request(service_url);
@@ -593,7 +767,8 @@ bool CmsApi::queryLoveCode(QString machine_code, QString love_code, QByteArray *
     QByteArray reply_data;
 
     // set request header
-    if (setRequestHeader(machine_code, &request) == false) {
+    *offline = false;
+    if (setRequestHeader(machine_code, &request, offline) == false) {
         return false;
     }
 
@@ -604,7 +779,7 @@ bool CmsApi::queryLoveCode(QString machine_code, QString love_code, QByteArray *
     request.setHeader(QNetworkRequest::ContentLengthHeader, QByteArray::number(request_data.size()));
 
     // post and wait for reply
-    if (postAndWaitForReply(request, request_data, &reply_data) == false) {
+    if (postAndWaitForReply(request, request_data, &reply_data, nullptr, offline) == false) {
         return false;
     }
 
@@ -624,6 +799,16 @@ bool CmsApi::queryLoveCode(QString machine_code, QString love_code, QByteArray *
     return true;
 }
 
+const QByteArray &CmsApi::monitoringRequestData(QString machine_code, const TelemetryPayload &payload)
+{
+    if (machine_code != monitoring_code_ || monitoring_head_.isEmpty()) {
+        monitoring_code_ = machine_code;
+        monitoring_head_ = TelemetryPayload::head(machine_code);
+    }
+    payload.write(monitoring_head_, &monitoring_body_);
+    return monitoring_body_;
+}
+
 bool CmsApi::getMohistToken(QString machine_code, QByteArray *token)
 {
     if (debug_enabled_)
@@ -742,45 +927,118 @@ bool CmsApi::useMohistVoucher(QString machine_code, QString voucher_barcode, boo
     return true;
 }
 
-bool CmsApi::setRequestHeader(QString machine_code, QNetworkRequest* request)
+bool CmsApi::setRequestHeader(QString machine_code, QNetworkRequest* request, bool *offline)
 {
     QByteArray token;
-    QByteArray bearer;
 
-    if (getToken(machine_code, &token) == false) {
+    if (getToken(machine_code, &token, offline) == false) {
         return false;
     }
 
+    setBearer(token, request);
+    return true;
+}
+
+void CmsApi::setBearer(const QByteArray &token, QNetworkRequest *request)
+{
+    QByteArray bearer;
     bearer.append("Bearer ");
     bearer.append(token);
 
     request->setHeader(QNetworkRequest::ContentTypeHeader, "application/json");
     request->setRawHeader(QByteArray("Authorization"), bearer);
+}
+
+bool CmsApi::postCached(QString machine_code, QNetworkRequest request, QByteArray request_data, QByteArray *reply_data)
+{
+    QByteArray key = HttpCache::key(machine_code, request.url(), request_data);
+    HttpCacheEntry cached;
+    bool has_cached = http_cache_->lookup(key, &cached);
+    if (has_cached && HttpCache::isFresh(cached)) {
+        Metrics::increment(Metrics::CMS_CACHE_HITS);
+        *reply_data = cached.body;
+        return true;
+    }
+
+    // the token is only needed when the request is sent
+    if (setRequestHeader(machine_code, &request) == false) {
+        return false;
+    }
+    if (has_cached) {
+        HttpCache::addValidators(cached, &request);
+    }
+
+    HttpCacheEntry response;
+    if (postAndWaitForReply(request, request_data, reply_data, &response) == false) {
+        return false;
+    }
+    storeReply(key, response, reply_data);
     return true;
 }
 
-bool CmsApi::postAndWaitForReply(QNetworkRequest request, QByteArray request_data, QByteArray *reply_data)
+bool CmsApi::storeReply(const QByteArray &key, HttpCacheEntry response, QByteArray *reply_data)
+{
+    HttpCacheEntry cached;
+    bool has_cached = http_cache_->lookup(key, &cached);
+
+    // unchanged, keep the body and take the new freshness
+    if (has_cached && response.status == 304) {
+        Metrics::increment(Metrics::CMS_CACHE_REVALIDATED);
+        if (response.etag.isEmpty()) {
+            response.etag = cached.etag;
+        }
+        if (response.last_modified.isEmpty()) {
+            response.last_modified = cached.last_modified;
+        }
+        response.body = cached.body;
+        http_cache_->store(key, response);
+        *reply_data = cached.body;
+        return true;
+    }
+
+    Metrics::increment(Metrics::CMS_CACHE_MISSES);
+    if (response.status == 200 && reply_data->indexOf("errors") < 0) {
+        response.body = *reply_data;
+        http_cache_->store(key, response);
+    }
+    return false;
+}
+
+bool CmsApi::postAndWaitForReply(QNetworkRequest request, QByteArray request_data, QByteArray *reply_data, HttpCacheEntry *response, bool *offline)
 {
     QEventLoop loop;
     QNetworkReply *reply = nullptr;
+    QElapsedTimer latency_clock;
+    latency_clock.start();
 
     // post request and wait for reply
     reply = network_manager_->post(request, request_data);
     connect(reply, SIGNAL(finished()), &loop, SLOT(quit()));
     loop.exec();
 
+    Metrics::increment(Metrics::CMS_REQUESTS);
+    Metrics::observe(Metrics::CMS_LATENCY, latency_clock.nsecsElapsed() / 1000);
+
     // check reply status
     if (reply == nullptr) {
+        Metrics::increment(Metrics::CMS_ERRORS);
         return false;
     }
     if (reply->error() != QNetworkReply::NoError) {
         if (debug_enabled_)
             qDebug() << "[CmsApi] QNetworkReply Error:" << reply->error();
+        Metrics::increment(Metrics::CMS_ERRORS);
+        if (offline != nullptr) {
+            *offline = isNetworkFailure(reply);
+        }
         delete reply;
         return false;
     }
 
     // return reply data
+    if (response != nullptr) {
+        HttpCache::readResponse(reply, response);
+    }
     reply_data->clear();
     reply_data->append(reply->readAll());
     delete reply;
@@ -55,11 +55,19 @@
 #define Event_ERR_COIN_PORT         "14"
 #define Event_ERR_HOPPER_PORT       "15"
 #define Event_INIT_FINISHED         "30"
+#define Event_ALARM_OVER_TEMP       "40"
+#define Event_ALARM_UNDER_TEMP      "41"
+#define Event_ALARM_TEMP_RATE       "42"
+#define Event_ALARM_DOOR_OPEN       "43"
+#define Event_ALARM_CP_STUCK_ON     "44"
+#define Event_ANOMALY_TEMP_DRIFT    "45"
+#define Event_ANOMALY_DUTY_CYCLE    "46"
 
 // define event code
 #define Log_MASTER_UPDATE_REQUEST   "20"
 #define Log_MASTER_UPDATE_SUCCESS   "21"
 #define Log_MASTER_UPDATE_FAILED    "22"
+#define Log_DUTY_CYCLE              "23"
 
 // define pulling command code
 #define PCMD_READ_SW_VERSION        "10"
@@ -68,6 +76,7 @@
 #define PCMD_SET_COMPRESSOR_OFF     "21"
 #define PCMD_SET_DOOR_EVALVE_ON     "22"
 #define PCMD_SET_DOOR_EVALVE_OFF    "23"
+#define PCMD_SET_TEMP_SETPOINT      "24"
 #define PCMD_MACHINE_INIT_REQUEST   "30"
 #define PCMD_MASTER_UPDATE_START    "31"
 #define PCMD_MASTER_UPDATE_SUCCESS  "32"
@@ -90,6 +99,11 @@
 #define PAYMENT_JCO_PAY             "18"
 
 class QNetworkAccessManager;
+class TelemetryPayload;
+class HttpCache;
+struct HttpCacheEntry;
+class ScanCache;
+class FileDownload;
 class QNetworkRequest;
 class QNetworkReply;
 
@@ -102,14 +116,40 @@ public:
     ~CmsApi();
 
     void setDebugEnabled(bool enabled);
+    bool isDebugEnabled() const;
 
+    // persistent stores: HttpCache for the machine, vendor and version infos,
+    // ScanCache for the barcode and love-code scans
+    void setCacheDir(QString dir);
+
+    // refreshes the most used cached scan codes before they expire
+    int prefetchScanCodes(QString machine_code, int max_count);
+
+    // bytes per second for file downloads, 0 is unlimited
+    void setDownloadRateLimit(qint64 bytes_per_sec);
+
+   // small files only, the reply is held in memory
    bool getUrlFileData(QString url, QByteArray *out_ba);
+   // streamed to file_path and resumed after a failure, see FileDownload
+   bool getUrlFileData(QString url, QString file_path, QByteArray sha256_hex = QByteArray());
+
+   // offline is set when the CMS could not be reached, a rejection leaves it false
+   bool getToken(QString machine_code, QByteArray *token, bool *offline = nullptr);
+
+   // building blocks for requests run in parallel, the caller owns the
+   // replies and hands the token to each request explicitly
+   QNetworkReply *requestToken(QString machine_code);
+   bool readToken(QNetworkReply *reply, QByteArray *token, bool *offline = nullptr);
+   // the last known reply, stale or not
+   bool lookupCached(QString machine_code, const QNetworkRequest &request, const QByteArray &request_data, QByteArray *reply_data, bool *fresh);
+   QNetworkReply *postWithToken(QString machine_code, QNetworkRequest request, const QByteArray &request_data, const QByteArray &token);
+   // revalidated is true for a 304, reply_data then holds the cached body
+   bool readCachedReply(QString machine_code, QNetworkReply *reply, const QByteArray &request_data, QByteArray *reply_data, bool *revalidated);
 
-   bool getToken(QString machine_code, QByteArray *token);
    bool getVendorInfos(QString machine_code, QByteArray *infos);
    bool getMachineInfos(QString machine_code, QByteArray *infos);
    bool getRemoteCommand(QString machine_code, QByteArray *cmds);
-   bool updateMonitoringInfos(QString machine_code, QMap<QString, QByteArray> info_map);
+   bool updateMonitoringInfos(QString machine_code, const TelemetryPayload &payload);
    bool updateTransactionInfos(QString machine_code, QMap<QString, QByteArray> info_map, QByteArray *resp_infos);
    bool updateSettlementInfos(QString machine_code, QMap<QString, QByteArray> info_map);
    bool getBarcodeInfos(QString machine_code, QString barcode, QByteArray *infos);
@@ -117,18 +157,37 @@ public:
    bool getVersionInfos(QString machine_code, QByteArray *infos);
    bool updateVersionInfos(QString machine_code, QString fw_ver, QString sw_ver);
    bool updateEventInfos(QString machine_code, QString event_code);
+   bool updateEventInfos(QString machine_code, QString event_code, QMap<QString, QString> parameters);
    bool updateMachineLog(QString machine_code, QString log_code, QMap<QString, QString> parameters);
    bool queryLoveCode(QString machine_code, QString love_code, QByteArray *infos);
 
+   const QByteArray &monitoringRequestData(QString machine_code, const TelemetryPayload &payload);
+
    bool getMohistToken(QString machine_code, QByteArray *token);
    bool useMohistVoucher(QString machine_code, QString voucher_barcode, bool unused = false);
 
+Q_SIGNALS:
+    void downloadProgress(qint64 received, qint64 total);
+
 private:
-   bool setRequestHeader(QString machine_code, QNetworkRequest* request);
-   bool postAndWaitForReply(QNetworkRequest request, QByteArray request_data, QByteArray *reply_data);
+   bool setRequestHeader(QString machine_code, QNetworkRequest* request, bool *offline = nullptr);
+   static void setBearer(const QByteArray &token, QNetworkRequest *request);
+   bool fetchBarcodeInfos(QString machine_code, QString barcode, QByteArray *infos, bool *offline);
+   bool fetchLoveCode(QString machine_code, QString love_code, QByteArray *infos, bool *offline);
+   bool postCached(QString machine_code, QNetworkRequest request, QByteArray request_data, QByteArray *reply_data);
+   bool storeReply(const QByteArray &key, HttpCacheEntry response, QByteArray *reply_data);
+   bool postAndWaitForReply(QNetworkRequest request, QByteArray request_data, QByteArray *reply_data, HttpCacheEntry *response = nullptr, bool *offline = nullptr);
 
 private:
     QNetworkAccessManager *network_manager_;
+    HttpCache *http_cache_;
+    ScanCache *scan_cache_;
+    FileDownload *file_download_;
+
+    // monitoring uploads reuse one body buffer and the escaped machine code
+    QString monitoring_code_;
+    QByteArray monitoring_head_;
+    QByteArray monitoring_body_;
 
     bool debug_enabled_ = true;
 };
@@ -0,0 +1,260 @@
+#include "cms_bootstrap.h"
+
+#include <QNetworkRequest>
+#include <QNetworkReply>
+#include <QTimer>
+#include <QJsonDocument>
+#include <QDebug>
+
+#include "cms_api.h"
+#include "metrics.h"
+
+static const char *const info_urls[CmsBootstrap::INFO_COUNT] = {
+    url_init, url_vendor_show, url_version_get
+};
+
+static const char *const info_names[CmsBootstrap::INFO_COUNT] = {
+    "machine", "vendor", "version"
+};
+
+// the same request as getMachineInfos and co, so they share the cache entries
+static QNetworkRequest infoRequest(int info, const QString &machine_code, QByteArray *request_data)
+{
+    QJsonObject request_obj;
+    if (info == CmsBootstrap::MACHINE_INFO) {
+        request_obj.insert("machine_code", machine_code);
+    }
+    *request_data = QJsonDocument(request_obj).toJson();
+
+    QNetworkRequest request((QUrl(info_urls[info])));
+    request.setHeader(QNetworkRequest::ContentLengthHeader, QByteArray::number(request_data->size()));
+    return request;
+}
+
+CmsBootstrap::CmsBootstrap(CmsApi *cms_api, QObject *parent)
+    : QObject(parent)
+    , cms_api_(cms_api)
+{
+    tmr_timeout_ = new QTimer(this);
+    tmr_timeout_->setSingleShot(true);
+    connect(tmr_timeout_, SIGNAL(timeout()), this, SLOT(timeout()));
+}
+
+CmsBootstrap::~CmsBootstrap()
+{
+
+}
+
+void CmsBootstrap::setTimeout(int msecs)
+{
+    timeout_ms_ = qMax(1000, msecs);
+}
+
+bool CmsBootstrap::start(QString machine_code)
+{
+    if (running_ || machine_code.isEmpty()) {
+        return false;
+    }
+
+    machine_code_ = machine_code;
+    running_ = true;
+    ready_ = false;
+    from_cache_ = false;
+    ready_ms_ = -1;
+    token_ms_ = -1;
+    total_ms_ = -1;
+    pending_ = 0;
+    clock_.start();
+
+    // serve the last known infos right away, stale ones are revalidated below
+    int cached = 0;
+    int fresh = 0;
+    for (int i = 0; i < INFO_COUNT; i++) {
+        QByteArray request_data;
+        QNetworkRequest request = infoRequest(i, machine_code_, &request_data);
+        bool is_fresh = false;
+        infos_[i].clear();
+        fetched_[i] = false;
+        cache_[i] = "miss";
+        info_ms_[i] = -1;
+        if (cms_api_->lookupCached(machine_code_, request, request_data, &infos_[i], &is_fresh)) {
+            cached++;
+            cache_[i] = "stale";
+            if (is_fresh) {
+                fresh++;
+                fetched_[i] = true;
+                cache_[i] = "fresh";
+                info_ms_[i] = 0;
+            }
+        }
+    }
+    if (cached == INFO_COUNT) {
+        markReady(true);
+    }
+    if (fresh == INFO_COUNT) {
+        finish(true);
+        return true;
+    }
+
+    token_reply_ = cms_api_->requestToken(machine_code_);
+    connect(token_reply_, SIGNAL(finished()), this, SLOT(tokenFinished()));
+    tmr_timeout_->start(timeout_ms_);
+    return true;
+}
+
+bool CmsBootstrap::isRunning() const
+{
+    return running_;
+}
+
+bool CmsBootstrap::isReady() const
+{
+    return ready_;
+}
+
+QByteArray CmsBootstrap::infos(Info info) const
+{
+    return infos_[info];
+}
+
+QJsonObject CmsBootstrap::report() const
+{
+    QJsonObject infos_obj;
+    for (int i = 0; i < INFO_COUNT; i++) {
+        QJsonObject info_obj;
+        info_obj.insert("fetched", fetched_[i]);
+        info_obj.insert("cache", cache_[i]);
+        info_obj.insert("ms", double(info_ms_[i]));
+        infos_obj.insert(info_names[i], info_obj);
+    }
+
+    QJsonObject report_obj;
+    report_obj.insert("machine_code", machine_code_);
+    report_obj.insert("source", (ready_ == false)? "none" : (from_cache_)? "cache" : "network");
+    report_obj.insert("ready_ms", double(ready_ms_));
+    report_obj.insert("token_ms", double(token_ms_));
+    report_obj.insert("total_ms", double(total_ms_));
+    report_obj.insert("infos", infos_obj);
+    return report_obj;
+}
+
+void CmsBootstrap::tokenFinished()
+{
+    QNetworkReply *reply = token_reply_;
+    token_reply_ = nullptr;
+    if (reply == nullptr) {
+        return;
+    }
+    token_ms_ = clock_.elapsed();
+
+    bool result = cms_api_->readToken(reply, &token_);
+    reply->deleteLater();
+    if (result == false) {
+        finish(false);
+        return;
+    }
+
+    // one token for all of them, they run in parallel
+    for (int i = 0; i < INFO_COUNT; i++) {
+        if (fetched_[i] == false) {
+            postInfo(Info(i));
+        }
+    }
+    tmr_timeout_->start(timeout_ms_);
+}
+
+void CmsBootstrap::infoFinished()
+{
+    QNetworkReply *reply = qobject_cast<QNetworkReply *>(sender());
+    int info = -1;
+    for (int i = 0; i < INFO_COUNT; i++) {
+        if (replies_[i] == reply) {
+            info = i;
+        }
+    }
+    if (reply == nullptr || info < 0) {
+        return;
+    }
+    replies_[info] = nullptr;
+    info_ms_[info] = clock_.elapsed() - info_ms_[info];
+
+    Metrics::increment(Metrics::CMS_REQUESTS);
+    Metrics::observe(Metrics::CMS_LATENCY, info_ms_[info] * 1000);
+    QByteArray request_data;
+    infoRequest(info, machine_code_, &request_data);
+    QByteArray reply_data;
+    bool revalidated = false;
+    if (cms_api_->readCachedReply(machine_code_, reply, request_data, &reply_data, &revalidated)) {
+        if (reply_data.indexOf("errors") < 0) {
+            infos_[info] = reply_data;
+            fetched_[info] = true;
+            cache_[info] = (revalidated)? "revalidated" : "miss";
+        }
+        else {
+            qDebug() << "[BOOT]" << info_names[info] << "infos error:" << QString(reply_data);
+        }
+    }
+    else {
+        qDebug() << "[BOOT]" << info_names[info] << "infos error:" << reply->error();
+        Metrics::increment(Metrics::CMS_ERRORS);
+    }
+    reply->deleteLater();
+
+    pending_--;
+    if (pending_ > 0) {
+        return;
+    }
+
+    bool result = true;
+    for (int i = 0; i < INFO_COUNT; i++) {
+        result = result && fetched_[i];
+    }
+    if (result && ready_ == false) {
+        markReady(false);
+    }
+    finish(result);
+}
+
+void CmsBootstrap::timeout()
+{
+    // aborting emits finished, the handlers above clean up
+    if (token_reply_ != nullptr) {
+        token_reply_->abort();
+    }
+    for (int i = 0; i < INFO_COUNT; i++) {
+        if (replies_[i] != nullptr) {
+            replies_[i]->abort();
+        }
+    }
+}
+
+void CmsBootstrap::postInfo(Info info)
+{
+    QByteArray request_data;
+    QNetworkRequest request = infoRequest(info, machine_code_, &request_data);
+
+    info_ms_[info] = clock_.elapsed();
+    replies_[info] = cms_api_->postWithToken(machine_code_, request, request_data, token_);
+    connect(replies_[info], SIGNAL(finished()), this, SLOT(infoFinished()));
+    pending_++;
+}
+
+void CmsBootstrap::markReady(bool from_cache)
+{
+    ready_ = true;
+    from_cache_ = from_cache;
+    ready_ms_ = clock_.elapsed();
+    Metrics::setGauge(Metrics::BOOTSTRAP_READY_MS, ready_ms_);
+    qDebug() << "[BOOT] ready from" << ((from_cache)? "cache" : "network") << "in" << ready_ms_ << "ms";
+    emit ready(from_cache);
+}
+
+void CmsBootstrap::finish(bool result)
+{
+    tmr_timeout_->stop();
+    total_ms_ = clock_.elapsed();
+    running_ = false;
+    token_.clear();
+    qDebug() << "[BOOT]" << QJsonDocument(report()).toJson(QJsonDocument::Compact);
+    emit finished(result);
+}
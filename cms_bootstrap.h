@@ -0,0 +1,80 @@
+#ifndef CMS_BOOTSTRAP_H
+#define CMS_BOOTSTRAP_H
+
+#include <QObject>
+#include <QElapsedTimer>
+#include <QJsonObject>
+
+class CmsApi;
+class QNetworkReply;
+class QTimer;
+
+// Startup fetch of the machine, vendor and version infos. The last known
+// infos in the CmsApi HTTP cache make the machine ready at once, stale
+// ones included. Whatever is not fresh is then revalidated: one token is
+// requested and the infos are posted in parallel with it, conditional
+// requests where a cached copy exists.
+class CmsBootstrap : public QObject
+{
+    Q_OBJECT
+
+public:
+    enum Info {
+        MACHINE_INFO,
+        VENDOR_INFO,
+        VERSION_INFO,
+        INFO_COUNT
+    };
+
+    CmsBootstrap(CmsApi *cms_api, QObject *parent = nullptr);
+    ~CmsBootstrap();
+
+    void setTimeout(int msecs);
+
+    bool start(QString machine_code);
+    bool isRunning() const;
+    bool isReady() const;
+
+    QByteArray infos(Info info) const;
+    QJsonObject report() const;
+
+Q_SIGNALS:
+    // from_cache is false if the infos came straight from the CMS
+    void ready(bool from_cache);
+    void finished(bool result);
+
+private slots:
+    void tokenFinished();
+    void infoFinished();
+    void timeout();
+
+private:
+    void postInfo(Info info);
+    void markReady(bool from_cache);
+    void finish(bool result);
+
+private:
+    CmsApi *cms_api_;
+    QTimer *tmr_timeout_;
+    QString machine_code_;
+    int timeout_ms_ = 10000;
+
+    QByteArray token_;
+    QNetworkReply *token_reply_ = nullptr;
+    QNetworkReply *replies_[INFO_COUNT] = {};
+    QByteArray infos_[INFO_COUNT];
+    bool fetched_[INFO_COUNT] = {};
+    const char *cache_[INFO_COUNT] = {};
+    qint64 info_ms_[INFO_COUNT] = {};
+    int pending_ = 0;
+
+    bool running_ = false;
+    bool ready_ = false;
+    bool from_cache_ = false;
+    QElapsedTimer clock_;
+    qint64 ready_ms_ = -1;
+    qint64 token_ms_ = -1;
+    qint64 total_ms_ = -1;
+};
+
+#endif // CMS_BOOTSTRAP_H
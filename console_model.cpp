@@ -0,0 +1,117 @@
+#include "console_model.h"
+
+ConsoleModel::ConsoleModel(int capacity, QObject *parent)
+    : QAbstractListModel(parent)
+    , capacity_(qMax(1, capacity))
+{
+    // allocate all slots once, memory use stays flat afterwards
+    lines_.resize(capacity_);
+}
+
+ConsoleModel::~ConsoleModel()
+{
+
+}
+
+int ConsoleModel::rowCount(const QModelIndex &parent) const
+{
+    if (parent.isValid()) {
+        return 0;
+    }
+    return count_;
+}
+
+QVariant ConsoleModel::data(const QModelIndex &index, int role) const
+{
+    if (index.isValid() == false || index.row() >= count_) {
+        return QVariant();
+    }
+
+    const Line &line = lines_.at((head_ + index.row()) % capacity_);
+    if (role == Qt::DisplayRole) {
+        return line.text;
+    }
+    if (role == DirectionRole) {
+        return (line.direction == TX)? QString("TX") : QString("RX");
+    }
+    return QVariant();
+}
+
+void ConsoleModel::appendLine(Direction direction, const QString &text)
+{
+    // hold the line back while the view is paused
+    if (paused_) {
+        if (pending_.size() >= capacity_) {
+            pending_.dequeue();
+            dropped_count_++;
+        }
+        pending_.enqueue({direction, text});
+        return;
+    }
+    insertLine(direction, text);
+}
+
+void ConsoleModel::clear()
+{
+    beginResetModel();
+    for (int i = 0; i < capacity_; i++) {
+        lines_[i].text.clear();
+    }
+    head_ = 0;
+    count_ = 0;
+    pending_.clear();
+    dropped_count_ = 0;
+    endResetModel();
+}
+
+void ConsoleModel::setPaused(bool paused)
+{
+    if (paused_ == paused) {
+        return;
+    }
+    paused_ = paused;
+
+    // flush the lines received while paused
+    if (paused_ == false) {
+        while (pending_.isEmpty() == false) {
+            Line line = pending_.dequeue();
+            insertLine(line.direction, line.text);
+        }
+    }
+}
+
+bool ConsoleModel::isPaused() const
+{
+    return paused_;
+}
+
+int ConsoleModel::capacity() const
+{
+    return capacity_;
+}
+
+int ConsoleModel::droppedCount() const
+{
+    return dropped_count_;
+}
+
+void ConsoleModel::insertLine(Direction direction, const QString &text)
+{
+    // drop the oldest line when the ring buffer is full
+    if (count_ == capacity_) {
+        beginRemoveRows(QModelIndex(), 0, 0);
+        lines_[head_].text.clear();
+        head_ = (head_ + 1) % capacity_;
+        count_--;
+        dropped_count_++;
+        endRemoveRows();
+    }
+
+    // write the new line into the next free slot
+    beginInsertRows(QModelIndex(), count_, count_);
+    Line &line = lines_[(head_ + count_) % capacity_];
+    line.direction = direction;
+    line.text = text;
+    count_++;
+    endInsertRows();
+}
@@ -0,0 +1,59 @@
+#ifndef CONSOLE_MODEL_H
+#define CONSOLE_MODEL_H
+
+#include <QAbstractListModel>
+#include <QVector>
+#include <QQueue>
+#include <QString>
+
+class ConsoleModel : public QAbstractListModel
+{
+    Q_OBJECT
+
+public:
+    enum Direction {
+        TX,
+        RX
+    };
+
+    enum Role {
+        DirectionRole = Qt::UserRole + 1
+    };
+
+public:
+    ConsoleModel(int capacity = 2000, QObject *parent = nullptr);
+    ~ConsoleModel();
+
+    int rowCount(const QModelIndex &parent = QModelIndex()) const override;
+    QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const override;
+
+    void appendLine(Direction direction, const QString &text);
+    void clear();
+
+    void setPaused(bool paused);
+    bool isPaused() const;
+    int capacity() const;
+    int droppedCount() const;
+
+private:
+    void insertLine(Direction direction, const QString &text);
+
+private:
+    struct Line {
+        Direction direction;
+        QString text;
+    };
+
+    // fixed capacity ring buffer, row 0 is the oldest line
+    QVector<Line> lines_;
+    int capacity_;
+    int head_ = 0;
+    int count_ = 0;
+
+    // lines received while paused, bounded by the same capacity
+    QQueue<Line> pending_;
+    bool paused_ = false;
+    int dropped_count_ = 0;
+};
+
+#endif // CONSOLE_MODEL_H
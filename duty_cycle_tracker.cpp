@@ -0,0 +1,235 @@
+#include "duty_cycle_tracker.h"
+
+#include <QFile>
+#include <QDateTime>
+#include <QJsonObject>
+#include <QJsonDocument>
+#include <QDebug>
+
+// closed periods waiting for the upload, two days of hours and the days
+#define DUTY_MAX_CLOSED     50
+
+QMap<QString, QString> DutySummary::parameters() const
+{
+    QMap<QString, QString> parameters;
+    parameters.insert("period", (period == DAY)? "day" : "hour");
+    parameters.insert("start", QDateTime::fromMSecsSinceEpoch(start_ms).toString(Qt::ISODate));
+    parameters.insert("covered_s", QString::number(covered_ms / 1000));
+    parameters.insert("cp_ratio", QString::number((covered_ms > 0)? double(cp_on_ms) / covered_ms : 0.0, 'f', 3));
+    parameters.insert("cp_cycles", QString::number(cp_cycles));
+    parameters.insert("cp_short_cycles", QString::number(cp_short_cycles));
+    parameters.insert("cp_run_avg_s", QString::number((cp_runs > 0)? cp_run_ms / cp_runs / 1000 : 0));
+    parameters.insert("cp_run_max_s", QString::number(cp_run_max_ms / 1000));
+    parameters.insert("door_ratio", QString::number((covered_ms > 0)? double(door_open_ms) / covered_ms : 0.0, 'f', 3));
+    parameters.insert("door_opens", QString::number(door_opens));
+    parameters.insert("door_open_s", QString::number(door_open_ms / 1000));
+    parameters.insert("door_open_max_s", QString::number(door_open_max_ms / 1000));
+    return parameters;
+}
+
+DutyCycleTracker::DutyCycleTracker()
+{
+
+}
+
+DutyCycleTracker::~DutyCycleTracker()
+{
+
+}
+
+void DutyCycleTracker::setLogDir(QString dir)
+{
+    log_dir_ = dir;
+}
+
+void DutyCycleTracker::setShortCycle(int secs)
+{
+    short_cycle_ms_ = qMax(1, secs) * 1000LL;
+}
+
+void DutyCycleTracker::setMaxGap(int secs)
+{
+    max_gap_ms_ = qMax(1, secs) * 1000LL;
+}
+
+void DutyCycleTracker::add(const TemperatureSample &sample)
+{
+    qint64 now = sample.timestamp;
+    bool cp_on = (sample.state & SAMPLE_STATE_CP);
+    bool door_on = (sample.state & SAMPLE_STATE_DOOR);
+
+    // a clock step back drops the open periods
+    if (last_timestamp_ >= 0 && now < last_timestamp_) {
+        for (int p = 0; p < DutySummary::PERIOD_COUNT; p++) {
+            open_[p].start_ms = -1;
+        }
+        last_timestamp_ = -1;
+    }
+
+    // the previous state holds until this sample
+    bool counted = (last_timestamp_ >= 0 && now - last_timestamp_ <= max_gap_ms_);
+    for (int p = 0; p < DutySummary::PERIOD_COUNT; p++) {
+        advance(p, (last_timestamp_ >= 0)? last_timestamp_ : now, now, counted);
+    }
+    if (counted == false) {
+        compressor_.known = false;
+        door_.known = false;
+    }
+
+    // compressor runs
+    if (compressor_.known && compressor_.on != cp_on) {
+        if (cp_on) {
+            for (int p = 0; p < DutySummary::PERIOD_COUNT; p++) {
+                open_[p].cp_cycles++;
+            }
+        }
+        else if (compressor_.since_ms >= 0) {
+            qint64 run_ms = now - compressor_.since_ms;
+            for (int p = 0; p < DutySummary::PERIOD_COUNT; p++) {
+                DutySummary &open = open_[p];
+                open.cp_runs++;
+                open.cp_run_ms += run_ms;
+                open.cp_run_max_ms = qMax(open.cp_run_max_ms, run_ms);
+                if (run_ms < short_cycle_ms_) {
+                    open.cp_short_cycles++;
+                }
+            }
+        }
+        compressor_.since_ms = now;
+    }
+    else if (compressor_.known == false) {
+        compressor_.since_ms = -1;
+    }
+    compressor_.known = true;
+    compressor_.on = cp_on;
+
+    // door openings
+    if (door_.known && door_.on != door_on) {
+        if (door_on) {
+            for (int p = 0; p < DutySummary::PERIOD_COUNT; p++) {
+                open_[p].door_opens++;
+            }
+        }
+        else if (door_.since_ms >= 0) {
+            qint64 open_ms = now - door_.since_ms;
+            for (int p = 0; p < DutySummary::PERIOD_COUNT; p++) {
+                open_[p].door_open_max_ms = qMax(open_[p].door_open_max_ms, open_ms);
+            }
+        }
+        door_.since_ms = now;
+    }
+    else if (door_.known == false) {
+        door_.since_ms = -1;
+    }
+    door_.known = true;
+    door_.on = door_on;
+
+    last_timestamp_ = now;
+}
+
+bool DutyCycleTracker::takeSummary(DutySummary *summary)
+{
+    if (closed_.isEmpty()) {
+        return false;
+    }
+    *summary = closed_.dequeue();
+    return true;
+}
+
+const DutySummary &DutyCycleTracker::current(DutySummary::Period period) const
+{
+    return open_[period];
+}
+
+void DutyCycleTracker::advance(int period, qint64 from_ms, qint64 to_ms, bool counted)
+{
+    DutySummary &open = open_[period];
+    if (open.start_ms < 0) {
+        openPeriod(period, (counted)? from_ms : to_ms);
+    }
+
+    // a gap closes the period without filling the hours in between
+    if (counted == false) {
+        if (to_ms >= open.end_ms) {
+            closePeriod(period);
+            openPeriod(period, to_ms);
+        }
+        return;
+    }
+
+    while (true) {
+        qint64 from = qMax(from_ms, open.start_ms);
+        qint64 to = qMin(to_ms, open.end_ms);
+        if (to > from) {
+            open.covered_ms += to - from;
+            if (compressor_.on) {
+                open.cp_on_ms += to - from;
+            }
+            if (door_.on) {
+                open.door_open_ms += to - from;
+            }
+        }
+        if (to_ms < open.end_ms) {
+            break;
+        }
+        qint64 end_ms = open.end_ms;
+        closePeriod(period);
+        openPeriod(period, end_ms);
+    }
+}
+
+void DutyCycleTracker::openPeriod(int period, qint64 at_ms)
+{
+    // local hours and days, like the daily logs
+    QDateTime at = QDateTime::fromMSecsSinceEpoch(at_ms);
+    DutySummary &open = open_[period];
+    open = DutySummary();
+    open.period = period;
+    if (period == DutySummary::DAY) {
+        open.start_ms = QDateTime(at.date(), QTime(0, 0)).toMSecsSinceEpoch();
+        open.end_ms = QDateTime(at.date().addDays(1), QTime(0, 0)).toMSecsSinceEpoch();
+    }
+    else {
+        open.start_ms = QDateTime(at.date(), QTime(at.time().hour(), 0)).toMSecsSinceEpoch();
+        open.end_ms = open.start_ms + 60 * 60 * 1000;
+    }
+}
+
+void DutyCycleTracker::closePeriod(int period)
+{
+    const DutySummary &open = open_[period];
+    if (open.covered_ms == 0) {
+        return;
+    }
+
+    writeLog(open);
+    if (closed_.size() >= DUTY_MAX_CLOSED) {
+        closed_.dequeue();
+    }
+    closed_.enqueue(open);
+}
+
+void DutyCycleTracker::writeLog(const DutySummary &summary)
+{
+    if (log_dir_.isEmpty()) {
+        return;
+    }
+
+    // written to the log of the day the period closed in, the day before
+    // may already be archived
+    QString file_path = QString("%1/duty_%2.txt").arg(log_dir_).arg(QDate::currentDate().toString("yyyyMMdd"));
+    QFile log_file(file_path);
+    if (log_file.open(QFile::WriteOnly | QFile::Append) == false) {
+        qDebug() << "[DUTY] open log file failed:" << file_path;
+        return;
+    }
+
+    QJsonObject summary_obj;
+    QMap<QString, QString> parameters = summary.parameters();
+    foreach (QString key, parameters.keys()) {
+        summary_obj.insert(key, parameters.value(key));
+    }
+    log_file.write(QJsonDocument(summary_obj).toJson(QJsonDocument::Compact));
+    log_file.write("\n");
+    log_file.close();
+}
@@ -0,0 +1,82 @@
+#ifndef DUTY_CYCLE_TRACKER_H
+#define DUTY_CYCLE_TRACKER_H
+
+#include <QString>
+#include <QMap>
+#include <QQueue>
+
+#include "sample_store.h"
+
+// compressor and door activity over one hour or one local day
+struct DutySummary
+{
+    enum Period {
+        HOUR,
+        DAY,
+        PERIOD_COUNT
+    };
+
+    int period = HOUR;
+    qint64 start_ms = -1;
+    qint64 end_ms = -1;
+    qint64 covered_ms = 0;          // time with samples, gaps are left out
+    qint64 cp_on_ms = 0;
+    int cp_cycles = 0;              // off to on
+    int cp_runs = 0;                // finished runs of a known length
+    int cp_short_cycles = 0;        // runs shorter than the short cycle limit
+    qint64 cp_run_ms = 0;
+    qint64 cp_run_max_ms = 0;
+    qint64 door_open_ms = 0;
+    int door_opens = 0;
+    qint64 door_open_max_ms = 0;
+
+    QMap<QString, QString> parameters() const;
+};
+
+// Follows the cp and door flags of every sample and keeps on-time, cycle
+// counts, short cycles and door-open durations per hour and per local day.
+// A state holds until the next sample, a gap longer than the limit is not
+// counted and breaks the current runs. Closed periods are appended to
+// <log dir>/duty_yyyyMMdd.txt and queued for upload.
+class DutyCycleTracker
+{
+public:
+    DutyCycleTracker();
+    ~DutyCycleTracker();
+
+    void setLogDir(QString dir);
+    void setShortCycle(int secs);
+    void setMaxGap(int secs);
+
+    void add(const TemperatureSample &sample);
+
+    // closed periods in order, at most two days of them are kept
+    bool takeSummary(DutySummary *summary);
+    const DutySummary &current(DutySummary::Period period) const;
+
+private:
+    struct Run {
+        bool known = false;
+        bool on = false;
+        qint64 since_ms = -1;       // -1 if the run started before the first sample
+    };
+
+    void advance(int period, qint64 from_ms, qint64 to_ms, bool counted);
+    void openPeriod(int period, qint64 at_ms);
+    void closePeriod(int period);
+    void writeLog(const DutySummary &summary);
+
+private:
+    QString log_dir_;
+    qint64 short_cycle_ms_ = 5 * 60 * 1000;
+    qint64 max_gap_ms_ = 10 * 60 * 1000;
+
+    DutySummary open_[DutySummary::PERIOD_COUNT];
+    QQueue<DutySummary> closed_;
+
+    qint64 last_timestamp_ = -1;
+    Run compressor_;
+    Run door_;
+};
+
+#endif // DUTY_CYCLE_TRACKER_H
@@ -0,0 +1,400 @@
+#include "file_download.h"
+
+#include <QNetworkAccessManager>
+#include <QNetworkRequest>
+#include <QNetworkReply>
+#include <QSaveFile>
+#include <QTimer>
+#include <QDebug>
+
+// the ETag or Last-Modified of the part, sent back as If-Range
+static QByteArray readValidator(const QString &file_path)
+{
+    QFile tag_file(file_path + ".part.tag");
+    if (tag_file.open(QFile::ReadOnly) == false) {
+        return QByteArray();
+    }
+    return tag_file.readAll().trimmed();
+}
+
+static void writeValidator(const QString &file_path, const QByteArray &validator)
+{
+    QFile tag_file(file_path + ".part.tag");
+    if (validator.isEmpty()) {
+        tag_file.remove();
+        return;
+    }
+    if (tag_file.open(QFile::WriteOnly | QFile::Truncate)) {
+        tag_file.write(validator);
+    }
+}
+
+FileDownload::FileDownload(QNetworkAccessManager *network_manager, QObject *parent)
+    : QObject(parent)
+    , network_manager_(network_manager)
+    , hash_(QCryptographicHash::Sha256)
+{
+    tmr_stall_ = new QTimer(this);
+    tmr_stall_->setSingleShot(true);
+    connect(tmr_stall_, SIGNAL(timeout()), this, SLOT(stalled()));
+
+    tmr_throttle_ = new QTimer(this);
+    tmr_throttle_->setSingleShot(true);
+    connect(tmr_throttle_, SIGNAL(timeout()), this, SLOT(replyReadyRead()));
+}
+
+FileDownload::~FileDownload()
+{
+    abort();
+}
+
+void FileDownload::setRateLimit(qint64 bytes_per_sec)
+{
+    // a few KiB/s at least, a pause for one chunk stays below the stall timeout
+    rate_limit_ = (bytes_per_sec > 0)? qMax<qint64>(bytes_per_sec, FILE_DOWNLOAD_CHUNK / 8) : 0;
+}
+
+void FileDownload::setStallTimeout(int msecs)
+{
+    stall_ms_ = qMax(10000, msecs);
+}
+
+void FileDownload::setRetries(int count)
+{
+    retries_ = qMax(0, count);
+}
+
+bool FileDownload::start(QString url, QString file_path, QByteArray sha256_hex)
+{
+    if (running_) {
+        return false;
+    }
+
+    url_ = url;
+    file_path_ = file_path;
+    sha256_hex_ = sha256_hex.trimmed().toLower();
+    total_ = -1;
+    attempt_ = 0;
+    aborted_ = false;
+    error_.clear();
+
+    // carry on from whatever an earlier run left behind
+    if (openPart(false) == false) {
+        error_ = part_file_.errorString();
+        qDebug() << "[DOWNLOAD] open failed:" << part_file_.fileName() << error_;
+        return false;
+    }
+    if (received_ > 0) {
+        qDebug() << "[DOWNLOAD] resuming" << url_ << "at" << received_;
+    }
+
+    running_ = true;
+    request();
+    return true;
+}
+
+void FileDownload::abort()
+{
+    if (running_ == false) {
+        return;
+    }
+
+    // aborting emits finished, the retry is skipped there
+    aborted_ = true;
+    if (reply_ != nullptr) {
+        reply_->abort();
+    }
+    else {
+        finish(false, "aborted");
+    }
+}
+
+bool FileDownload::isRunning() const
+{
+    return running_;
+}
+
+QString FileDownload::errorString() const
+{
+    return error_;
+}
+
+void FileDownload::replyMetaDataChanged()
+{
+    if (reply_ == nullptr) {
+        return;
+    }
+
+    int status = reply_->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    if (status == 206) {
+        // Content-Range: bytes <first>-<last>/<total>
+        QByteArray range = reply_->rawHeader("Content-Range");
+        qint64 first = range.mid(6, range.indexOf('-') - 6).trimmed().toLongLong();
+        qint64 total = range.mid(range.lastIndexOf('/') + 1).toLongLong();
+        if (range.startsWith("bytes ") == false || first != received_) {
+            qDebug() << "[DOWNLOAD] unexpected range" << range << ", restarting";
+            openPart(true);
+            reply_->abort();
+            return;
+        }
+        total_ = (total > 0)? total : -1;
+        accepted_ = true;
+    }
+    else if (status == 200) {
+        // the whole file, the part is gone or no longer matches
+        if (openPart(true) == false) {
+            error_ = part_file_.errorString();
+            aborted_ = true;
+            reply_->abort();
+            return;
+        }
+        QVariant length = reply_->header(QNetworkRequest::ContentLengthHeader);
+        total_ = (length.isValid())? length.toLongLong() : -1;
+        QByteArray validator = reply_->rawHeader("ETag");
+        if (validator.isEmpty() || validator.startsWith("W/")) {
+            validator = reply_->rawHeader("Last-Modified");
+        }
+        writeValidator(file_path_, validator);
+        accepted_ = true;
+    }
+}
+
+void FileDownload::replyReadyRead()
+{
+    if (reply_ == nullptr) {
+        return;
+    }
+
+    // an error body is dropped, it never reaches the part file
+    if (accepted_ == false) {
+        while (reply_->read(chunk_, sizeof(chunk_)) > 0) {
+        }
+        return;
+    }
+    readReply(false);
+}
+
+void FileDownload::replyFinished()
+{
+    QNetworkReply *reply = reply_;
+    if (reply == nullptr) {
+        return;
+    }
+
+    // the rest of the reply buffer, the limit only applies while receiving
+    QNetworkReply::NetworkError error = reply->error();
+    if (error == QNetworkReply::NoError && accepted_) {
+        readReply(true);
+    }
+    tmr_stall_->stop();
+    tmr_throttle_->stop();
+    reply_ = nullptr;
+    int status = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    QByteArray range = reply->rawHeader("Content-Range");
+    QString error_string = reply->errorString();
+    reply->deleteLater();
+    part_file_.flush();
+    reportProgress(true);
+
+    if (aborted_) {
+        finish(false, (error_.isEmpty())? QString("aborted") : error_);
+        return;
+    }
+
+    // the part already holds the whole file: 416 with Content-Range: bytes */<total>
+    bool complete = (error == QNetworkReply::NoError && accepted_ && (total_ < 0 || received_ == total_));
+    if (status == 416 && received_ > 0) {
+        if (range.startsWith("bytes */") && range.mid(8).trimmed().toLongLong() == received_) {
+            total_ = received_;
+            complete = true;
+        }
+    }
+
+    if (complete) {
+        part_file_.close();
+        QByteArray sha256_hex = hash_.result().toHex();
+        if (sha256_hex_.isEmpty() == false && sha256_hex != sha256_hex_) {
+            // a bad part is not worth resuming
+            QFile::remove(file_path_ + ".part");
+            writeValidator(file_path_, QByteArray());
+            finish(false, QString("sha256 mismatch: %1").arg(QString(sha256_hex)));
+            return;
+        }
+
+        if (replaceTarget() == false) {
+            finish(false, QString("replace failed: %1").arg(file_path_));
+            return;
+        }
+        QFile::remove(file_path_ + ".part");
+        writeValidator(file_path_, QByteArray());
+        finish(true, QString());
+        return;
+    }
+
+    // the part no longer matches the file on the server, start over
+    if (status == 416) {
+        openPart(true);
+    }
+
+    if (error == QNetworkReply::NoError) {
+        error_string = QString("incomplete, %1 of %2 bytes").arg(received_).arg(total_);
+    }
+    if (++attempt_ > retries_) {
+        finish(false, error_string);
+        return;
+    }
+    int delay_ms = qMin(attempt_ * 2000, 30000);
+    qDebug() << "[DOWNLOAD]" << error_string << ", retry" << attempt_ << "at" << received_ << "in" << delay_ms << "ms";
+    QTimer::singleShot(delay_ms, this, SLOT(request()));
+}
+
+void FileDownload::stalled()
+{
+    // no data for a while, a new request resumes where this one stopped
+    if (reply_ != nullptr) {
+        qDebug() << "[DOWNLOAD] stalled at" << received_;
+        reply_->abort();
+    }
+}
+
+void FileDownload::request()
+{
+    if (running_ == false || reply_ != nullptr) {
+        return;
+    }
+
+    QNetworkRequest request((QUrl(url_)));
+    request.setAttribute(QNetworkRequest::FollowRedirectsAttribute, true);
+    if (received_ > 0) {
+        request.setRawHeader("Range", "bytes=" + QByteArray::number(received_) + "-");
+        QByteArray validator = readValidator(file_path_);
+        if (validator.isEmpty() == false) {
+            request.setRawHeader("If-Range", validator);
+        }
+    }
+
+    accepted_ = false;
+    request_bytes_ = 0;
+    progress_ms_ = 0;
+    clock_.start();
+
+    reply_ = network_manager_->get(request);
+    if (rate_limit_ > 0) {
+        reply_->setReadBufferSize(FILE_DOWNLOAD_CHUNK * 4);
+    }
+    connect(reply_, SIGNAL(metaDataChanged()), this, SLOT(replyMetaDataChanged()));
+    connect(reply_, SIGNAL(readyRead()), this, SLOT(replyReadyRead()));
+    connect(reply_, SIGNAL(finished()), this, SLOT(replyFinished()));
+    tmr_stall_->start(stall_ms_);
+}
+
+bool FileDownload::openPart(bool restart)
+{
+    if (part_file_.isOpen()) {
+        part_file_.close();
+    }
+    part_file_.setFileName(file_path_ + ".part");
+    hash_.reset();
+    received_ = 0;
+    if (restart) {
+        writeValidator(file_path_, QByteArray());
+        total_ = -1;
+    }
+
+    QFile::OpenMode mode = QFile::ReadWrite;
+    if (restart) {
+        mode |= QFile::Truncate;
+    }
+    if (part_file_.open(mode) == false) {
+        return false;
+    }
+
+    // hash what is already there chunk by chunk, the file is never held in memory
+    qint64 size = 0;
+    while ((size = part_file_.read(chunk_, sizeof(chunk_))) > 0) {
+        hash_.addData(chunk_, int(size));
+        received_ += size;
+    }
+    return part_file_.seek(received_);
+}
+
+bool FileDownload::replaceTarget()
+{
+    // copied through a QSaveFile, the old file stays until the new one is whole
+    QFile part_file(file_path_ + ".part");
+    QSaveFile target_file(file_path_);
+    if (part_file.open(QFile::ReadOnly) == false || target_file.open(QFile::WriteOnly) == false) {
+        return false;
+    }
+
+    qint64 size = 0;
+    while ((size = part_file.read(chunk_, sizeof(chunk_))) > 0) {
+        if (target_file.write(chunk_, size) != size) {
+            target_file.cancelWriting();
+            break;
+        }
+    }
+    return (size == 0 && target_file.commit());
+}
+
+void FileDownload::readReply(bool drain)
+{
+    tmr_stall_->start(stall_ms_);
+    while (reply_->bytesAvailable() > 0) {
+        qint64 max_size = sizeof(chunk_);
+        if (rate_limit_ > 0 && drain == false) {
+            // one chunk of burst on top of the rate since the request started
+            qint64 budget = rate_limit_ * clock_.elapsed() / 1000 + qint64(sizeof(chunk_)) - request_bytes_;
+            if (budget <= 0) {
+                tmr_throttle_->start(int(qMax<qint64>(10, -budget * 1000 / rate_limit_ + 1)));
+                break;
+            }
+            max_size = qMin(max_size, budget);
+        }
+
+        qint64 size = reply_->read(chunk_, max_size);
+        if (size <= 0) {
+            break;
+        }
+        if (part_file_.write(chunk_, size) != size) {
+            error_ = part_file_.errorString();
+            aborted_ = true;
+            reply_->abort();
+            return;
+        }
+        hash_.addData(chunk_, int(size));
+        received_ += size;
+        request_bytes_ += size;
+    }
+    reportProgress(false);
+}
+
+void FileDownload::reportProgress(bool force)
+{
+    // a few updates per second are enough for a progress bar
+    qint64 now = clock_.elapsed();
+    if (force == false && now - progress_ms_ < 250) {
+        return;
+    }
+    progress_ms_ = now;
+    emit progress(received_, total_);
+}
+
+void FileDownload::finish(bool result, QString error)
+{
+    running_ = false;
+    tmr_stall_->stop();
+    tmr_throttle_->stop();
+    if (part_file_.isOpen()) {
+        part_file_.close();
+    }
+
+    error_ = error;
+    if (result) {
+        qDebug() << "[DOWNLOAD] done:" << file_path_ << received_ << "bytes";
+    }
+    else {
+        qDebug() << "[DOWNLOAD] failed:" << url_ << error_;
+    }
+    emit finished(result);
+}
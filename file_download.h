@@ -0,0 +1,88 @@
+#ifndef FILE_DOWNLOAD_H
+#define FILE_DOWNLOAD_H
+
+#include <QObject>
+#include <QFile>
+#include <QCryptographicHash>
+#include <QElapsedTimer>
+
+class QNetworkAccessManager;
+class QNetworkReply;
+class QTimer;
+
+#define FILE_DOWNLOAD_CHUNK     (16 * 1024)
+
+// Streams a url to <file>.part and moves it to <file> once complete and
+// verified. An interrupted download resumes from the size of the part file
+// with a Range request, If-Range keeps a changed file from being stitched
+// to the old part. The SHA-256 is updated as the data arrives, so memory
+// use does not depend on the file size. With a rate limit the reply buffer
+// is kept small and reading is paused, TCP flow control slows the sender.
+class FileDownload : public QObject
+{
+    Q_OBJECT
+
+public:
+    FileDownload(QNetworkAccessManager *network_manager, QObject *parent = nullptr);
+    ~FileDownload();
+
+    // bytes per second, 0 is unlimited
+    void setRateLimit(qint64 bytes_per_sec);
+    void setStallTimeout(int msecs);
+    void setRetries(int count);
+
+    // sha256_hex is optional, without it the file is not verified
+    bool start(QString url, QString file_path, QByteArray sha256_hex = QByteArray());
+    void abort();
+
+    bool isRunning() const;
+    QString errorString() const;
+
+Q_SIGNALS:
+    void progress(qint64 received, qint64 total);
+    void finished(bool result);
+
+private slots:
+    void replyMetaDataChanged();
+    void replyReadyRead();
+    void replyFinished();
+    void stalled();
+    void request();
+
+private:
+    bool openPart(bool restart);
+    bool replaceTarget();
+    void readReply(bool drain);
+    void reportProgress(bool force);
+    void finish(bool result, QString error);
+
+private:
+    QNetworkAccessManager *network_manager_;
+    QTimer *tmr_stall_;
+    QTimer *tmr_throttle_;
+    QNetworkReply *reply_ = nullptr;
+    qint64 rate_limit_ = 0;
+    int stall_ms_ = 30000;
+    int retries_ = 5;
+
+    QString url_;
+    QString file_path_;
+    QByteArray sha256_hex_;
+    QFile part_file_;
+    QCryptographicHash hash_;
+    qint64 received_ = 0;
+    qint64 total_ = -1;
+    int attempt_ = 0;
+    bool accepted_ = false;
+    bool aborted_ = false;
+    bool running_ = false;
+    QString error_;
+
+    // throttle budget counts from the start of the current request
+    QElapsedTimer clock_;
+    qint64 request_bytes_ = 0;
+    qint64 progress_ms_ = 0;
+    char chunk_[FILE_DOWNLOAD_CHUNK];
+};
+
+#endif // FILE_DOWNLOAD_H
@@ -0,0 +1,183 @@
+#include "http_cache.h"
+
+#include <QUrl>
+#include <QNetworkRequest>
+#include <QNetworkReply>
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QSaveFile>
+#include <QJsonObject>
+#include <QJsonDocument>
+#include <QLocale>
+#include <QDebug>
+
+// entries kept in memory, the rest is read back from disk when needed
+#define HTTP_CACHE_MEMORY_ENTRIES   256
+
+HttpCache::HttpCache()
+{
+
+}
+
+HttpCache::~HttpCache()
+{
+
+}
+
+void HttpCache::setDir(QString dir)
+{
+    dir_ = dir;
+    entries_.clear();
+    if (dir_.isEmpty() == false) {
+        QDir().mkpath(dir_);
+    }
+}
+
+QByteArray HttpCache::key(const QString &machine_code, const QUrl &url, const QByteArray &request_data)
+{
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    hash.addData(machine_code.toUtf8());
+    hash.addData("\n");
+    hash.addData(url.toEncoded());
+    hash.addData("\n");
+    hash.addData(request_data);
+    return hash.result().toHex();
+}
+
+bool HttpCache::lookup(const QByteArray &key, HttpCacheEntry *entry)
+{
+    if (entries_.contains(key)) {
+        *entry = entries_.value(key);
+        return true;
+    }
+    if (dir_.isEmpty()) {
+        return false;
+    }
+
+    QFile entry_file(filePath(key));
+    if (entry_file.open(QFile::ReadOnly) == false) {
+        return false;
+    }
+    QJsonObject entry_obj = QJsonDocument::fromJson(entry_file.readAll()).object();
+    if (entry_obj.contains("body") == false) {
+        return false;
+    }
+
+    entry->status = 200;
+    entry->etag = entry_obj.value("etag").toString().toUtf8();
+    entry->last_modified = entry_obj.value("last_modified").toString().toUtf8();
+    entry->expires_ms = qint64(entry_obj.value("expires_ms").toDouble());
+    entry->body = QByteArray::fromBase64(entry_obj.value("body").toString().toLatin1());
+    entry->no_store = false;
+
+    if (entries_.size() >= HTTP_CACHE_MEMORY_ENTRIES) {
+        entries_.clear();
+    }
+    entries_.insert(key, *entry);
+    return true;
+}
+
+void HttpCache::store(const QByteArray &key, const HttpCacheEntry &entry)
+{
+    // nothing to revalidate with and already stale, not worth keeping
+    if (entry.no_store || (entry.etag.isEmpty() && entry.last_modified.isEmpty() && isFresh(entry) == false)) {
+        remove(key);
+        return;
+    }
+
+    if (entries_.size() >= HTTP_CACHE_MEMORY_ENTRIES && entries_.contains(key) == false) {
+        entries_.clear();
+    }
+    entries_.insert(key, entry);
+    if (dir_.isEmpty()) {
+        return;
+    }
+
+    QJsonObject entry_obj;
+    entry_obj.insert("etag", QString::fromUtf8(entry.etag));
+    entry_obj.insert("last_modified", QString::fromUtf8(entry.last_modified));
+    entry_obj.insert("expires_ms", double(entry.expires_ms));
+    entry_obj.insert("body", QString::fromLatin1(entry.body.toBase64()));
+
+    QString file_path = filePath(key);
+    QSaveFile entry_file(file_path);
+    if (entry_file.open(QFile::WriteOnly) == false) {
+        qDebug() << "[CACHE] write entry failed:" << file_path;
+        return;
+    }
+    entry_file.write(QJsonDocument(entry_obj).toJson(QJsonDocument::Compact));
+    if (entry_file.commit() == false) {
+        qDebug() << "[CACHE] write entry failed:" << file_path;
+    }
+}
+
+void HttpCache::remove(const QByteArray &key)
+{
+    entries_.remove(key);
+    if (dir_.isEmpty() == false) {
+        QFile::remove(filePath(key));
+    }
+}
+
+bool HttpCache::isFresh(const HttpCacheEntry &entry)
+{
+    return entry.expires_ms > QDateTime::currentMSecsSinceEpoch();
+}
+
+void HttpCache::addValidators(const HttpCacheEntry &entry, QNetworkRequest *request)
+{
+    if (entry.etag.isEmpty() == false) {
+        request->setRawHeader("If-None-Match", entry.etag);
+    }
+    if (entry.last_modified.isEmpty() == false) {
+        request->setRawHeader("If-Modified-Since", entry.last_modified);
+    }
+}
+
+void HttpCache::readResponse(QNetworkReply *reply, HttpCacheEntry *entry)
+{
+    entry->status = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    entry->etag = reply->rawHeader("ETag");
+    entry->last_modified = reply->rawHeader("Last-Modified");
+    entry->expires_ms = 0;
+    entry->no_store = false;
+
+    // max-age sets the freshness, no-cache revalidates every time
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
+    bool no_cache = false;
+    bool has_max_age = false;
+    foreach (QByteArray directive, reply->rawHeader("Cache-Control").split(',')) {
+        directive = directive.trimmed().toLower();
+        if (directive == "no-store") {
+            entry->no_store = true;
+        }
+        else if (directive == "no-cache") {
+            no_cache = true;
+        }
+        else if (directive.startsWith("max-age=")) {
+            entry->expires_ms = now + directive.mid(8).toLongLong() * 1000;
+            has_max_age = true;
+        }
+    }
+
+    // Expires only counts without max-age
+    if (has_max_age == false && reply->hasRawHeader("Expires")) {
+        // RFC 1123 date, e.g. Sun, 06 Nov 1994 08:49:37 GMT
+        QDateTime expires = QLocale::c().toDateTime(QString::fromLatin1(reply->rawHeader("Expires").trimmed().left(25)),
+                                                    "ddd, dd MMM yyyy hh:mm:ss");
+        if (expires.isValid()) {
+            expires.setTimeSpec(Qt::UTC);
+            entry->expires_ms = expires.toMSecsSinceEpoch();
+        }
+    }
+    if (no_cache) {
+        entry->expires_ms = 0;
+    }
+}
+
+QString HttpCache::filePath(const QByteArray &key) const
+{
+    return QString("%1/%2.json").arg(dir_).arg(QString::fromLatin1(key));
+}
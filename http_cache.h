@@ -0,0 +1,57 @@
+#ifndef HTTP_CACHE_H
+#define HTTP_CACHE_H
+
+#include <QString>
+#include <QByteArray>
+#include <QHash>
+
+class QUrl;
+class QNetworkRequest;
+class QNetworkReply;
+
+// one cached CMS response, or the caching headers of a new one
+struct HttpCacheEntry
+{
+    int status = 0;
+    QByteArray etag;
+    QByteArray last_modified;
+    QByteArray body;
+    qint64 expires_ms = 0;      // fresh until, msecs since epoch
+    bool no_store = false;
+};
+
+// Conditional-request cache for CMS resources that rarely change: the
+// machine, vendor and version infos. Barcode and love-code scans are not
+// kept here, ScanCache is their only cache. The CMS answers POST requests, so entries are keyed by the machine code, the url
+// and the request body. A fresh entry (Cache-Control max-age) is served
+// without a request, a stale one is revalidated with If-None-Match and
+// If-Modified-Since and a 304 costs no body. Entries are kept as one file
+// each, the memory copy is only a bounded working set.
+class HttpCache
+{
+public:
+    HttpCache();
+    ~HttpCache();
+
+    // empty keeps the entries in memory only
+    void setDir(QString dir);
+
+    static QByteArray key(const QString &machine_code, const QUrl &url, const QByteArray &request_data);
+
+    bool lookup(const QByteArray &key, HttpCacheEntry *entry);
+    void store(const QByteArray &key, const HttpCacheEntry &entry);
+    void remove(const QByteArray &key);
+
+    static bool isFresh(const HttpCacheEntry &entry);
+    static void addValidators(const HttpCacheEntry &entry, QNetworkRequest *request);
+    static void readResponse(QNetworkReply *reply, HttpCacheEntry *entry);
+
+private:
+    QString filePath(const QByteArray &key) const;
+
+private:
+    QString dir_;
+    QHash<QByteArray, HttpCacheEntry> entries_;
+};
+
+#endif // HTTP_CACHE_H
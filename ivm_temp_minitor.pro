@@ -9,19 +9,78 @@ CONFIG += c++11
 #DEFINES += QT_DISABLE_DEPRECATED_BEFORE=0x060000    # disables all the APIs deprecated before Qt 6.0.0
 DEFINES += _DEV_STAGE_
 SOURCES += \
+    alarm_engine.cpp \
+    anomaly_detector.cpp \
     cms_api.cpp \
+    cms_bootstrap.cpp \
+    console_model.cpp \
+    duty_cycle_tracker.cpp \
+    file_download.cpp \
+    http_cache.cpp \
+    lane_profiler.cpp \
+    latency_trace.cpp \
+    log_archiver.cpp \
     main.cpp \
     main_window.cpp \
-    vm_controller.cpp
+    metrics.cpp \
+    metrics_server.cpp \
+    port_watcher.cpp \
+    sample_store.cpp \
+    scan_cache.cpp \
+    serial_replay.cpp \
+    serial_trace.cpp \
+    telemetry_payload.cpp \
+    telemetry_sampler.cpp \
+    temperature_chart.cpp \
+    thermostat_controller.cpp \
+    vend_job.cpp \
+    vm_controller.cpp \
+    vmc_emulator.cpp \
+    vmc_protocol.cpp \
+    vmc_stress_test.cpp \
+    windowed_stats.cpp
 
 HEADERS += \
+    alarm_engine.h \
+    anomaly_detector.h \
     cms_api.h \
+    cms_bootstrap.h \
+    console_model.h \
+    duty_cycle_tracker.h \
+    file_download.h \
+    http_cache.h \
+    lane_profiler.h \
+    latency_trace.h \
+    log_archiver.h \
     main_window.h \
-    vm_controller.h
+    metrics.h \
+    metrics_server.h \
+    port_watcher.h \
+    sample_store.h \
+    scan_cache.h \
+    serial_replay.h \
+    serial_trace.h \
+    telemetry_payload.h \
+    telemetry_sampler.h \
+    temperature_chart.h \
+    thermostat_controller.h \
+    vend_job.h \
+    vm_controller.h \
+    vmc_emulator.h \
+    vmc_protocol.h \
+    vmc_stress_test.h \
+    windowed_stats.h
 
 FORMS += \
     main_window.ui
 
+# protocol microbenchmarks, build with "qmake CONFIG+=benchmark" and run with --bench
+CONFIG(benchmark) {
+    DEFINES += _BENCHMARK_
+    SOURCES += protocol_bench.cpp
+    HEADERS += protocol_bench.h
+}
+
 # Default rules for deployment.
 qnx: target.path = /tmp/$${TARGET}/bin
 else: unix:!android: target.path = /opt/$${TARGET}/bin
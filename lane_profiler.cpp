@@ -0,0 +1,227 @@
+#include "lane_profiler.h"
+
+#include <QFile>
+#include <QSaveFile>
+#include <QJsonDocument>
+#include <QJsonArray>
+#include <QDateTime>
+#include <QDebug>
+
+#include "vm_controller.h"
+
+// upper bounds in msecs
+static const qint64 bucket_bounds[LANE_BUCKET_COUNT] = {
+    100, 250, 500, 1000, 2000, 5000, 10000, 20000, 60000, 120000
+};
+
+static const char *const phase_names[LaneProfiler::PHASE_COUNT] = {
+    "ok", "op", "done", "retry", "cars", "cdos"
+};
+
+static const char *const failure_names[LaneProfiler::FAILURE_COUNT] = {
+    "drop", "cargo", "door", "not_pickup", "timeout"
+};
+
+LaneProfiler::LaneProfiler()
+{
+
+}
+
+LaneProfiler::~LaneProfiler()
+{
+    save();
+}
+
+bool LaneProfiler::setFile(QString file_path)
+{
+    file_path_ = file_path;
+    lanes_.clear();
+
+    QFile profile_file(file_path_);
+    if (profile_file.exists() == false) {
+        return true;
+    }
+    if (profile_file.open(QFile::ReadOnly) == false) {
+        qDebug() << "[LANE] open profile failed:" << file_path_;
+        return false;
+    }
+
+    QJsonParseError parse_error;
+    QJsonObject profile_obj = QJsonDocument::fromJson(profile_file.readAll(), &parse_error).object();
+    if (parse_error.error != QJsonParseError::NoError) {
+        qDebug() << "[LANE] parse profile failed:" << parse_error.errorString();
+        return false;
+    }
+    fromJson(profile_obj);
+    return true;
+}
+
+bool LaneProfiler::save()
+{
+    if (file_path_.isEmpty()) {
+        return false;
+    }
+
+    QSaveFile profile_file(file_path_);
+    if (profile_file.open(QFile::WriteOnly) == false) {
+        qDebug() << "[LANE] save profile failed:" << file_path_;
+        return false;
+    }
+    profile_file.write(QJsonDocument(toJson()).toJson(QJsonDocument::Compact));
+    return profile_file.commit();
+}
+
+void LaneProfiler::beginChannel(int ch1_row, int ch1_col, int ch2_row, int ch2_col, bool continuing)
+{
+    if (continuing == false) {
+        batch_lanes_.clear();
+    }
+
+    drop_lanes_.clear();
+    drop_lanes_.append(qMakePair(ch1_row, ch1_col));
+    if (ch2_row >= 0 && ch2_col >= 0) {
+        drop_lanes_.append(qMakePair(ch2_row, ch2_col));
+    }
+    for (int i = 0; i < drop_lanes_.size(); i++) {
+        lanes_[drop_lanes_.at(i)].vends++;
+    }
+}
+
+void LaneProfiler::phaseFinished(int state, qint64 usecs, bool result, int result_state)
+{
+    Phase phase;
+    switch (state) {
+    case VMController::WAIT_CH_OK:      phase = PHASE_OK;       break;
+    case VMController::WAIT_CH_OP:      phase = PHASE_OP;       break;
+    case VMController::WAIT_CH_DONE:    phase = PHASE_DONE;     break;
+    case VMController::WAIT_CH_RETRY:   phase = PHASE_RETRY;    break;
+    case VMController::WAIT_CARS:       phase = PHASE_CARS;     break;
+    case VMController::WAIT_CDOS:       phase = PHASE_CDOS;     break;
+    default:
+        return;
+    }
+
+    int failure = -1;
+    if (result == false) {
+        switch (result_state) {
+        case VMController::ERROR_DROP:          failure = FAIL_DROP;        break;
+        case VMController::ERROR_CARGO:         failure = FAIL_CARGO;       break;
+        case VMController::ERROR_DOOR:          failure = FAIL_DOOR;        break;
+        case VMController::WARNING_NOT_PICKUP:  failure = FAIL_NOT_PICKUP;  break;
+        case VMController::ERROR_TIMEOUT:       failure = FAIL_TIMEOUT;     break;
+        default:
+            break;
+        }
+    }
+
+    // the pickup and door checks belong to every lane of the batch
+    const QList<Lane> &lanes = (phase == PHASE_CARS || phase == PHASE_CDOS)? batch_lanes_ : drop_lanes_;
+    qint64 msecs = usecs / 1000;
+    int bucket = 0;
+    while (bucket < LANE_BUCKET_COUNT && msecs > bucket_bounds[bucket]) {
+        bucket++;
+    }
+    for (int i = 0; i < lanes.size(); i++) {
+        LaneStats &lane = lanes_[lanes.at(i)];
+        PhaseStats &stats = lane.phases[phase];
+        stats.buckets[bucket]++;
+        stats.count++;
+        stats.sum_ms += msecs;
+        stats.max_ms = qMax(stats.max_ms, msecs);
+        if (failure >= 0) {
+            lane.failures[failure]++;
+        }
+    }
+
+    // a completed drop waits with the batch for the pickup
+    if (result && (phase == PHASE_DONE || phase == PHASE_RETRY)) {
+        batch_lanes_.append(drop_lanes_);
+        drop_lanes_.clear();
+    }
+
+    // the sequence is over, keep the counts
+    if (phase == PHASE_CDOS || failure >= 0) {
+        if (phase == PHASE_CDOS) {
+            batch_lanes_.clear();
+        }
+        save();
+    }
+}
+
+QJsonObject LaneProfiler::toJson() const
+{
+    QJsonArray bounds_array;
+    for (int i = 0; i < LANE_BUCKET_COUNT; i++) {
+        bounds_array.append(double(bucket_bounds[i]));
+    }
+
+    QJsonObject lanes_obj;
+    for (QMap<Lane, LaneStats>::const_iterator it = lanes_.constBegin(); it != lanes_.constEnd(); ++it) {
+        const LaneStats &lane = it.value();
+
+        QJsonObject phases_obj;
+        for (int phase = 0; phase < PHASE_COUNT; phase++) {
+            const PhaseStats &stats = lane.phases[phase];
+            if (stats.count == 0) {
+                continue;
+            }
+            QJsonArray buckets_array;
+            for (int i = 0; i <= LANE_BUCKET_COUNT; i++) {
+                buckets_array.append(double(stats.buckets[i]));
+            }
+            QJsonObject phase_obj;
+            phase_obj.insert("count", double(stats.count));
+            phase_obj.insert("sum_ms", double(stats.sum_ms));
+            phase_obj.insert("max_ms", double(stats.max_ms));
+            phase_obj.insert("buckets", buckets_array);
+            phases_obj.insert(phase_names[phase], phase_obj);
+        }
+
+        QJsonObject failures_obj;
+        for (int failure = 0; failure < FAILURE_COUNT; failure++) {
+            failures_obj.insert(failure_names[failure], double(lane.failures[failure]));
+        }
+
+        QJsonObject lane_obj;
+        lane_obj.insert("row", it.key().first);
+        lane_obj.insert("col", it.key().second);
+        lane_obj.insert("vends", double(lane.vends));
+        lane_obj.insert("phases", phases_obj);
+        lane_obj.insert("failures", failures_obj);
+        lanes_obj.insert(QString("%1-%2").arg(it.key().first).arg(it.key().second), lane_obj);
+    }
+
+    QJsonObject profile_obj;
+    profile_obj.insert("updated", QDateTime::currentDateTime().toString(Qt::ISODate));
+    profile_obj.insert("bucket_bounds_ms", bounds_array);
+    profile_obj.insert("lanes", lanes_obj);
+    return profile_obj;
+}
+
+void LaneProfiler::fromJson(const QJsonObject &profile_obj)
+{
+    QJsonObject lanes_obj = profile_obj.value("lanes").toObject();
+    foreach (QString key, lanes_obj.keys()) {
+        QJsonObject lane_obj = lanes_obj.value(key).toObject();
+        LaneStats &lane = lanes_[qMakePair(lane_obj.value("row").toInt(), lane_obj.value("col").toInt())];
+        lane.vends = qint64(lane_obj.value("vends").toDouble());
+
+        QJsonObject phases_obj = lane_obj.value("phases").toObject();
+        for (int phase = 0; phase < PHASE_COUNT; phase++) {
+            QJsonObject phase_obj = phases_obj.value(phase_names[phase]).toObject();
+            PhaseStats &stats = lane.phases[phase];
+            stats.count = qint64(phase_obj.value("count").toDouble());
+            stats.sum_ms = qint64(phase_obj.value("sum_ms").toDouble());
+            stats.max_ms = qint64(phase_obj.value("max_ms").toDouble());
+            QJsonArray buckets_array = phase_obj.value("buckets").toArray();
+            for (int i = 0; i <= LANE_BUCKET_COUNT && i < buckets_array.size(); i++) {
+                stats.buckets[i] = qint64(buckets_array.at(i).toDouble());
+            }
+        }
+
+        QJsonObject failures_obj = lane_obj.value("failures").toObject();
+        for (int failure = 0; failure < FAILURE_COUNT; failure++) {
+            lane.failures[failure] = qint64(failures_obj.value(failure_names[failure]).toDouble());
+        }
+    }
+}
@@ -0,0 +1,78 @@
+#ifndef LANE_PROFILER_H
+#define LANE_PROFILER_H
+
+#include <QString>
+#include <QMap>
+#include <QPair>
+#include <QList>
+#include <QJsonObject>
+
+#define LANE_BUCKET_COUNT   10
+
+// Per-lane timing of every vend phase and counters of the lane errors,
+// kept in a JSON file so slow motors and jam-prone lanes show up over days.
+// CARS and CDOS are shared by all lanes dropped since the last door check.
+class LaneProfiler
+{
+public:
+    enum Phase {
+        PHASE_OK,
+        PHASE_OP,
+        PHASE_DONE,
+        PHASE_RETRY,
+        PHASE_CARS,
+        PHASE_CDOS,
+        PHASE_COUNT
+    };
+
+    enum Failure {
+        FAIL_DROP,
+        FAIL_CARGO,
+        FAIL_DOOR,
+        FAIL_NOT_PICKUP,
+        FAIL_TIMEOUT,
+        FAILURE_COUNT
+    };
+
+    LaneProfiler();
+    ~LaneProfiler();
+
+    // loads the previous counts if the file exists
+    bool setFile(QString file_path);
+    bool save();
+
+    // continuing adds the lanes to the batch waiting for CARS/CDOS
+    void beginChannel(int ch1_row, int ch1_col, int ch2_row, int ch2_col, bool continuing);
+
+    // state is the VMController::State that was left, result_state the one
+    // it moved to; a timeout passes ERROR_TIMEOUT
+    void phaseFinished(int state, qint64 usecs, bool result, int result_state);
+
+    QJsonObject toJson() const;
+
+private:
+    struct PhaseStats {
+        qint64 buckets[LANE_BUCKET_COUNT + 1] = {};     // last one is +Inf
+        qint64 count = 0;
+        qint64 sum_ms = 0;
+        qint64 max_ms = 0;
+    };
+
+    struct LaneStats {
+        PhaseStats phases[PHASE_COUNT];
+        qint64 failures[FAILURE_COUNT] = {};
+        qint64 vends = 0;
+    };
+
+    typedef QPair<int, int> Lane;
+
+    void fromJson(const QJsonObject &profile_obj);
+
+private:
+    QString file_path_;
+    QMap<Lane, LaneStats> lanes_;
+    QList<Lane> drop_lanes_;
+    QList<Lane> batch_lanes_;
+};
+
+#endif // LANE_PROFILER_H
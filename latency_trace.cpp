@@ -0,0 +1,77 @@
+#include "latency_trace.h"
+
+#include <QElapsedTimer>
+#include <QStringList>
+#include <QDebug>
+
+#include <atomic>
+
+#include "metrics.h"
+
+LatencyTrace::LatencyTrace()
+{
+    for (int i = 0; i < STAGE_COUNT; i++) {
+        stamps[i] = -1;
+    }
+}
+
+void LatencyTrace::stamp(Stage stage)
+{
+    stamps[stage] = now();
+}
+
+void LatencyTrace::stamp(Stage stage, qint64 usecs)
+{
+    stamps[stage] = usecs;
+}
+
+void LatencyTrace::finish(bool log) const
+{
+    QStringList deltas;
+
+    // each stage is measured from the latest stage reached before it
+    qint64 previous = stamps[TPAL_TX];
+    for (int stage = FRAME_COMPLETE; stage < STAGE_COUNT; stage++) {
+        if (stamps[stage] < 0) {
+            continue;
+        }
+        if (previous >= 0) {
+            qint64 delta_us = stamps[stage] - previous;
+            Metrics::observe(Metrics::Histogram(Metrics::STAGE_FRAME_COMPLETE + stage - FRAME_COMPLETE), delta_us);
+            if (log) {
+                deltas.append(QString("%1 %2").arg(stageName(stage)).arg(delta_us / 1000.0, 0, 'f', 1));
+            }
+        }
+        previous = stamps[stage];
+    }
+
+    if (stamps[TPAL_TX] >= 0 && stamps[HTTP_ACK] >= 0) {
+        Metrics::observe(Metrics::STAGE_TOTAL, stamps[HTTP_ACK] - stamps[TPAL_TX]);
+    }
+    if (log) {
+        qDebug() << "[TRACE]" << id << deltas.join(", ") << "ms";
+    }
+}
+
+quint64 LatencyTrace::nextId()
+{
+    static std::atomic<quint64> last_id(0);
+    return ++last_id;
+}
+
+qint64 LatencyTrace::now()
+{
+    static QElapsedTimer clock;
+    if (clock.isValid() == false) {
+        clock.start();
+    }
+    return clock.nsecsElapsed() / 1000;
+}
+
+const char *LatencyTrace::stageName(int stage)
+{
+    static const char *const names[STAGE_COUNT] = {
+        "tpal_tx", "frame_complete", "decode", "log_write", "enqueue", "http_send", "http_ack"
+    };
+    return (stage >= 0 && stage < STAGE_COUNT)? names[stage] : "unknown";
+}
@@ -0,0 +1,37 @@
+#ifndef LATENCY_TRACE_H
+#define LATENCY_TRACE_H
+
+#include <QtGlobal>
+
+// Monotonic stage timestamps of one temperature sample, from the TPAL
+// request to the CMS acknowledgment. The deltas between consecutive
+// stages are exported as Metrics histograms when the trace finishes.
+struct LatencyTrace
+{
+    enum Stage {
+        TPAL_TX,
+        FRAME_COMPLETE,
+        DECODE,
+        LOG_WRITE,
+        ENQUEUE,
+        HTTP_SEND,
+        HTTP_ACK,
+        STAGE_COUNT
+    };
+
+    quint64 id = 0;
+    qint64 stamps[STAGE_COUNT];     // usecs on the monotonic clock, -1 if not reached
+
+    LatencyTrace();
+
+    void stamp(Stage stage);
+    void stamp(Stage stage, qint64 usecs);
+    // the [TRACE] line is only logged with log set
+    void finish(bool log) const;
+
+    static quint64 nextId();
+    static qint64 now();
+    static const char *stageName(int stage);
+};
+
+#endif // LATENCY_TRACE_H
@@ -0,0 +1,415 @@
+#include "log_archiver.h"
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QMap>
+#include <QDate>
+#include <QElapsedTimer>
+#include <QRegularExpression>
+#include <QtEndian>
+#include <QDebug>
+
+#ifdef Q_OS_UNIX
+#include <time.h>
+#include <unistd.h>
+#endif
+#ifdef Q_OS_LINUX
+#include <sys/syscall.h>
+#endif
+
+#define ARCHIVE_MAGIC       "IVMA"
+#define ARCHIVE_VERSION     1
+#define ARCHIVE_HEADER_LEN  5
+#define DAY_HEADER_LEN      28
+#define BLOCK_HEADER_LEN    8
+#define ARCHIVE_BLOCK_SIZE  (256 * 1024)
+
+// ioprio_set(2), not wrapped by glibc
+#define IOPRIO_WHO_PROCESS  1
+#define IOPRIO_CLASS_IDLE   3
+#define IOPRIO_CLASS_SHIFT  13
+
+struct DayHeader
+{
+    QByteArray day;
+    quint64 raw_size = 0;
+    quint64 stored_size = 0;
+    quint32 block_count = 0;
+    qint64 offset = 0;          // first block
+};
+
+static bool readDayHeader(QFile *file, DayHeader *header)
+{
+    QByteArray data = file->read(DAY_HEADER_LEN);
+    if (data.length() != DAY_HEADER_LEN) {
+        return false;
+    }
+
+    const uchar *fields = reinterpret_cast<const uchar *>(data.constData());
+    header->day = data.left(8);
+    header->raw_size = qFromLittleEndian<quint64>(fields + 8);
+    header->stored_size = qFromLittleEndian<quint64>(fields + 16);
+    header->block_count = qFromLittleEndian<quint32>(fields + 24);
+    header->offset = file->pos();
+
+    // a day cut short by a crash is not complete
+    return header->offset + qint64(header->stored_size) <= file->size();
+}
+
+// reads the complete days, returns the end of the last one or -1 if the
+// file is not an archive
+static qint64 scanArchive(QFile *file, QList<DayHeader> *headers)
+{
+    file->seek(0);
+    QByteArray magic = file->read(ARCHIVE_HEADER_LEN);
+    if (magic.length() != ARCHIVE_HEADER_LEN || magic.startsWith(ARCHIVE_MAGIC) == false) {
+        return -1;
+    }
+
+    qint64 end = ARCHIVE_HEADER_LEN;
+    DayHeader header;
+    while (readDayHeader(file, &header)) {
+        headers->append(header);
+        end = header.offset + qint64(header.stored_size);
+        file->seek(end);
+    }
+    return end;
+}
+
+static bool readBlocks(QFile *file, const DayHeader &header, QByteArray *data)
+{
+    file->seek(header.offset);
+    for (quint32 i = 0; i < header.block_count; i++) {
+        QByteArray block_header = file->read(BLOCK_HEADER_LEN);
+        if (block_header.length() != BLOCK_HEADER_LEN) {
+            return false;
+        }
+        const uchar *fields = reinterpret_cast<const uchar *>(block_header.constData());
+        quint32 raw_len = qFromLittleEndian<quint32>(fields);
+        quint32 packed_len = qFromLittleEndian<quint32>(fields + 4);
+
+        QByteArray raw = qUncompress(file->read(packed_len));
+        if (quint32(raw.length()) != raw_len) {
+            return false;
+        }
+        data->append(raw);
+    }
+    return quint64(data->length()) == header.raw_size;
+}
+
+// rewrites the archive without one day, the old file stays in place until
+// the copy is committed
+static bool dropDay(const QString &archive_path, const DayHeader &header, qint64 end)
+{
+    QFile archive_file(archive_path);
+    QSaveFile copy_file(archive_path);
+    if (archive_file.open(QFile::ReadOnly) == false || copy_file.open(QFile::WriteOnly) == false) {
+        return false;
+    }
+
+    qint64 day_start = header.offset - DAY_HEADER_LEN;
+    qint64 day_end = header.offset + qint64(header.stored_size);
+    qint64 ranges[2][2] = { { 0, day_start }, { day_end, end } };
+    for (int i = 0; i < 2; i++) {
+        archive_file.seek(ranges[i][0]);
+        qint64 left = ranges[i][1] - ranges[i][0];
+        while (left > 0) {
+            QByteArray chunk = archive_file.read(qMin<qint64>(left, ARCHIVE_BLOCK_SIZE));
+            if (chunk.isEmpty() || copy_file.write(chunk) != chunk.length()) {
+                copy_file.cancelWriting();
+                return false;
+            }
+            left -= chunk.length();
+        }
+    }
+    archive_file.close();
+    return copy_file.commit();
+}
+
+static qint64 threadCpuTime()
+{
+#ifdef Q_OS_UNIX
+    struct timespec now;
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now) == 0) {
+        return qint64(now.tv_sec) * 1000000 + now.tv_nsec / 1000;
+    }
+#endif
+    return 0;
+}
+
+LogArchiver::LogArchiver(QString log_dir, QObject *parent)
+    : QObject(parent)
+    , log_dir_(log_dir)
+    , archive_dir_(log_dir + "/archive")
+{
+    prefixes_.append("ivm_temp_");
+}
+
+LogArchiver::~LogArchiver()
+{
+
+}
+
+void LogArchiver::setPrefixes(const QStringList &prefixes)
+{
+    prefixes_ = prefixes;
+}
+
+void LogArchiver::setRetention(int max_age_days, qint64 max_bytes)
+{
+    max_age_days_ = max_age_days;
+    max_bytes_ = max_bytes;
+}
+
+QStringList LogArchiver::days(QString archive_path)
+{
+    QStringList day_list;
+    QFile archive_file(archive_path);
+    if (archive_file.open(QFile::ReadOnly) == false) {
+        return day_list;
+    }
+
+    QList<DayHeader> headers;
+    scanArchive(&archive_file, &headers);
+    for (int i = 0; i < headers.size(); i++) {
+        day_list.append(QString::fromLatin1(headers.at(i).day));
+    }
+    return day_list;
+}
+
+bool LogArchiver::readDay(QString archive_path, QString day, QByteArray *data)
+{
+    QFile archive_file(archive_path);
+    if (archive_file.open(QFile::ReadOnly) == false) {
+        return false;
+    }
+
+    QList<DayHeader> headers;
+    scanArchive(&archive_file, &headers);
+    for (int i = 0; i < headers.size(); i++) {
+        if (headers.at(i).day == day.toLatin1()) {
+            data->clear();
+            return readBlocks(&archive_file, headers.at(i), data);
+        }
+    }
+    return false;
+}
+
+void LogArchiver::run()
+{
+    // archiving must never slow down logging and serial I/O
+    if (io_priority_set_ == false) {
+        io_priority_set_ = true;
+#ifdef Q_OS_LINUX
+        if (syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT) != 0) {
+            qDebug() << "[ARCHIVE] set idle I/O priority failed";
+        }
+#endif
+    }
+
+    QElapsedTimer wall_clock;
+    wall_clock.start();
+    qint64 cpu_start_us = threadCpuTime();
+
+    QDir().mkpath(archive_dir_);
+    QString today = QDate::currentDate().toString("yyyyMMdd");
+    QRegularExpression day_pattern("^(.*)(\\d{8})\\.txt$");
+
+    int day_count = 0;
+    qint64 raw_bytes = 0;
+    qint64 stored_bytes = 0;
+    int failures = 0;
+
+    QDir log_dir(log_dir_);
+    foreach (QString file_name, log_dir.entryList(QStringList() << "*.txt", QDir::Files, QDir::Name)) {
+        QRegularExpressionMatch match = day_pattern.match(file_name);
+        if (match.hasMatch() == false || prefixes_.contains(match.captured(1)) == false) {
+            continue;
+        }
+
+        // today is still being written
+        QString day = match.captured(2);
+        if (day >= today) {
+            continue;
+        }
+
+        QString log_path = log_dir.filePath(file_name);
+        QString archive_path = QString("%1/%2%3.ivma").arg(archive_dir_).arg(match.captured(1)).arg(day.left(6));
+        qint64 raw_size = QFileInfo(log_path).size();
+        qint64 stored_size = 0;
+        if (archiveDay(log_path, archive_path, day, &stored_size) == false) {
+            qDebug() << "[ARCHIVE] archive" << file_name << "failed";
+            failures++;
+            continue;
+        }
+
+        // a day found already archived does not count twice
+        QFile::remove(log_path);
+        day_count++;
+        if (stored_size > 0) {
+            raw_bytes += raw_size;
+            stored_bytes += stored_size;
+        }
+    }
+
+    QJsonObject report_obj;
+    enforceRetention(&report_obj);
+
+    report_obj.insert("days", day_count);
+    report_obj.insert("failures", failures);
+    report_obj.insert("raw_bytes", double(raw_bytes));
+    report_obj.insert("stored_bytes", double(stored_bytes));
+    report_obj.insert("ratio", (stored_bytes > 0)? double(raw_bytes) / stored_bytes : 0.0);
+    report_obj.insert("cpu_ms", (threadCpuTime() - cpu_start_us) / 1000.0);
+    report_obj.insert("wall_ms", double(wall_clock.elapsed()));
+
+    if (day_count > 0 || failures > 0) {
+        qDebug() << "[ARCHIVE]" << day_count << "days," << raw_bytes << "->" << stored_bytes << "bytes in"
+                 << report_obj.value("cpu_ms").toDouble() << "ms cpu";
+    }
+    emit finished(report_obj);
+}
+
+bool LogArchiver::archiveDay(const QString &log_path, const QString &archive_path, const QString &day, qint64 *stored_size)
+{
+    QFile log_file(log_path);
+    if (log_file.open(QFile::ReadOnly) == false) {
+        return false;
+    }
+
+    QFile archive_file(archive_path);
+    if (archive_file.open(QFile::ReadWrite) == false) {
+        return false;
+    }
+
+    // new archive, or drop the tail a crash may have left behind
+    qint64 end = ARCHIVE_HEADER_LEN;
+    if (archive_file.size() == 0) {
+        QByteArray header(ARCHIVE_MAGIC);
+        header.append(char(ARCHIVE_VERSION));
+        archive_file.write(header);
+    }
+    else {
+        QList<DayHeader> headers;
+        end = scanArchive(&archive_file, &headers);
+        if (end < 0) {
+            qDebug() << "[ARCHIVE] not an archive:" << archive_path;
+            return false;
+        }
+
+        // archived before the log could be removed, or the log changed
+        // since and its old copy is replaced
+        for (int i = 0; i < headers.size(); i++) {
+            if (headers.at(i).day != day.toLatin1()) {
+                continue;
+            }
+            if (qint64(headers.at(i).raw_size) == log_file.size()) {
+                *stored_size = 0;
+                return true;
+            }
+
+            archive_file.close();
+            if (dropDay(archive_path, headers.at(i), end) == false || archive_file.open(QFile::ReadWrite) == false) {
+                qDebug() << "[ARCHIVE] replace day failed:" << day;
+                return false;
+            }
+            headers.clear();
+            end = scanArchive(&archive_file, &headers);
+            break;
+        }
+        archive_file.resize(end);
+    }
+
+    // compress in blocks, each one can be read back alone
+    QByteArray blocks;
+    quint32 block_count = 0;
+    quint64 raw_size = 0;
+    uchar fields[8];
+    while (log_file.atEnd() == false) {
+        QByteArray raw = log_file.read(ARCHIVE_BLOCK_SIZE);
+        QByteArray packed = qCompress(raw, 9);
+        qToLittleEndian<quint32>(quint32(raw.length()), fields);
+        qToLittleEndian<quint32>(quint32(packed.length()), fields + 4);
+        blocks.append(reinterpret_cast<const char *>(fields), BLOCK_HEADER_LEN);
+        blocks.append(packed);
+        raw_size += quint64(raw.length());
+        block_count++;
+    }
+
+    QByteArray header = day.toLatin1().left(8);
+    uchar sizes[20];
+    qToLittleEndian<quint64>(raw_size, sizes);
+    qToLittleEndian<quint64>(quint64(blocks.length()), sizes + 8);
+    qToLittleEndian<quint32>(block_count, sizes + 16);
+    header.append(reinterpret_cast<const char *>(sizes), 20);
+
+    archive_file.seek(end);
+    if (archive_file.write(header) != DAY_HEADER_LEN || archive_file.write(blocks) != blocks.length()) {
+        archive_file.resize(end);
+        return false;
+    }
+    archive_file.flush();
+#ifdef Q_OS_UNIX
+    fsync(archive_file.handle());
+#endif
+
+    // read the day back before the log is removed
+    QByteArray verify;
+    DayHeader day_header;
+    archive_file.seek(end);
+    if (readDayHeader(&archive_file, &day_header) == false || readBlocks(&archive_file, day_header, &verify) == false) {
+        archive_file.resize(end);
+        return false;
+    }
+
+    *stored_size = DAY_HEADER_LEN + blocks.length();
+    return true;
+}
+
+void LogArchiver::enforceRetention(QJsonObject *report)
+{
+    QDir archive_dir(archive_dir_);
+    QFileInfoList archives = archive_dir.entryInfoList(QStringList() << "*.ivma", QDir::Files);
+    QRegularExpression month_pattern("(\\d{4})(\\d{2})\\.ivma$");
+
+    // oldest month first
+    QMap<QString, QFileInfo> by_month;
+    qint64 total_bytes = 0;
+    foreach (QFileInfo archive, archives) {
+        QRegularExpressionMatch match = month_pattern.match(archive.fileName());
+        if (match.hasMatch() == false) {
+            continue;
+        }
+        by_month.insert(match.captured(1) + match.captured(2) + archive.fileName(), archive);
+        total_bytes += archive.size();
+    }
+
+    QDate today = QDate::currentDate();
+    int removed = 0;
+    QMap<QString, QFileInfo>::iterator it = by_month.begin();
+    while (it != by_month.end()) {
+        QDate month(it.key().left(4).toInt(), it.key().mid(4, 2).toInt(), 1);
+        QDate last_day = month.addMonths(1).addDays(-1);
+
+        // age is counted from the last day of the month, size drops the
+        // oldest months but never the current one
+        bool too_old = (max_age_days_ > 0 && last_day.daysTo(today) > max_age_days_);
+        bool too_big = (max_bytes_ > 0 && total_bytes > max_bytes_ && last_day < today);
+        if (too_old == false && too_big == false) {
+            ++it;
+            continue;
+        }
+
+        qDebug() << "[ARCHIVE] remove" << it.value().fileName() << ((too_old)? "(age)" : "(size)");
+        if (QFile::remove(it.value().filePath())) {
+            total_bytes -= it.value().size();
+            removed++;
+        }
+        it = by_month.erase(it);
+    }
+
+    report->insert("archives_removed", removed);
+    report->insert("archive_bytes", double(total_bytes));
+}
@@ -0,0 +1,52 @@
+#ifndef LOG_ARCHIVER_H
+#define LOG_ARCHIVER_H
+
+#include <QObject>
+#include <QStringList>
+#include <QJsonObject>
+
+// Moves closed daily logs (<prefix>yyyyMMdd.txt) into monthly archives
+// <log dir>/archive/<prefix>yyyyMM.ivma and enforces age and size limits.
+// Meant to live in its own thread, run() lowers the I/O priority of it.
+//
+// header : "IVMA", version (1 byte)
+// day    : "yyyyMMdd", raw size (8 bytes LE), stored size (8 bytes LE),
+//          block count (4 bytes LE), blocks
+// block  : raw length (4 bytes LE), packed length (4 bytes LE), qCompress data
+//
+// The stored size lets a reader skip whole days, so one day is read back
+// without decompressing the rest of the month.
+class LogArchiver : public QObject
+{
+    Q_OBJECT
+
+public:
+    LogArchiver(QString log_dir, QObject *parent = nullptr);
+    ~LogArchiver();
+
+    void setPrefixes(const QStringList &prefixes);
+    void setRetention(int max_age_days, qint64 max_bytes);
+
+    static QStringList days(QString archive_path);
+    static bool readDay(QString archive_path, QString day, QByteArray *data);
+
+public slots:
+    void run();
+
+Q_SIGNALS:
+    void finished(QJsonObject report);
+
+private:
+    bool archiveDay(const QString &log_path, const QString &archive_path, const QString &day, qint64 *stored_size);
+    void enforceRetention(QJsonObject *report);
+
+private:
+    QString log_dir_;
+    QString archive_dir_;
+    QStringList prefixes_;
+    int max_age_days_ = 365;
+    qint64 max_bytes_ = 64 * 1024 * 1024;
+    bool io_priority_set_ = false;
+};
+
+#endif // LOG_ARCHIVER_H
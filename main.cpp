@@ -1,11 +1,244 @@
 #include "main_window.h"
 
 #include <QApplication>
+#include <QCommandLineParser>
+#include <QThread>
+#include <QJsonObject>
+#include <QJsonDocument>
+#include <QLoggingCategory>
+#include <QTextStream>
+#include <QDebug>
+
+#include "log_archiver.h"
+#include "metrics_server.h"
+#include "serial_replay.h"
+#include "vend_job.h"
+#include "vm_controller.h"
+#ifdef _BENCHMARK_
+#include "protocol_bench.h"
+#endif
+#include "vmc_emulator.h"
+#include "vmc_stress_test.h"
+
+// options of the monitor window, with or without the emulator
+static void configureWindow(MainWindow *w, const QCommandLineParser &parser)
+{
+    if (parser.isSet("record")) {
+        w->setTraceFile(parser.value("record"));
+    }
+    if (parser.isSet("alarm-rules")) {
+        w->setAlarmRulesFile(parser.value("alarm-rules"));
+    }
+    if (parser.isSet("anomaly-config")) {
+        w->setAnomalyConfigFile(parser.value("anomaly-config"));
+    }
+    if (parser.isSet("thermostat")) {
+        w->setThermostatFile(parser.value("thermostat"));
+    }
+    if (parser.isSet("stats-windows")) {
+        QList<int> minutes;
+        foreach (QString value, parser.value("stats-windows").split(',')) {
+            minutes.append(value.toInt());
+        }
+        w->setStatsWindows(minutes);
+    }
+    if (parser.isSet("upload-window")) {
+        w->setUploadWindow(parser.value("upload-window").toInt());
+    }
+    if (parser.isSet("prefetch-hours")) {
+        QStringList hours = parser.value("prefetch-hours").split(',');
+        w->setPrefetchHours(hours.first().toInt(), hours.last().toInt());
+    }
+}
 
 int main(int argc, char *argv[])
 {
     QApplication a(argc, argv);
-    MainWindow w;
-    w.show();
-    return a.exec();
+
+    // command line options for offline testing
+    QCommandLineParser parser;
+    parser.addHelpOption();
+    parser.addOption({"vmc-emulator", "Run a VMC emulator on a pseudo terminal."});
+    parser.addOption({"vmc-stress", "Stress VMController against the emulator for <seconds>.", "seconds"});
+    parser.addOption({"stress-vend", "Include channel vend sequences in the stress run."});
+    parser.addOption({"stress-poll", "Run background TPAL polls every <ms> during the stress run.", "ms"});
+    parser.addOption({"vend-cart", "Dispense a cart of row:column lanes, e.g. 1:1,1:2,2:10, against the emulator and print the outcomes.", "lanes"});
+    parser.addOption({"vend-single", "Dispense the cart one lane per drop, without combined drops."});
+    parser.addOption({"emu-latency", "Emulator response latency range in ms, e.g. 5,20.", "min,max"});
+    parser.addOption({"emu-op-delay", "Emulator delay between channel steps in ms.", "ms"});
+    parser.addOption({"emu-fragment", "Split emulator responses into <bytes>,<delay ms> fragments.", "bytes,ms"});
+    parser.addOption({"emu-drop-rate", "Probability of dropping a response.", "rate"});
+    parser.addOption({"emu-corrupt-rate", "Probability of corrupting a response.", "rate"});
+    parser.addOption({"emu-channel-error", "Error code returned by channel commands (EE01..EE04).", "code"});
+    parser.addOption({"record", "Record the VMC serial session into <file>.", "file"});
+    parser.addOption({"alarm-rules", "Load local alarm rules from a JSON <file>.", "file"});
+    parser.addOption({"anomaly-config", "Tune the drift detector with a JSON <file>.", "file"});
+    parser.addOption({"thermostat", "Run the local compressor loop configured by a JSON <file>.", "file"});
+    parser.addOption({"stats-windows", "Lengths of the three statistics windows in minutes, default 1,15,60.", "min,min,min"});
+    parser.addOption({"upload-window", "Upload the summaries of the <minutes> statistics window instead of the samples.", "minutes"});
+    parser.addOption({"prefetch-hours", "Refresh the cached scan codes between these local hours, default 3,5.", "from,to"});
+    parser.addOption({"metrics", "Serve Prometheus metrics on <address:port>, e.g. 127.0.0.1:9105.", "address"});
+    parser.addOption({"archive-read", "List the days in a log <archive>, or print one with --archive-day.", "archive"});
+    parser.addOption({"archive-day", "Day to print from the archive, yyyyMMdd.", "day"});
+    parser.addOption({"replay", "Replay a recorded VMC serial session and print the transcript.", "file"});
+#ifdef _BENCHMARK_
+    parser.addOption({"bench", "Run the protocol microbenchmarks and write JSON results to <file> (- for stdout).", "file"});
+    parser.addOption({"bench-baseline", "Compare the benchmark results with a previous JSON <file>.", "file"});
+#endif
+    parser.process(a);
+
+#ifdef _BENCHMARK_
+    if (parser.isSet("bench")) {
+        QLoggingCategory::setFilterRules("*.debug=false\ndefault.debug=false");
+        return ProtocolBench::run(parser.value("bench"), parser.value("bench-baseline"));
+    }
+#endif
+
+    // read back an archived daily log
+    if (parser.isSet("archive-read")) {
+        QTextStream out(stdout);
+        if (parser.isSet("archive-day") == false) {
+            foreach (QString day, LogArchiver::days(parser.value("archive-read"))) {
+                out << day << "\n";
+            }
+            return 0;
+        }
+
+        QByteArray data;
+        if (LogArchiver::readDay(parser.value("archive-read"), parser.value("archive-day"), &data) == false) {
+            qWarning() << "[ARCHIVE] day not found:" << parser.value("archive-day");
+            return 1;
+        }
+        out << data;
+        return 0;
+    }
+
+    // deterministic replay of a recorded session
+    if (parser.isSet("replay")) {
+        QLoggingCategory::setFilterRules("*.debug=false");
+
+        SerialReplay replay;
+        if (replay.load(parser.value("replay")) == false) {
+            qWarning() << "[REPLAY] load trace failed:" << parser.value("replay");
+            return 1;
+        }
+        replay.run();
+
+        QTextStream out(stdout);
+        foreach (QString line, replay.transcript()) {
+            out << line << "\n";
+        }
+
+        QJsonObject result_obj;
+        result_obj.insert("records", replay.recordCount());
+        result_obj.insert("trace_ms", replay.traceDuration() / 1000.0);
+        result_obj.insert("replay_ms", replay.replayDuration() / 1000.0);
+        result_obj.insert("records_per_sec", (replay.replayDuration() > 0)?
+                              replay.recordCount() * 1000000.0 / replay.replayDuration() : 0.0);
+        out << QJsonDocument(result_obj).toJson(QJsonDocument::Compact) << "\n";
+        out.flush();
+        return 0;
+    }
+
+    // local metrics endpoint, localhost unless an address is given
+    MetricsServer metrics_server;
+    if (parser.isSet("metrics")) {
+        metrics_server.start(parser.value("metrics"));
+    }
+
+    bool stress_mode = parser.isSet("vmc-stress");
+    bool vend_mode = parser.isSet("vend-cart");
+
+    // lanes are written as <row>:<column>, anything else is rejected
+    QList<QPair<int, int>> cart;
+    if (vend_mode) {
+        foreach (QString lane, parser.value("vend-cart").split(',', Qt::SkipEmptyParts)) {
+            QStringList position = lane.trimmed().split(':');
+            bool row_ok = false;
+            bool col_ok = false;
+            int row = (position.size() == 2)? position.at(0).toInt(&row_ok) : 0;
+            int col = (position.size() == 2)? position.at(1).toInt(&col_ok) : 0;
+            if (row_ok == false || col_ok == false || row <= 0 || col <= 0) {
+                qWarning() << "[VEND] invalid lane, expected row:column:" << lane;
+                return 1;
+            }
+            cart.append(qMakePair(row, col));
+        }
+        if (cart.isEmpty()) {
+            qWarning() << "[VEND] empty cart";
+            return 1;
+        }
+    }
+    if (parser.isSet("vmc-emulator") == false && stress_mode == false && vend_mode == false) {
+        MainWindow w;
+        configureWindow(&w, parser);
+        w.show();
+        return a.exec();
+    }
+
+    // configure the emulator, it runs in its own thread so blocking reads
+    // in VMController do not starve it
+    VmcEmulator *emulator = new VmcEmulator();
+    if (parser.isSet("emu-latency")) {
+        QStringList range = parser.value("emu-latency").split(',');
+        emulator->setLatency(range.first().toInt(), range.last().toInt());
+    }
+    if (parser.isSet("emu-op-delay")) {
+        emulator->setOperationDelay(parser.value("emu-op-delay").toInt());
+    }
+    if (parser.isSet("emu-fragment")) {
+        QStringList fragment = parser.value("emu-fragment").split(',');
+        emulator->setFragmentation(fragment.first().toInt(), (fragment.size() > 1)? fragment.at(1).toInt() : 0);
+    }
+    emulator->setDropRate(parser.value("emu-drop-rate").toDouble());
+    emulator->setCorruptRate(parser.value("emu-corrupt-rate").toDouble());
+    emulator->setChannelError(parser.value("emu-channel-error").toUtf8());
+
+    QThread emulator_thread;
+    emulator->moveToThread(&emulator_thread);
+    emulator_thread.start();
+
+    bool started = false;
+    QMetaObject::invokeMethod(emulator, "start", Qt::BlockingQueuedConnection, Q_RETURN_ARG(bool, started));
+
+    int result = 1;
+    if (started) {
+        if (stress_mode) {
+            VmcStressTest stress_test;
+            QObject::connect(&stress_test, SIGNAL(finished()), &a, SLOT(quit()));
+            stress_test.setPollPeriod(parser.value("stress-poll").toInt());
+            if (stress_test.start(emulator->portName(), parser.value("vmc-stress").toInt(), parser.isSet("stress-vend"))) {
+                result = a.exec();
+            }
+        }
+        else if (vend_mode) {
+            VMController vm_controller;
+            vm_controller.setPortName(emulator->portName());
+            VendJob vend_job(&vm_controller);
+            vend_job.setPairing(parser.isSet("vend-single") == false);
+            QObject::connect(&vend_job, SIGNAL(finished(bool)), &a, SLOT(quit()));
+            if (vm_controller.open(QIODevice::ReadWrite) && vend_job.start(cart)) {
+                a.exec();
+
+                QTextStream out(stdout);
+                out << QJsonDocument(vend_job.report()).toJson(QJsonDocument::Compact) << "\n";
+                out.flush();
+                result = (vend_job.report().value("dispensed").toInt() == cart.size())? 0 : 2;
+            }
+        }
+        else {
+            MainWindow w;
+            w.addPortName(emulator->portName());
+            configureWindow(&w, parser);
+            w.show();
+            result = a.exec();
+        }
+    }
+
+    // shut the emulator down in its own thread
+    QMetaObject::invokeMethod(emulator, "stop", Qt::BlockingQueuedConnection);
+    emulator_thread.quit();
+    emulator_thread.wait();
+    delete emulator;
+    return result;
 }
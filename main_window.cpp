@@ -3,6 +3,8 @@
 
 #include <QSerialPort>
 #include <QSerialPortInfo>
+#include <QSortFilterProxyModel>
+#include <QRegularExpression>
 #include <QTime>
 #include <QFile>
 #include <QTextStream>
@@ -12,7 +14,19 @@
 #include <QProcess>
 #include <QDebug>
 
+#include "alarm_engine.h"
+#include "anomaly_detector.h"
 #include "cms_api.h"
+#include "cms_bootstrap.h"
+#include "console_model.h"
+#include "duty_cycle_tracker.h"
+#include "lane_profiler.h"
+#include "log_archiver.h"
+#include "metrics.h"
+#include "port_watcher.h"
+#include "sample_store.h"
+#include "telemetry_sampler.h"
+#include "thermostat_controller.h"
 #include "vm_controller.h"
 
 MainWindow::MainWindow(QWidget *parent)
@@ -44,19 +58,166 @@ MainWindow::MainWindow(QWidget *parent)
     connect(ui->pbtn_set, SIGNAL(clicked()), this, SLOT(pbtn_set_clicked()));
     connect(ui->spinBox_auto_interval, SIGNAL(valueChanged(int)), this, SLOT(spinBox_valueChanged(int)));
 
+    // initialize output console, the ring buffer keeps memory use flat
+    console_model_ = new ConsoleModel(2000, this);
+    console_proxy_ = new QSortFilterProxyModel(this);
+    console_proxy_->setSourceModel(console_model_);
+    console_proxy_->setFilterRole(ConsoleModel::DirectionRole);
+    ui->listView_console->setModel(console_proxy_);
+    connect(console_proxy_, SIGNAL(rowsInserted(QModelIndex,int,int)), ui->listView_console, SLOT(scrollToBottom()));
+    connect(ui->pbtn_pause, SIGNAL(clicked()), this, SLOT(pbtn_pause_clicked()));
+    connect(ui->chBox_filter_tx, SIGNAL(toggled(bool)), this, SLOT(chBox_filter_toggled()));
+    connect(ui->chBox_filter_rx, SIGNAL(toggled(bool)), this, SLOT(chBox_filter_toggled()));
+
+    // initialize temperature chart
+    sample_store_ = new SampleStore(30 * 24 * 60, this);
+    ui->chart_temperature->setSampleStore(sample_store_);
+    connect(ui->cbBox_chart_span, SIGNAL(currentIndexChanged(int)), this, SLOT(cbBox_chart_span_changed(int)));
+
     // create cms api object
     cms_api_ = new CmsApi(this);
+    cms_api_->setCacheDir(QString("%1/cms_cache").arg(dir_log));
+
+    // fetched in parallel once the machine code is set, through the cms api cache
+    cms_bootstrap_ = new CmsBootstrap(cms_api_, this);
+    connect(cms_bootstrap_, SIGNAL(ready(bool)), this, SLOT(bootstrap_ready(bool)));
+    connect(cms_bootstrap_, SIGNAL(finished(bool)), this, SLOT(bootstrap_finished(bool)));
+
+    tmr_prefetch_ = new QTimer(this);
+    tmr_prefetch_->setInterval(10 * 60 * 1000);
+    connect(tmr_prefetch_, SIGNAL(timeout()), this, SLOT(prefetch_scan_codes()));
+    tmr_prefetch_->start();
 
     // initialize external device
     vm_controller_ = new VMController(this);
-    connect(vm_controller_, SIGNAL(readyRead()), this, SLOT(vmc_ready_read()));
+    connect(vm_controller_, SIGNAL(rawDataReceived(QByteArray)), this, SLOT(vmc_ready_read(QByteArray)));
+
+    // initialize high-rate sampling
+    sampler_ = new TelemetrySampler(vm_controller_, this);
+    connect(sampler_, SIGNAL(sampleReady(TemperatureSample,QByteArray)), this, SLOT(sampler_sample_ready(TemperatureSample,QByteArray)));
+
+    tmr_upload_ = new QTimer(this);
+    tmr_upload_->setInterval(ui->spinBox_auto_interval->value() * 60 * 1000);
+    connect(tmr_upload_, SIGNAL(timeout()), this, SLOT(upload_aggregate()));
+
+    // initialize alarm engine
+    alarm_engine_ = new AlarmEngine(this);
+    alarm_engine_->loadDefaultRules();
+    connect(alarm_engine_, SIGNAL(alarmRaised(QString,QMap<QString,QString>)), this, SLOT(alarm_changed(QString,QMap<QString,QString>)));
+    connect(alarm_engine_, SIGNAL(alarmCleared(QString,QMap<QString,QString>)), this, SLOT(alarm_changed(QString,QMap<QString,QString>)));
+
+    // early warnings of slow drift, sent like the alarms
+    anomaly_detector_ = new AnomalyDetector(this);
+    connect(anomaly_detector_, SIGNAL(anomalyRaised(QString,QMap<QString,QString>)), this, SLOT(alarm_changed(QString,QMap<QString,QString>)));
+    connect(anomaly_detector_, SIGNAL(anomalyCleared(QString,QMap<QString,QString>)), this, SLOT(alarm_changed(QString,QMap<QString,QString>)));
+
+    // compressor and door duty cycle, kept next to the daily logs
+    duty_tracker_ = new DutyCycleTracker();
+    duty_tracker_->setLogDir(dir_log);
+
+    // per channel window statistics, time above counts from the alarm thresholds
+    windowed_stats_ = new WindowedStats();
+    applyStatsThresholds();
+
+    // follow serial ports coming and going
+    port_watcher_ = new PortWatcher(vm_controller_, this);
+    connect(port_watcher_, SIGNAL(portsChanged(QStringList)), this, SLOT(ports_changed(QStringList)));
+    connect(port_watcher_, SIGNAL(portLost(QString)), this, SLOT(port_lost(QString)));
+    connect(port_watcher_, SIGNAL(portRestored(QString,qint64)), this, SLOT(port_restored(QString,qint64)));
+
+    // initialize thermostat, disabled until a config is loaded
+    thermostat_ = new ThermostatController(vm_controller_, this);
+    thermostat_->setLogDir(dir_log);
+
+    // profile vend phases per lane across restarts
+    lane_profiler_ = new LaneProfiler();
+    lane_profiler_->setFile(QString("%1/lane_profile.json").arg(dir_log));
+    vm_controller_->setLaneProfiler(lane_profiler_);
+
+    // archive closed days in a low priority thread, once now and hourly
+    log_archiver_ = new LogArchiver(dir_log);
+    log_archiver_->setPrefixes(QStringList() << "ivm_temp_" << "thermostat_" << "duty_");
+    log_archiver_->moveToThread(&archive_thread_);
+    connect(&archive_thread_, SIGNAL(finished()), log_archiver_, SLOT(deleteLater()));
+    connect(log_archiver_, SIGNAL(finished(QJsonObject)), this, SLOT(archive_finished(QJsonObject)));
+    archive_thread_.start(QThread::IdlePriority);
+
+    tmr_archive_ = new QTimer(this);
+    tmr_archive_->setInterval(60 * 60 * 1000);
+    connect(tmr_archive_, SIGNAL(timeout()), log_archiver_, SLOT(run()));
+    tmr_archive_->start();
+    QMetaObject::invokeMethod(log_archiver_, "run", Qt::QueuedConnection);
 }
 
 MainWindow::~MainWindow()
 {
+    archive_thread_.quit();
+    archive_thread_.wait();
+
+    vm_controller_->setLaneProfiler(nullptr);
+    delete lane_profiler_;
+    delete windowed_stats_;
+    delete duty_tracker_;
     delete ui;
 }
 
+void MainWindow::addPortName(QString port_name)
+{
+    // ports that QSerialPortInfo cannot enumerate, e.g. the emulator pty
+    if (extra_ports_.contains(port_name) == false) {
+        extra_ports_.append(port_name);
+    }
+    if (ui->cbBox_port->findText(port_name) < 0) {
+        ui->cbBox_port->addItem(port_name);
+    }
+    ui->cbBox_port->setCurrentText(port_name);
+}
+
+void MainWindow::setTraceFile(QString file_path)
+{
+    vm_controller_->startRecording(file_path);
+}
+
+void MainWindow::setAlarmRulesFile(QString file_path)
+{
+    if (alarm_engine_->loadRules(file_path) == false) {
+        alarm_engine_->clearRules();
+        alarm_engine_->loadDefaultRules();
+    }
+    applyStatsThresholds();
+}
+
+void MainWindow::setThermostatFile(QString file_path)
+{
+    thermostat_->loadConfig(file_path);
+}
+
+void MainWindow::setAnomalyConfigFile(QString file_path)
+{
+    anomaly_detector_->loadConfig(file_path);
+}
+
+void MainWindow::setStatsWindows(const QList<int> &minutes)
+{
+    for (int i = 0; i < WindowedStats::WINDOW_COUNT && i < minutes.size(); i++) {
+        windowed_stats_->setLength(WindowedStats::Window(i), minutes.at(i) * 60);
+    }
+}
+
+void MainWindow::setUploadWindow(int minutes)
+{
+    upload_window_ = windowed_stats_->find(minutes * 60);
+    if (upload_window_ < 0) {
+        qDebug() << "[STATS] no" << minutes << "min window, uploading samples";
+    }
+}
+
+void MainWindow::setPrefetchHours(int from_hour, int to_hour)
+{
+    prefetch_from_hour_ = qBound(0, from_hour, 23);
+    prefetch_to_hour_ = qBound(0, to_hour, 24);
+}
+
 void MainWindow::pbtn_open_clicked()
 {
     // do nothing when serial port is invalid
@@ -73,16 +234,22 @@ void MainWindow::pbtn_open_clicked()
         // change the status of widgets when serial port is opened
         if (vm_controller_->open(QIODevice::ReadWrite)) {
             vm_controller_->setRequestToSend(true);
+            port_watcher_->attach();
             ui->pbtn_open->setText("Close");
             ui->pbtn_send->setEnabled(true);
             ui->chBox_auto_enable->setEnabled(false);
             ui->spinBox_auto_interval->setEnabled(false);
+            ui->chBox_high_rate->setEnabled(false);
+            ui->spinBox_sample_interval->setEnabled(false);
             ui->lineEdit_cmd->setEnabled(true);
         }
     }
     // close the chosen serial port
     else {
+        port_watcher_->detach();
         tmr_auto_send_->stop();
+        tmr_upload_->stop();
+        sampler_->stop();
 
         vm_controller_->clear();
         vm_controller_->close();
@@ -92,6 +259,8 @@ void MainWindow::pbtn_open_clicked()
         ui->pbtn_send->setEnabled(false);
         ui->chBox_auto_enable->setEnabled(true);
         ui->spinBox_auto_interval->setEnabled(true);
+        ui->chBox_high_rate->setEnabled(true);
+        ui->spinBox_sample_interval->setEnabled(true);
         ui->lineEdit_cmd->clear();
         ui->lineEdit_cmd->setEnabled(false);
     }
@@ -101,6 +270,16 @@ void MainWindow::pbtn_send_clicked()
 {
     if (vm_controller_->isOpen()) {
 
+        // poll TPAL at a high rate and upload only the aggregates
+        if (ui->chBox_high_rate->isChecked()) {
+            sampler_->setInterval(ui->spinBox_sample_interval->value() * 1000);
+            sampler_->start();
+            tmr_upload_->start();
+            ui->pbtn_send->setEnabled(false);
+            ui->lineEdit_cmd->setEnabled(false);
+            return;
+        }
+
         vmc_send();
 
         if (ui->chBox_auto_enable->isChecked()) {
@@ -113,12 +292,48 @@ void MainWindow::pbtn_send_clicked()
 
 void MainWindow::pbtn_clear_clicked()
 {
-    ui->textBrowser->clear();
+    console_model_->clear();
+}
+
+void MainWindow::pbtn_pause_clicked()
+{
+    console_model_->setPaused(!console_model_->isPaused());
+    ui->pbtn_pause->setText((console_model_->isPaused())? "Resume" : "Pause");
+}
+
+void MainWindow::chBox_filter_toggled()
+{
+    QStringList directions;
+    if (ui->chBox_filter_tx->isChecked()) {
+        directions.append("TX");
+    }
+    if (ui->chBox_filter_rx->isChecked()) {
+        directions.append("RX");
+    }
+
+    // an empty alternation must hide everything instead of matching all
+    if (directions.isEmpty()) {
+        console_proxy_->setFilterRegularExpression(QRegularExpression("^$"));
+    }
+    else {
+        console_proxy_->setFilterRegularExpression(QRegularExpression(QString("^(%1)$").arg(directions.join('|'))));
+    }
+}
+
+void MainWindow::cbBox_chart_span_changed(int index)
+{
+    static const qint64 hour = 60 * 60 * 1000;
+    static const qint64 spans[] = { hour, 6 * hour, 24 * hour, 7 * 24 * hour, 30 * 24 * hour };
+
+    if (index >= 0 && index < int(sizeof(spans) / sizeof(spans[0]))) {
+        ui->chart_temperature->setTimeSpan(spans[index]);
+    }
 }
 
 void MainWindow::spinBox_valueChanged(int value)
 {
     tmr_auto_send_->setInterval(value * 60 * 1000);
+    tmr_upload_->setInterval(value * 60 * 1000);
 }
 
 void MainWindow::vmc_send()
@@ -128,26 +343,122 @@ void MainWindow::vmc_send()
     tx_data.append(ui->lineEdit_cmd->text().toUtf8());
     tx_data.append('\n');
 
-    // update textBrowser
-    ui->textBrowser->append(QString("%1 TX: %2").arg(QTime::currentTime().toString("hh:mm:ss"))
-                                                .arg(ui->lineEdit_cmd->text()));
+    // update console
+    console_model_->appendLine(ConsoleModel::TX, QString("%1 TX: %2").arg(QTime::currentTime().toString("hh:mm:ss"))
+                                                                     .arg(ui->lineEdit_cmd->text()));
 
     // send tx data
-    vm_controller_->clear();
-    vm_controller_->write(tx_data);
+    vm_controller_->sendRawData(tx_data);
     vm_controller_->waitForBytesWritten(500);
 }
 
-void MainWindow::vmc_ready_read()
+void MainWindow::vmc_ready_read(QByteArray rx_data)
+{
+    LatencyTrace trace = startTrace();
+
+    // update console
+    console_model_->appendLine(ConsoleModel::RX, QString("%1 RX(%2): %3").arg(QTime::currentTime().toString("hh:mm:ss"))
+                                                                         .arg(QString::number(rx_data.length()))
+                                                                         .arg(QString::fromUtf8(rx_data)));
+
+    // store the decoded sample for the chart
+    TemperatureSample sample;
+    bool decoded = TemperatureSample::fromTpal(rx_data, QDateTime::currentMSecsSinceEpoch(), &sample);
+    trace.stamp(LatencyTrace::DECODE);
+    if (decoded) {
+        Metrics::increment(Metrics::SAMPLES_RECEIVED);
+        sample_store_->append(sample);
+        windowed_stats_->add(sample);
+        duty_tracker_->add(sample);
+        alarm_engine_->evaluate(sample);
+        anomaly_detector_->evaluate(sample);
+        thermostat_->evaluate(sample);
+    }
+
+    writeDailyLog(rx_data);
+    trace.stamp(LatencyTrace::LOG_WRITE);
+
+    // update to cloud
+    if (upload_window_ < 0 && frame_payload_.fromTpal(rx_data)) {
+        enqueueUpload(frame_payload_, trace);
+    }
+    takeWindowSummaries(trace);
+    takeDutySummaries();
+    scheduleFlush();
+}
+
+void MainWindow::sampler_sample_ready(const TemperatureSample &sample, const QByteArray &rx_data)
 {
-    // read all data
-    QByteArray rx_data = vm_controller_->readAll();
+    // the sampler decoded the frame right before emitting
+    last_trace_ = startTrace();
+    last_trace_.stamp(LatencyTrace::DECODE);
+
+    // every sample feeds the statistics and the alarm rules, the chart and
+    // the daily log keep their one sample per minute
+    Metrics::increment(Metrics::SAMPLES_RECEIVED);
+    windowed_stats_->add(sample);
+    duty_tracker_->add(sample);
+    qint64 minute = sample.timestamp / 60000;
+    if (minute != chart_minute_) {
+        chart_minute_ = minute;
+        sample_store_->append(sample);
+        writeDailyLog(rx_data);
+    }
+    last_trace_.stamp(LatencyTrace::LOG_WRITE);
+    alarm_engine_->evaluate(sample);
+    anomaly_detector_->evaluate(sample);
+    thermostat_->evaluate(sample);
+    if (takeWindowSummaries(last_trace_)) {
+        scheduleFlush();
+    }
+    takeDutySummaries();
+
+    ui->label_sampling_stats->setText(QString("samples %1, dropped %2\njitter %3 / %4 ms, link %5%")
+                                      .arg(sampler_->sampleCount())
+                                      .arg(sampler_->droppedCount())
+                                      .arg(sampler_->averageJitter(), 0, 'f', 1)
+                                      .arg(sampler_->maxJitter())
+                                      .arg(vm_controller_->linkUtilization() * 100, 0, 'f', 1));
+}
 
-    // update textBrowser
-    ui->textBrowser->append(QString("%1 RX(%2): %3").arg(QTime::currentTime().toString("hh:mm:ss"))
-                                                    .arg(QString::number(rx_data.length()))
-                                                    .arg(QString::fromUtf8(rx_data)));
+void MainWindow::upload_aggregate()
+{
+    // the aggregate is still taken so it restarts with the upload interval
+    if (sampler_->takeAggregate(&aggregate_payload_) && upload_window_ < 0) {
+        aggregate_payload_.setDecimal(TelemetryPayload::JITTER_AVG_MS, sampler_->averageJitter(), 1);
+        aggregate_payload_.setNumber(TelemetryPayload::JITTER_MAX_MS, sampler_->maxJitter());
+
+        // traced by the newest sample, its enqueue stage includes the aggregation window
+        enqueueUpload(aggregate_payload_, last_trace_);
+    }
+    qDebug() << "[SAMPLER] samples:" << sampler_->sampleCount()
+             << "dropped:" << sampler_->droppedCount()
+             << "jitter avg/max:" << sampler_->averageJitter() << sampler_->maxJitter()
+             << "link:" << vm_controller_->linkUtilization();
+    flushEvents();
+    flushUploads();
+}
+
+void MainWindow::alarm_changed(QString event_code, QMap<QString, QString> parameters)
+{
+    // keep the latest events if the cloud is unreachable for long
+    if (event_queue_.size() >= 100) {
+        event_queue_.dequeue();
+    }
+    event_queue_.enqueue(qMakePair(event_code, parameters));
+    Metrics::setGauge(Metrics::EVENT_QUEUE_DEPTH, event_queue_.size());
+    scheduleFlush();
+}
 
+void MainWindow::archive_finished(QJsonObject report)
+{
+    if (report.value("days").toInt() > 0 || report.value("archives_removed").toInt() > 0) {
+        qDebug() << "[ARCHIVE]" << QJsonDocument(report).toJson(QJsonDocument::Compact);
+    }
+}
+
+void MainWindow::writeDailyLog(const QByteArray &rx_data)
+{
     QString today = QDateTime::currentDateTime().toString("yyyyMMdd");
 
     QFile log_file;
@@ -165,39 +476,155 @@ void MainWindow::vmc_ready_read()
     QTextStream out(&log_file);
 
     // write the date of recording
-    out << QDateTime::currentDateTime().toString("hh:mm:ss")
-        << ", TP01 " << rx_data.mid( 4, 5)
-        << ", TP02 " << rx_data.mid(13, 5)
-        << ", TP03 " << rx_data.mid(22, 5)
-        << ", TP04 " << rx_data.mid(31, 5)
-        << ", TP05 " << rx_data.mid(40, 5)
-        << ", TP06 " << rx_data.mid(49, 5)
-        << ", TP07 " << rx_data.mid(58, 5)
-        << ", TP08 " << rx_data.mid(67, 5) << "\n";
+    out << TemperatureSample::tpalLogLine(rx_data, QDateTime::currentDateTime().toString("hh:mm:ss"));
 
     // clear the buffered data
     out.flush();
     log_file.close();
+}
 
-    // update to cloud
-    QMap<QString, QByteArray> infos;
-    infos.insert("temperature_1", rx_data.mid( 4, 5));
-    infos.insert("temperature_2", rx_data.mid(13, 5));
-    infos.insert("temperature_3", rx_data.mid(22, 5));
-    infos.insert("temperature_4", rx_data.mid(31, 5));
-    infos.insert("temperature_5", rx_data.mid(40, 5));
-    infos.insert("temperature_6", rx_data.mid(49, 5));
-    infos.insert("temperature_7", rx_data.mid(58, 5));
-    infos.insert("temperature_8", rx_data.mid(67, 5));
-    infos.insert("cp",            rx_data.mid(74, 1));
-    infos.insert("fn",            rx_data.mid(77, 1));
-    infos.insert("door",          rx_data.mid(80, 1));
-
-    if (machine_code_.isEmpty())
+LatencyTrace MainWindow::startTrace()
+{
+    LatencyTrace trace;
+    trace.id = LatencyTrace::nextId();
+    trace.stamp(LatencyTrace::TPAL_TX, vm_controller_->lastTpalTransmitTime());
+    trace.stamp(LatencyTrace::FRAME_COMPLETE, vm_controller_->lastFrameTime());
+    return trace;
+}
+
+void MainWindow::enqueueUpload(const TelemetryPayload &payload, const LatencyTrace &trace)
+{
+    // keep at most one day of minute uploads while offline, the head may be in flight
+    if (upload_queue_.size() >= 24 * 60) {
+        upload_queue_.removeAt((uploading_)? 1 : 0);
+    }
+    PendingUpload upload;
+    upload.payload = payload;
+    upload.trace = trace;
+    upload.trace.stamp(LatencyTrace::ENQUEUE);
+    upload_queue_.enqueue(upload);
+    Metrics::setGauge(Metrics::OUTBOX_DEPTH, upload_queue_.size());
+}
+
+bool MainWindow::takeWindowSummaries(const LatencyTrace &trace)
+{
+    bool queued = false;
+    WindowSummary summary;
+    for (int i = 0; i < WindowedStats::WINDOW_COUNT; i++) {
+        if (windowed_stats_->takeSummary(WindowedStats::Window(i), &summary) == false) {
+            continue;
+        }
+        qDebug() << "[STATS]" << windowed_stats_->length(WindowedStats::Window(i)) << "s window closed,"
+                 << summary.count << "samples";
+        if (i == upload_window_) {
+            WindowedStats::toPayload(summary, &window_payload_);
+            enqueueUpload(window_payload_, trace);
+            queued = true;
+        }
+    }
+    return queued;
+}
+
+void MainWindow::takeDutySummaries()
+{
+    DutySummary summary;
+    bool queued = false;
+    while (duty_tracker_->takeSummary(&summary)) {
+        // keep the latest summaries if the cloud is unreachable for long
+        if (log_queue_.size() >= 100) {
+            log_queue_.dequeue();
+        }
+        log_queue_.enqueue(qMakePair(QString(Log_DUTY_CYCLE), summary.parameters()));
+        queued = true;
+    }
+    if (queued) {
+        scheduleFlush();
+    }
+}
+
+void MainWindow::applyStatsThresholds()
+{
+    windowed_stats_->clearThresholds();
+    for (int i = 0; i < TP_CHANNEL_COUNT; i++) {
+        float threshold;
+        if (alarm_engine_->overTemperatureThreshold(i + 1, &threshold)) {
+            windowed_stats_->setThreshold(i, threshold);
+        }
+    }
+}
+
+void MainWindow::flushUploads()
+{
+    if (machine_code_.isEmpty()) {
         qDebug()<< "Pls set machine code";
-    else {
-        cms_api_->updateMonitoringInfos(machine_code_, infos);
+        return;
+    }
+
+    // the request runs a nested event loop, do not re-enter from a timer
+    if (uploading_) {
+        return;
     }
+    uploading_ = true;
+
+    // send in order, keep the rest for the next try on failure
+    while (upload_queue_.isEmpty() == false) {
+        // a retried upload keeps the time of its latest attempt
+        upload_queue_.head().trace.stamp(LatencyTrace::HTTP_SEND);
+        if (cms_api_->updateMonitoringInfos(machine_code_, upload_queue_.head().payload) == false) {
+            break;
+        }
+        PendingUpload upload = upload_queue_.dequeue();
+        upload.trace.stamp(LatencyTrace::HTTP_ACK);
+        upload.trace.finish(cms_api_->isDebugEnabled());
+    }
+    Metrics::setGauge(Metrics::OUTBOX_DEPTH, upload_queue_.size());
+    uploading_ = false;
+}
+
+void MainWindow::scheduleFlush()
+{
+    // CmsApi waits in a nested event loop, never run it from inside the
+    // serial receive and sample callbacks
+    if (flush_queued_ == false) {
+        flush_queued_ = true;
+        QMetaObject::invokeMethod(this, "flush_queues", Qt::QueuedConnection);
+    }
+}
+
+void MainWindow::flush_queues()
+{
+    flush_queued_ = false;
+    flushEvents();
+    flushUploads();
+}
+
+void MainWindow::flushEvents()
+{
+    if (machine_code_.isEmpty() || sending_events_) {
+        return;
+    }
+    sending_events_ = true;
+
+    // send in order, keep the rest for the next try on failure
+    while (event_queue_.isEmpty() == false) {
+        QPair<QString, QMap<QString, QString> > event = event_queue_.head();
+        if (cms_api_->updateEventInfos(machine_code_, event.first, event.second) == false) {
+            break;
+        }
+        event_queue_.dequeue();
+        Metrics::increment(Metrics::EVENTS_SENT);
+    }
+    Metrics::setGauge(Metrics::EVENT_QUEUE_DEPTH, event_queue_.size());
+
+    // machine logs after the events, an alarm is more urgent than a summary
+    while (event_queue_.isEmpty() && log_queue_.isEmpty() == false) {
+        QPair<QString, QMap<QString, QString> > log = log_queue_.head();
+        if (cms_api_->updateMachineLog(machine_code_, log.first, log.second) == false) {
+            break;
+        }
+        log_queue_.dequeue();
+    }
+    sending_events_ = false;
 }
 
 void MainWindow::watch_pulling()
@@ -233,8 +660,12 @@ void MainWindow::watch_pulling()
             return;
         }
 
+        // the local thermostat owns the compressor, the cloud may only move the setpoint
+        if (thermostat_->isEnabled() && (pulling_cmd == PCMD_SET_COMPRESSOR_ON || pulling_cmd == PCMD_SET_COMPRESSOR_OFF)) {
+            qDebug() << "[PULLING] compressor command ignored, thermostat enabled";
+        }
         // normal request
-        if (pulling_cmd == PCMD_SET_COMPRESSOR_ON) {
+        else if (pulling_cmd == PCMD_SET_COMPRESSOR_ON) {
             if (vm_controller_ != nullptr)
                 vm_controller_->setCompressorSwitch(true);
         }
@@ -242,14 +673,111 @@ void MainWindow::watch_pulling()
             if (vm_controller_ != nullptr)
                 vm_controller_->setCompressorSwitch(false);
         }
+        else if (pulling_cmd == PCMD_SET_TEMP_SETPOINT) {
+            QJsonValue setpoint = intobj.value("parameter").toObject().value("setpoint");
+            bool ok = setpoint.isDouble();
+            double value = (ok)? setpoint.toDouble() : setpoint.toString().toDouble(&ok);
+            if (ok) {
+                qDebug() << "[PULLING] thermostat setpoint" << thermostat_->setpoint() << "->" << value;
+                thermostat_->setSetpoint(value);
+                thermostat_->saveConfig();
+            }
+            else {
+                qDebug() << "[PULLING] invalid setpoint:" << setpoint;
+            }
+        }
 
         // start pulling timer
         tmr_pulling_watch_->start();
     }
 }
 
+void MainWindow::ports_changed(QStringList port_names)
+{
+    QString current = ui->cbBox_port->currentText();
+
+    foreach (QString port_name, extra_ports_) {
+        if (port_names.contains(port_name) == false) {
+            port_names.append(port_name);
+        }
+    }
+    ui->cbBox_port->clear();
+    ui->cbBox_port->addItems(port_names);
+
+    // keep the selection while its port exists
+    if (port_names.contains(current)) {
+        ui->cbBox_port->setCurrentText(current);
+    }
+}
+
+void MainWindow::port_lost(QString port_name)
+{
+    qDebug() << "[PORT]" << port_name << "lost, waiting for the adapter to come back";
+    console_model_->appendLine(ConsoleModel::RX, QString("%1 -- port %2 lost").arg(QTime::currentTime().toString("hh:mm:ss"))
+                                                                           .arg(port_name));
+}
+
+void MainWindow::port_restored(QString port_name, qint64 outage_ms)
+{
+    // the adapter may come back under another name
+    if (ui->cbBox_port->findText(port_name) < 0) {
+        ui->cbBox_port->addItem(port_name);
+    }
+    ui->cbBox_port->setCurrentText(port_name);
+    console_model_->appendLine(ConsoleModel::RX, QString("%1 -- port %2 reopened after %3 s").arg(QTime::currentTime().toString("hh:mm:ss"))
+                                                                                         .arg(port_name)
+                                                                                         .arg(outage_ms / 1000.0, 0, 'f', 1));
+}
+
 void MainWindow::pbtn_set_clicked()
 {
     machine_code_ = ui->lineEdit_machine_code->text();
     tmr_pulling_watch_->start();
+    cms_bootstrap_->start(machine_code_);
+}
+
+void MainWindow::bootstrap_ready(bool from_cache)
+{
+    readBootstrapInfos();
+    console_model_->appendLine(ConsoleModel::RX, QString("%1 -- machine infos ready from %2 in %3 ms").arg(QTime::currentTime().toString("hh:mm:ss"))
+                                                                                                  .arg((from_cache)? "cache" : "CMS")
+                                                                                                  .arg(cms_bootstrap_->report().value("ready_ms").toDouble()));
+}
+
+void MainWindow::bootstrap_finished(bool result)
+{
+    // a revalidation may have changed the infos served at ready, the last
+    // known ones stay in use if it failed
+    if (result) {
+        readBootstrapInfos();
+    }
+    else {
+        console_model_->appendLine(ConsoleModel::RX, QString("%1 -- machine infos not refreshed%2").arg(QTime::currentTime().toString("hh:mm:ss"))
+                                                                                                  .arg((machine_infos_.isEmpty())? "" : ", keeping the last ones"));
+    }
+}
+
+void MainWindow::readBootstrapInfos()
+{
+    machine_infos_ = QJsonDocument::fromJson(cms_bootstrap_->infos(CmsBootstrap::MACHINE_INFO)).object();
+    vendor_infos_ = QJsonDocument::fromJson(cms_bootstrap_->infos(CmsBootstrap::VENDOR_INFO)).object();
+    version_infos_ = QJsonDocument::fromJson(cms_bootstrap_->infos(CmsBootstrap::VERSION_INFO)).object();
+    if (cms_api_->isDebugEnabled()) {
+        qDebug() << "[BOOT] machine:" << machine_infos_ << "vendor:" << vendor_infos_ << "version:" << version_infos_;
+    }
+}
+
+void MainWindow::prefetch_scan_codes()
+{
+    // once a day, inside the quiet hours and with a machine code set
+    QDateTime now = QDateTime::currentDateTime();
+    int hour = now.time().hour();
+    if (machine_code_.isEmpty() || prefetch_date_ == now.date()
+            || hour < prefetch_from_hour_ || hour >= prefetch_to_hour_) {
+        return;
+    }
+    prefetch_date_ = now.date();
+
+    int count = cms_api_->prefetchScanCodes(machine_code_, 200);
+    qDebug() << "[SCAN]" << count << "scan codes refreshed";
 }
@@ -3,6 +3,18 @@
 
 #include <QMainWindow>
 #include <QTimer>
+#include <QQueue>
+#include <QMap>
+#include <QPair>
+#include <QStringList>
+#include <QThread>
+#include <QDate>
+#include <QJsonObject>
+
+#include "latency_trace.h"
+#include "sample_store.h"
+#include "telemetry_payload.h"
+#include "windowed_stats.h"
 
 #ifdef _WIN32
 #define dir_log         "D:/Qt Projects/_HillEver/ivm_temp_minitor/log"
@@ -16,7 +28,18 @@ QT_END_NAMESPACE
 
 // forward declaration
 class CmsApi;
+class CmsBootstrap;
 class VMController;
+class ConsoleModel;
+class AlarmEngine;
+class AnomalyDetector;
+class DutyCycleTracker;
+class ThermostatController;
+class LaneProfiler;
+class LogArchiver;
+class PortWatcher;
+class TelemetrySampler;
+class QSortFilterProxyModel;
 
 class MainWindow : public QMainWindow
 {
@@ -26,15 +49,50 @@ public:
     MainWindow(QWidget *parent = nullptr);
     ~MainWindow();
 
+    void addPortName(QString port_name);
+    void setTraceFile(QString file_path);
+    void setAlarmRulesFile(QString file_path);
+    void setThermostatFile(QString file_path);
+    void setAnomalyConfigFile(QString file_path);
+    void setStatsWindows(const QList<int> &minutes);
+    void setUploadWindow(int minutes);
+    void setPrefetchHours(int from_hour, int to_hour);
+
 private slots:
     void pbtn_open_clicked();
     void pbtn_send_clicked();
     void pbtn_clear_clicked();
+    void pbtn_pause_clicked();
+    void chBox_filter_toggled();
+    void cbBox_chart_span_changed(int index);
     void pbtn_set_clicked();
     void spinBox_valueChanged(int value);
     void vmc_send();
-    void vmc_ready_read();
+    void vmc_ready_read(QByteArray rx_data);
+    void sampler_sample_ready(const TemperatureSample &sample, const QByteArray &rx_data);
+    void upload_aggregate();
+    void alarm_changed(QString event_code, QMap<QString, QString> parameters);
     void watch_pulling();
+    void ports_changed(QStringList port_names);
+    void port_lost(QString port_name);
+    void port_restored(QString port_name, qint64 outage_ms);
+    void archive_finished(QJsonObject report);
+    void bootstrap_ready(bool from_cache);
+    void bootstrap_finished(bool result);
+    void prefetch_scan_codes();
+    void flush_queues();
+
+private:
+    void writeDailyLog(const QByteArray &rx_data);
+    LatencyTrace startTrace();
+    void enqueueUpload(const TelemetryPayload &payload, const LatencyTrace &trace);
+    bool takeWindowSummaries(const LatencyTrace &trace);
+    void takeDutySummaries();
+    void applyStatsThresholds();
+    void scheduleFlush();
+    void flushUploads();
+    void flushEvents();
+    void readBootstrapInfos();
 
 private:
     Ui::MainWindow *ui;
@@ -43,10 +101,82 @@ private:
     QTimer *tmr_pulling_watch_;
     QString machine_code_ = "";
 
+    // bounded output console
+    ConsoleModel *console_model_;
+    QSortFilterProxyModel *console_proxy_;
+
+    // decoded TPAL samples shown in the chart
+    SampleStore *sample_store_;
+
+    // high-rate sampling, raw samples stay local and aggregates are uploaded;
+    // the chart and the daily log take the first sample of each minute
+    TelemetrySampler *sampler_;
+    qint64 chart_minute_ = -1;
+    QTimer *tmr_upload_;
+    struct PendingUpload {
+        TelemetryPayload payload;
+        LatencyTrace trace;
+    };
+    QQueue<PendingUpload> upload_queue_;
+    bool uploading_ = false;
+
+    // refilled in place for every frame and aggregate, the queue keeps copies
+    TelemetryPayload frame_payload_;
+    TelemetryPayload aggregate_payload_;
+
+    // windowed statistics, with an upload window set only its summaries
+    // are uploaded instead of the frames or aggregates
+    WindowedStats *windowed_stats_;
+    int upload_window_ = -1;
+    TelemetryPayload window_payload_;
+
+    // newest high-rate sample, its trace follows the next aggregate
+    LatencyTrace last_trace_;
+
+    // local alarms, sent as events as soon as they are detected
+    AlarmEngine *alarm_engine_;
+
+    // drift warnings share the event queue with the alarms
+    AnomalyDetector *anomaly_detector_;
+
+    // hourly and daily compressor/door summaries, sent as machine logs
+    DutyCycleTracker *duty_tracker_;
+    QQueue<QPair<QString, QMap<QString, QString> > > log_queue_;
+    QQueue<QPair<QString, QMap<QString, QString> > > event_queue_;
+    bool sending_events_ = false;
+    bool flush_queued_ = false;
+
+    // optional local compressor loop, the cloud may only move its setpoint
+    ThermostatController *thermostat_;
+
+    // per-lane vend timing, kept in the log directory
+    LaneProfiler *lane_profiler_;
+
+    // closed daily logs are compressed in the background
+    LogArchiver *log_archiver_;
+    QThread archive_thread_;
+    QTimer *tmr_archive_;
+
     // web api manager
     CmsApi *cms_api_;
 
+    // machine, vendor and version infos, cached by the cms api
+    CmsBootstrap *cms_bootstrap_;
+    QJsonObject machine_infos_;
+    QJsonObject vendor_infos_;
+    QJsonObject version_infos_;
+
+    // scan codes are refreshed once a day in the quiet hours
+    QTimer *tmr_prefetch_;
+    int prefetch_from_hour_ = 3;
+    int prefetch_to_hour_ = 5;
+    QDate prefetch_date_;
+
     // external device
     VMController *vm_controller_;
+
+    // hot-plug monitoring, extra ports are the ones enumeration cannot see
+    PortWatcher *port_watcher_;
+    QStringList extra_ports_;
 };
 #endif // MAIN_WINDOW_H
@@ -0,0 +1,164 @@
+#include "metrics.h"
+
+#include <atomic>
+
+#include "latency_trace.h"
+#include "vm_controller.h"
+
+// static storage is zero initialized before any code runs
+static std::atomic<quint64> counters[Metrics::COUNTER_COUNT];
+static std::atomic<qint64> gauges[Metrics::GAUGE_COUNT];
+static std::atomic<quint64> timeouts[METRICS_STATE_COUNT];
+
+struct HistogramData
+{
+    std::atomic<quint64> buckets[METRICS_BUCKET_COUNT + 1];     // last one is +Inf
+    std::atomic<quint64> sum_us;
+};
+static HistogramData histograms[Metrics::HISTOGRAM_COUNT];
+
+// upper bounds in usecs, from 100 us to 5 s
+static const qint64 bucket_bounds[METRICS_BUCKET_COUNT] = {
+    100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 500000, 1000000, 2500000, 5000000
+};
+
+void Metrics::increment(Counter counter, quint64 count)
+{
+    counters[counter].fetch_add(count, std::memory_order_relaxed);
+}
+
+void Metrics::setGauge(Gauge gauge, qint64 value)
+{
+    gauges[gauge].store(value, std::memory_order_relaxed);
+}
+
+void Metrics::raiseGauge(Gauge gauge, qint64 value)
+{
+    qint64 current = gauges[gauge].load(std::memory_order_relaxed);
+    while (value > current && gauges[gauge].compare_exchange_weak(current, value, std::memory_order_relaxed) == false) {
+    }
+}
+
+void Metrics::observe(Histogram histogram, qint64 usecs)
+{
+    int bucket = 0;
+    while (bucket < METRICS_BUCKET_COUNT && usecs > bucket_bounds[bucket]) {
+        bucket++;
+    }
+    histograms[histogram].buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+    histograms[histogram].sum_us.fetch_add(quint64(qMax(qint64(0), usecs)), std::memory_order_relaxed);
+}
+
+void Metrics::incrementTimeout(int state)
+{
+    if (state >= 0 && state < METRICS_STATE_COUNT) {
+        timeouts[state].fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+quint64 Metrics::counter(Counter counter)
+{
+    return counters[counter].load(std::memory_order_relaxed);
+}
+
+qint64 Metrics::gauge(Gauge gauge)
+{
+    return gauges[gauge].load(std::memory_order_relaxed);
+}
+
+static void appendHeader(QByteArray *text, const char *name, const char *type, const char *help)
+{
+    text->append("# HELP ").append(name).append(' ').append(help).append('\n');
+    text->append("# TYPE ").append(name).append(' ').append(type).append('\n');
+}
+
+static void appendValue(QByteArray *text, const char *name, const QByteArray &labels, double value)
+{
+    text->append(name);
+    if (labels.isEmpty() == false) {
+        text->append('{').append(labels).append('}');
+    }
+    text->append(' ').append(QByteArray::number(value, 'g', 12)).append('\n');
+}
+
+static void appendCounter(QByteArray *text, const char *name, const char *help, Metrics::Counter counter)
+{
+    appendHeader(text, name, "counter", help);
+    appendValue(text, name, QByteArray(), Metrics::counter(counter));
+}
+
+static void appendGauge(QByteArray *text, const char *name, const char *help, double value)
+{
+    appendHeader(text, name, "gauge", help);
+    appendValue(text, name, QByteArray(), value);
+}
+
+static void appendHistogramSeries(QByteArray *text, const char *name, const QByteArray &labels, Metrics::Histogram histogram)
+{
+    QByteArray prefix = (labels.isEmpty())? QByteArray() : labels + ",";
+    QByteArray bucket_name = QByteArray(name) + "_bucket";
+    quint64 cumulative = 0;
+    for (int i = 0; i <= METRICS_BUCKET_COUNT; i++) {
+        cumulative += histograms[histogram].buckets[i].load(std::memory_order_relaxed);
+        QByteArray le = (i < METRICS_BUCKET_COUNT)? QByteArray::number(bucket_bounds[i] / 1000000.0) : QByteArray("+Inf");
+        appendValue(text, bucket_name.constData(), prefix + "le=\"" + le + "\"", cumulative);
+    }
+    appendValue(text, (QByteArray(name) + "_sum").constData(), labels,
+                histograms[histogram].sum_us.load(std::memory_order_relaxed) / 1000000.0);
+    appendValue(text, (QByteArray(name) + "_count").constData(), labels, cumulative);
+}
+
+static void appendHistogram(QByteArray *text, const char *name, const char *help, Metrics::Histogram histogram)
+{
+    appendHeader(text, name, "histogram", help);
+    appendHistogramSeries(text, name, QByteArray(), histogram);
+}
+
+QByteArray Metrics::exposition()
+{
+    QByteArray text;
+    text.reserve(4096);
+
+    appendCounter(&text, "ivm_samples_received_total", "Decoded TPAL samples.", SAMPLES_RECEIVED);
+    appendCounter(&text, "ivm_frame_errors_total", "VMC responses with an invalid length or content.", FRAME_ERRORS);
+
+    appendHeader(&text, "ivm_vmc_timeouts_total", "counter", "VMC commands without a response, by controller state.");
+    for (int state = 0; state < METRICS_STATE_COUNT; state++) {
+        quint64 count = timeouts[state].load(std::memory_order_relaxed);
+        if (count > 0) {
+            appendValue(&text, "ivm_vmc_timeouts_total", QByteArray("state=\"") + VMController::stateName(state) + "\"", count);
+        }
+    }
+
+    appendCounter(&text, "ivm_port_reconnects_total", "Automatic reopens of the VMC serial port.", PORT_RECONNECTS);
+    appendGauge(&text, "ivm_port_last_outage_seconds", "Time from losing the VMC port to reopening it.", gauge(PORT_OUTAGE_MS) / 1000.0);
+    appendGauge(&text, "ivm_port_last_reconnect_seconds", "Time from the VMC port reappearing to reopening it.", gauge(PORT_RECONNECT_MS) / 1000.0);
+
+    appendGauge(&text, "ivm_bootstrap_ready_seconds", "Time from the startup bootstrap to usable machine infos.", gauge(BOOTSTRAP_READY_MS) / 1000.0);
+    appendCounter(&text, "ivm_cms_requests_total", "CMS requests sent.", CMS_REQUESTS);
+    appendCounter(&text, "ivm_cms_errors_total", "CMS requests failed at the network level.", CMS_ERRORS);
+    appendCounter(&text, "ivm_cms_cache_hits_total", "Cached CMS infos served without a request.", CMS_CACHE_HITS);
+    appendCounter(&text, "ivm_cms_cache_misses_total", "Cacheable CMS requests answered with a full body.", CMS_CACHE_MISSES);
+    appendCounter(&text, "ivm_cms_cache_revalidated_total", "Cached CMS infos confirmed unchanged by a 304.", CMS_CACHE_REVALIDATED);
+    appendCounter(&text, "ivm_scan_cache_hits_total", "Barcode and love code scans resolved locally.", SCAN_CACHE_HITS);
+    appendCounter(&text, "ivm_scan_cache_stale_total", "Scans answered from an expired entry while the CMS was unreachable.", SCAN_CACHE_STALE);
+    appendCounter(&text, "ivm_scan_cache_misses_total", "Scans that needed a CMS lookup.", SCAN_CACHE_MISSES);
+    appendHistogram(&text, "ivm_cms_request_duration_seconds", "CMS request round trip time.", CMS_LATENCY);
+    appendCounter(&text, "ivm_events_sent_total", "Events delivered to the CMS.", EVENTS_SENT);
+
+    appendGauge(&text, "ivm_outbox_depth", "Monitoring uploads waiting to be sent.", gauge(OUTBOX_DEPTH));
+    appendGauge(&text, "ivm_event_queue_depth", "Events waiting to be sent.", gauge(EVENT_QUEUE_DEPTH));
+    appendGauge(&text, "ivm_event_loop_lag_seconds", "Latest delay of a timer in the GUI event loop.", gauge(EVENT_LOOP_LAG_US) / 1000000.0);
+    appendGauge(&text, "ivm_event_loop_lag_max_seconds", "Largest event loop delay since start.", gauge(EVENT_LOOP_LAG_MAX_US) / 1000000.0);
+    appendHistogram(&text, "ivm_event_loop_lag_distribution_seconds", "Event loop delay distribution.", EVENT_LOOP_LAG);
+
+    // sample pipeline, each stage measured from the previous one
+    appendHeader(&text, "ivm_sample_stage_seconds", "histogram", "Time a sample spent reaching each stage from the previous one.");
+    for (int stage = LatencyTrace::FRAME_COMPLETE; stage < LatencyTrace::STAGE_COUNT; stage++) {
+        appendHistogramSeries(&text, "ivm_sample_stage_seconds", QByteArray("stage=\"") + LatencyTrace::stageName(stage) + "\"",
+                              Histogram(STAGE_FRAME_COMPLETE + stage - LatencyTrace::FRAME_COMPLETE));
+    }
+    appendHistogram(&text, "ivm_sample_to_ack_seconds", "Time from the TPAL request to the CMS acknowledgment.", STAGE_TOTAL);
+
+    return text;
+}
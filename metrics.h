@@ -0,0 +1,70 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <QByteArray>
+
+#define METRICS_STATE_COUNT     32
+#define METRICS_BUCKET_COUNT    15
+
+// Process wide counters, gauges and histograms. Every update is a single
+// relaxed atomic operation, so the hot paths never take a lock; the text
+// exposition reads the same atomics when /metrics is scraped.
+class Metrics
+{
+public:
+    enum Counter {
+        SAMPLES_RECEIVED,
+        FRAME_ERRORS,
+        CMS_REQUESTS,
+        CMS_ERRORS,
+        CMS_CACHE_HITS,
+        CMS_CACHE_MISSES,
+        CMS_CACHE_REVALIDATED,
+        SCAN_CACHE_HITS,
+        SCAN_CACHE_STALE,
+        SCAN_CACHE_MISSES,
+        EVENTS_SENT,
+        PORT_RECONNECTS,
+        COUNTER_COUNT
+    };
+
+    enum Gauge {
+        OUTBOX_DEPTH,
+        EVENT_QUEUE_DEPTH,
+        EVENT_LOOP_LAG_US,
+        EVENT_LOOP_LAG_MAX_US,
+        PORT_OUTAGE_MS,
+        PORT_RECONNECT_MS,
+        BOOTSTRAP_READY_MS,
+        GAUGE_COUNT
+    };
+
+    enum Histogram {
+        CMS_LATENCY,
+        EVENT_LOOP_LAG,
+        STAGE_FRAME_COMPLETE,   // sample stages follow LatencyTrace::Stage order
+        STAGE_DECODE,
+        STAGE_LOG_WRITE,
+        STAGE_ENQUEUE,
+        STAGE_HTTP_SEND,
+        STAGE_HTTP_ACK,
+        STAGE_TOTAL,
+        HISTOGRAM_COUNT
+    };
+
+    static void increment(Counter counter, quint64 count = 1);
+    static void setGauge(Gauge gauge, qint64 value);
+    static void raiseGauge(Gauge gauge, qint64 value);
+    static void observe(Histogram histogram, qint64 usecs);
+
+    // VMController::State of the command that timed out
+    static void incrementTimeout(int state);
+
+    static quint64 counter(Counter counter);
+    static qint64 gauge(Gauge gauge);
+
+    // Prometheus text format, version 0.0.4
+    static QByteArray exposition();
+};
+
+#endif // METRICS_H
@@ -0,0 +1,109 @@
+#include "metrics_server.h"
+
+#include <QTimer>
+#include <QTcpSocket>
+#include <QHostAddress>
+#include <QDebug>
+
+#include "metrics.h"
+
+#define LAG_TICK_MS     100
+
+MetricsServer::MetricsServer(QObject *parent)
+    : QTcpServer(parent)
+{
+    connect(this, SIGNAL(newConnection()), this, SLOT(newClient()));
+
+    // a timer that fires late means the event loop was blocked meanwhile
+    tmr_lag_ = new QTimer(this);
+    tmr_lag_->setTimerType(Qt::PreciseTimer);
+    tmr_lag_->setInterval(LAG_TICK_MS);
+    connect(tmr_lag_, SIGNAL(timeout()), this, SLOT(lagTick()));
+}
+
+MetricsServer::~MetricsServer()
+{
+
+}
+
+bool MetricsServer::start(QString address)
+{
+    int separator = address.lastIndexOf(':');
+    QString host = (separator >= 0)? address.left(separator) : QString("127.0.0.1");
+    quint16 port = address.mid(separator + 1).toUShort();
+
+    QHostAddress host_address = (host.isEmpty())? QHostAddress(QHostAddress::Any) : QHostAddress(host);
+    if (this->listen(host_address, port) == false) {
+        qDebug() << "[METRICS] listen on" << address << "failed:" << this->errorString();
+        return false;
+    }
+    qDebug() << "[METRICS] serving on" << host_address.toString() << this->serverPort();
+
+    lag_clock_.start();
+    last_tick_us_ = -1;
+    tmr_lag_->start();
+    return true;
+}
+
+void MetricsServer::newClient()
+{
+    while (this->hasPendingConnections()) {
+        QTcpSocket *socket = this->nextPendingConnection();
+        connect(socket, SIGNAL(readyRead()), this, SLOT(clientReadyRead()));
+        connect(socket, SIGNAL(disconnected()), socket, SLOT(deleteLater()));
+    }
+}
+
+void MetricsServer::clientReadyRead()
+{
+    QTcpSocket *socket = qobject_cast<QTcpSocket *>(sender());
+    if (socket == nullptr) {
+        return;
+    }
+
+    // only the request line matters, wait for the end of the headers
+    QByteArray request = socket->peek(socket->bytesAvailable());
+    if (request.contains("\r\n\r\n") == false) {
+        if (request.size() > 8192) {
+            socket->abort();
+        }
+        return;
+    }
+    socket->readAll();
+
+    QList<QByteArray> request_line = request.left(request.indexOf("\r\n")).split(' ');
+    if (request_line.size() < 2 || request_line.at(0) != "GET") {
+        reply(socket, "405 Method Not Allowed", "text/plain", "method not allowed\n");
+    }
+    else if (request_line.at(1) == "/metrics") {
+        reply(socket, "200 OK", "text/plain; version=0.0.4; charset=utf-8", Metrics::exposition());
+    }
+    else {
+        reply(socket, "404 Not Found", "text/plain", "not found\n");
+    }
+}
+
+void MetricsServer::lagTick()
+{
+    qint64 now_us = lag_clock_.nsecsElapsed() / 1000;
+    if (last_tick_us_ >= 0) {
+        qint64 lag_us = qMax(qint64(0), now_us - last_tick_us_ - LAG_TICK_MS * 1000);
+        Metrics::setGauge(Metrics::EVENT_LOOP_LAG_US, lag_us);
+        Metrics::raiseGauge(Metrics::EVENT_LOOP_LAG_MAX_US, lag_us);
+        Metrics::observe(Metrics::EVENT_LOOP_LAG, lag_us);
+    }
+    last_tick_us_ = now_us;
+}
+
+void MetricsServer::reply(QTcpSocket *socket, const QByteArray &status, const QByteArray &content_type, const QByteArray &body)
+{
+    QByteArray response;
+    response.append("HTTP/1.1 ").append(status).append("\r\n");
+    response.append("Content-Type: ").append(content_type).append("\r\n");
+    response.append("Content-Length: ").append(QByteArray::number(body.size())).append("\r\n");
+    response.append("Connection: close\r\n\r\n");
+    response.append(body);
+
+    socket->write(response);
+    socket->disconnectFromHost();
+}
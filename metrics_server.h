@@ -0,0 +1,37 @@
+#ifndef METRICS_SERVER_H
+#define METRICS_SERVER_H
+
+#include <QTcpServer>
+#include <QElapsedTimer>
+
+class QTimer;
+class QTcpSocket;
+
+// Minimal HTTP endpoint serving Metrics::exposition() on GET /metrics.
+// It also measures event loop lag with a short periodic timer.
+class MetricsServer : public QTcpServer
+{
+    Q_OBJECT
+
+public:
+    MetricsServer(QObject *parent = nullptr);
+    ~MetricsServer();
+
+    // e.g. "127.0.0.1:9105" or ":9105" for every interface
+    bool start(QString address);
+
+private slots:
+    void newClient();
+    void clientReadyRead();
+    void lagTick();
+
+private:
+    void reply(QTcpSocket *socket, const QByteArray &status, const QByteArray &content_type, const QByteArray &body);
+
+private:
+    QTimer *tmr_lag_;
+    QElapsedTimer lag_clock_;
+    qint64 last_tick_us_ = -1;
+};
+
+#endif // METRICS_SERVER_H
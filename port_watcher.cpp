@@ -0,0 +1,229 @@
+#include "port_watcher.h"
+
+#include <QFileSystemWatcher>
+#include <QSerialPortInfo>
+#include <QTimer>
+#include <QDir>
+#include <QFile>
+#include <QDebug>
+
+#include "metrics.h"
+#include "vm_controller.h"
+
+#define RECONNECT_BACKOFF_MIN_MS    500
+#define RECONNECT_BACKOFF_MAX_MS    30000
+
+PortWatcher::PortWatcher(VMController *vm_controller, QObject *parent)
+    : QObject(parent)
+    , vm_controller_(vm_controller)
+{
+    // udev creates and renames nodes in bursts, rescan once it settles
+    tmr_rescan_ = new QTimer(this);
+    tmr_rescan_->setInterval(300);
+    tmr_rescan_->setSingleShot(true);
+    connect(tmr_rescan_, SIGNAL(timeout()), this, SLOT(rescan()));
+
+    tmr_reconnect_ = new QTimer(this);
+    tmr_reconnect_->setSingleShot(true);
+    connect(tmr_reconnect_, SIGNAL(timeout()), this, SLOT(reconnect()));
+
+    fs_watcher_ = new QFileSystemWatcher(this);
+    connect(fs_watcher_, SIGNAL(directoryChanged(QString)), this, SLOT(directoryChanged()));
+    watchDirectories();
+
+    connect(vm_controller_, SIGNAL(errorOccurred(QSerialPort::SerialPortError)), this, SLOT(serialError(QSerialPort::SerialPortError)));
+
+    port_names_ = availablePorts();
+}
+
+PortWatcher::~PortWatcher()
+{
+
+}
+
+void PortWatcher::attach()
+{
+    // remember the adapter, not only its current device name
+    QSerialPortInfo port_info(vm_controller_->portName());
+    port_name_ = vm_controller_->portName();
+    system_location_ = (port_info.isNull())? port_name_ : port_info.systemLocation();
+    serial_number_ = port_info.serialNumber();
+    vendor_id_ = port_info.vendorIdentifier();
+    product_id_ = port_info.productIdentifier();
+
+    attached_ = true;
+    connected_ = vm_controller_->isOpen();
+    qDebug() << "[PORT] following" << port_name_ << "serial number" << serial_number_;
+}
+
+void PortWatcher::detach()
+{
+    attached_ = false;
+    connected_ = false;
+    tmr_reconnect_->stop();
+}
+
+bool PortWatcher::isAttached() const
+{
+    return attached_;
+}
+
+bool PortWatcher::isConnected() const
+{
+    return connected_;
+}
+
+QStringList PortWatcher::availablePorts() const
+{
+    QStringList port_names;
+    foreach (QSerialPortInfo port_info, QSerialPortInfo::availablePorts()) {
+        port_names.append(port_info.portName());
+    }
+    return port_names;
+}
+
+qint64 PortWatcher::reconnectCount() const
+{
+    return reconnect_count_;
+}
+
+qint64 PortWatcher::lastOutageTime() const
+{
+    return last_outage_ms_;
+}
+
+qint64 PortWatcher::lastReconnectTime() const
+{
+    return last_reconnect_ms_;
+}
+
+void PortWatcher::directoryChanged()
+{
+    tmr_rescan_->start();
+}
+
+void PortWatcher::rescan()
+{
+    // by-id only exists while some USB serial adapter is plugged in
+    watchDirectories();
+
+    QStringList port_names = availablePorts();
+    if (port_names != port_names_) {
+        port_names_ = port_names;
+        emit portsChanged(port_names_);
+    }
+
+    if (attached_ == false) {
+        return;
+    }
+
+    // the device node disappears with the adapter
+    if (connected_) {
+        if (QFile::exists(system_location_) == false) {
+            portGone();
+        }
+    }
+    else if (findPort().isEmpty() == false) {
+        // the adapter is back, try right away instead of waiting for the backoff
+        if (reappear_clock_.isValid() == false) {
+            reappear_clock_.start();
+        }
+        backoff_ms_ = RECONNECT_BACKOFF_MIN_MS;
+        tmr_reconnect_->stop();
+        reconnect();
+    }
+}
+
+void PortWatcher::serialError(QSerialPort::SerialPortError error)
+{
+    // a USB adapter that goes away reports a resource error on the open port
+    if (attached_ && connected_ && error == QSerialPort::ResourceError) {
+        portGone();
+    }
+}
+
+void PortWatcher::reconnect()
+{
+    if (attached_ == false || connected_) {
+        return;
+    }
+
+    // VMController::isOpened may have reopened the same name already
+    bool opened = vm_controller_->isOpen();
+    if (opened == false) {
+        QString port_name = findPort();
+        if (port_name.isEmpty() == false) {
+            if (reappear_clock_.isValid() == false) {
+                reappear_clock_.start();
+            }
+            vm_controller_->setPortName(port_name);
+            opened = vm_controller_->open(QIODevice::ReadWrite);
+        }
+    }
+
+    if (opened == false) {
+        backoff_ms_ = qMin(backoff_ms_ * 2, RECONNECT_BACKOFF_MAX_MS);
+        tmr_reconnect_->start(backoff_ms_);
+        return;
+    }
+
+    vm_controller_->setRequestToSend(true);
+    connected_ = true;
+    port_name_ = vm_controller_->portName();
+    QSerialPortInfo port_info(port_name_);
+    system_location_ = (port_info.isNull())? port_name_ : port_info.systemLocation();
+    last_outage_ms_ = outage_clock_.elapsed();
+    last_reconnect_ms_ = (reappear_clock_.isValid())? reappear_clock_.elapsed() : 0;
+    reconnect_count_++;
+
+    Metrics::increment(Metrics::PORT_RECONNECTS);
+    Metrics::setGauge(Metrics::PORT_OUTAGE_MS, last_outage_ms_);
+    Metrics::setGauge(Metrics::PORT_RECONNECT_MS, last_reconnect_ms_);
+    qDebug() << "[PORT] reopened" << port_name_ << "after an outage of" << last_outage_ms_
+             << "ms, reconnect took" << last_reconnect_ms_ << "ms";
+
+    emit portRestored(port_name_, last_outage_ms_);
+}
+
+void PortWatcher::portGone()
+{
+    connected_ = false;
+    outage_clock_.start();
+    reappear_clock_.invalidate();
+    qDebug() << "[PORT] lost" << port_name_;
+
+    vm_controller_->close();
+    emit portLost(port_name_);
+
+    backoff_ms_ = RECONNECT_BACKOFF_MIN_MS;
+    tmr_reconnect_->start(backoff_ms_);
+}
+
+QString PortWatcher::findPort() const
+{
+    // ports without a serial number (on-board UARTs, ptys) keep their name
+    if (serial_number_.isEmpty()) {
+        return (QFile::exists(system_location_))? port_name_ : QString();
+    }
+
+    foreach (QSerialPortInfo port_info, QSerialPortInfo::availablePorts()) {
+        if (port_info.serialNumber() == serial_number_
+                && port_info.vendorIdentifier() == vendor_id_
+                && port_info.productIdentifier() == product_id_) {
+            return port_info.portName();
+        }
+    }
+    return QString();
+}
+
+void PortWatcher::watchDirectories()
+{
+    QStringList directories;
+    directories << "/dev" << "/dev/serial/by-id";
+
+    foreach (QString directory, directories) {
+        if (QDir(directory).exists() && fs_watcher_->directories().contains(directory) == false) {
+            fs_watcher_->addPath(directory);
+        }
+    }
+}
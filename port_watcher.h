@@ -0,0 +1,76 @@
+#ifndef PORT_WATCHER_H
+#define PORT_WATCHER_H
+
+#include <QObject>
+#include <QElapsedTimer>
+#include <QSerialPort>
+#include <QStringList>
+
+class QFileSystemWatcher;
+class QTimer;
+class VMController;
+
+// Watches /dev and /dev/serial/by-id (inotify on Linux) for serial ports
+// coming and going. While attached it follows the VMC adapter by its USB
+// serial number, so a re-enumerated adapter is reopened under its new name
+// with exponential backoff.
+class PortWatcher : public QObject
+{
+    Q_OBJECT
+
+public:
+    PortWatcher(VMController *vm_controller, QObject *parent = nullptr);
+    ~PortWatcher();
+
+    // start following the port VMController has open, detach on manual close
+    void attach();
+    void detach();
+    bool isAttached() const;
+    bool isConnected() const;
+
+    QStringList availablePorts() const;
+
+    qint64 reconnectCount() const;
+    qint64 lastOutageTime() const;      // msecs from loss to reopen
+    qint64 lastReconnectTime() const;   // msecs from the port reappearing to reopen
+
+Q_SIGNALS:
+    void portsChanged(QStringList port_names);
+    void portLost(QString port_name);
+    void portRestored(QString port_name, qint64 outage_ms);
+
+private slots:
+    void directoryChanged();
+    void rescan();
+    void serialError(QSerialPort::SerialPortError error);
+    void reconnect();
+
+private:
+    void portGone();
+    QString findPort() const;
+    void watchDirectories();
+
+private:
+    VMController *vm_controller_;
+    QFileSystemWatcher *fs_watcher_;
+    QTimer *tmr_rescan_;
+    QTimer *tmr_reconnect_;
+    QStringList port_names_;
+
+    bool attached_ = false;
+    bool connected_ = false;
+    QString port_name_;
+    QString system_location_;
+    QString serial_number_;
+    quint16 vendor_id_ = 0;
+    quint16 product_id_ = 0;
+
+    int backoff_ms_ = 0;
+    QElapsedTimer outage_clock_;
+    QElapsedTimer reappear_clock_;
+    qint64 reconnect_count_ = 0;
+    qint64 last_outage_ms_ = 0;
+    qint64 last_reconnect_ms_ = 0;
+};
+
+#endif // PORT_WATCHER_H
@@ -0,0 +1,192 @@
+#include "protocol_bench.h"
+
+#include <QElapsedTimer>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QDateTime>
+#include <QTime>
+#include <QTextStream>
+#include <QDebug>
+
+#include <atomic>
+#include <stdlib.h>
+
+#include "sample_store.h"
+#include "telemetry_payload.h"
+#include "vm_controller.h"
+
+// Count heap allocations by interposing malloc in the executable. Qt
+// containers allocate through malloc directly and operator new ends up
+// there as well, so this catches both.
+static std::atomic<quint64> allocation_count(0);
+
+#ifdef __GLIBC__
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t count, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+
+void *malloc(size_t size) noexcept
+{
+    allocation_count.fetch_add(1, std::memory_order_relaxed);
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size) noexcept
+{
+    allocation_count.fetch_add(1, std::memory_order_relaxed);
+    return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size) noexcept
+{
+    allocation_count.fetch_add(1, std::memory_order_relaxed);
+    return __libc_realloc(ptr, size);
+}
+}
+#endif
+
+static const QByteArray tpal_frame("TP01+04.0TP02+04.5TP03+05.0TP04+05.5TP05-18.0TP06-18.5TP07+07.0TP08+07.5CP1FN1DR0");
+
+quint64 ProtocolBench::allocationCount()
+{
+    return allocation_count.load(std::memory_order_relaxed);
+}
+
+QJsonObject ProtocolBench::measure(QString name, int iterations, std::function<void()> operation)
+{
+    // warm up caches and lazily created statics
+    for (int i = 0; i < iterations / 10 + 1; i++) {
+        operation();
+    }
+
+    quint64 allocations = allocationCount();
+    QElapsedTimer timer;
+    timer.start();
+    for (int i = 0; i < iterations; i++) {
+        operation();
+    }
+    qint64 elapsed_ns = timer.nsecsElapsed();
+    allocations = allocationCount() - allocations;
+
+    QJsonObject result_obj;
+    result_obj.insert("name", name);
+    result_obj.insert("iterations", iterations);
+    result_obj.insert("ns_per_op", double(elapsed_ns) / iterations);
+    result_obj.insert("allocs_per_op", double(allocations) / iterations);
+    return result_obj;
+}
+
+int ProtocolBench::run(QString output_path, QString baseline_path)
+{
+    const int iterations = 100000;
+    QJsonArray results;
+
+    // TPAL decode into a typed sample
+    results.append(measure("tpal_decode", iterations, []() {
+        TemperatureSample sample;
+        TemperatureSample::fromTpal(tpal_frame, 0, &sample);
+    }));
+
+    // response classification through the VMController state machine
+    VMController vm_controller;
+    vm_controller.setReplayMode(true);
+    results.append(measure("classify_tpal", iterations, [&vm_controller]() {
+        vm_controller.replayTransmit(CMD_TPAL "\n");
+        vm_controller.replayReceive(tpal_frame);
+    }));
+    results.append(measure("classify_cars", iterations, [&vm_controller]() {
+        vm_controller.replayTransmit(CMD_CARS "\n");
+        vm_controller.replayReceive("CAGOOK");
+    }));
+    results.append(measure("classify_channel_error", iterations, [&vm_controller]() {
+        vm_controller.replayTransmit("CH11\n");
+        vm_controller.replayReceive("CH11OK");
+        vm_controller.replayReceive("CH11EE02");
+    }));
+
+    // upload payload: fill the fixed layout and write it into the reused
+    // body, neither may allocate once the buffer has grown
+    TelemetryPayload payload;
+    results.append(measure("telemetry_payload_fill", iterations, [&payload]() {
+        payload.fromTpal(tpal_frame);
+    }));
+    QByteArray head = TelemetryPayload::head("M0001");
+    QByteArray request_data;
+    results.append(measure("telemetry_payload_write", iterations, [&payload, &head, &request_data]() {
+        payload.write(head, &request_data);
+    }));
+
+    // daily log line formatting
+    results.append(measure("log_line_format", iterations, []() {
+        QByteArray line = TemperatureSample::tpalLogLine(tpal_frame, QTime::currentTime().toString("hh:mm:ss"));
+        Q_UNUSED(line);
+    }));
+
+    QJsonObject report_obj;
+    report_obj.insert("timestamp", QDateTime::currentDateTime().toString(Qt::ISODate));
+    report_obj.insert("qt_version", QString(qVersion()));
+#ifdef __GLIBC__
+    report_obj.insert("alloc_counting", true);
+#else
+    report_obj.insert("alloc_counting", false);
+#endif
+    report_obj.insert("results", results);
+
+    // compare with the results of a previous release, debug output is
+    // muted while benchmarking so the summary goes to stderr
+    if (baseline_path.isEmpty() == false) {
+        QFile baseline_file(baseline_path);
+        QTextStream err(stderr);
+        if (baseline_file.open(QFile::ReadOnly)) {
+            QJsonArray baseline = QJsonDocument::fromJson(baseline_file.readAll()).object().value("results").toArray();
+            foreach (QJsonValue value, results) {
+                QJsonObject current = value.toObject();
+                foreach (QJsonValue base_value, baseline) {
+                    QJsonObject base = base_value.toObject();
+                    if (base.value("name") == current.value("name") && base.value("ns_per_op").toDouble() > 0) {
+                        err << QString("[BENCH] %1: %2 ns/op (%3x), %4 allocs/op (was %5)\n")
+                               .arg(current.value("name").toString(), -24)
+                               .arg(current.value("ns_per_op").toDouble(), 0, 'f', 1)
+                               .arg(current.value("ns_per_op").toDouble() / base.value("ns_per_op").toDouble(), 0, 'f', 2)
+                               .arg(current.value("allocs_per_op").toDouble(), 0, 'f', 1)
+                               .arg(base.value("allocs_per_op").toDouble(), 0, 'f', 1);
+                    }
+                }
+            }
+        }
+    }
+
+    // the upload path is expected to stay off the heap
+    int status = 0;
+#ifdef __GLIBC__
+    foreach (QJsonValue value, results) {
+        QJsonObject current = value.toObject();
+        if (current.value("name").toString().startsWith("telemetry_payload_") && current.value("allocs_per_op").toDouble() > 0) {
+            QTextStream err(stderr);
+            err << QString("[BENCH] %1 allocates %2 times per op\n")
+                   .arg(current.value("name").toString())
+                   .arg(current.value("allocs_per_op").toDouble());
+            status = 2;
+        }
+    }
+#endif
+
+    QByteArray report = QJsonDocument(report_obj).toJson();
+    if (output_path.isEmpty() || output_path == "-") {
+        QTextStream out(stdout);
+        out << report;
+        out.flush();
+        return status;
+    }
+
+    QFile output_file(output_path);
+    if (output_file.open(QFile::WriteOnly | QFile::Truncate) == false) {
+        qWarning() << "[BENCH] open output failed:" << output_path;
+        return 1;
+    }
+    output_file.write(report);
+    output_file.close();
+    return status;
+}
@@ -0,0 +1,22 @@
+#ifndef PROTOCOL_BENCH_H
+#define PROTOCOL_BENCH_H
+
+#include <QString>
+#include <QJsonObject>
+#include <functional>
+
+// Microbenchmarks of the VMC receive path and the upload payload.
+// Built only with "qmake CONFIG+=benchmark", run with --bench.
+class ProtocolBench
+{
+public:
+    static int run(QString output_path, QString baseline_path = QString());
+
+    // heap allocations made by the process so far
+    static quint64 allocationCount();
+
+private:
+    static QJsonObject measure(QString name, int iterations, std::function<void()> operation);
+};
+
+#endif // PROTOCOL_BENCH_H
@@ -0,0 +1,207 @@
+#include "sample_store.h"
+
+bool TemperatureSample::fromTpal(const QByteArray &rx_data, qint64 timestamp, TemperatureSample *sample)
+{
+    // TPAL frame: 8 x (4 bytes tag + 5 bytes value), then cp, fn and door flags
+    if (rx_data.length() < 81) {
+        return false;
+    }
+
+    for (int i = 0; i < TP_CHANNEL_COUNT; i++) {
+        bool ok = false;
+        sample->temperature[i] = rx_data.mid(4 + i * 9, 5).trimmed().toFloat(&ok);
+        if (ok == false) {
+            return false;
+        }
+    }
+
+    sample->timestamp = timestamp;
+    sample->state = 0;
+    if (rx_data.at(74) == '1') {
+        sample->state |= SAMPLE_STATE_CP;
+    }
+    if (rx_data.at(77) == '1') {
+        sample->state |= SAMPLE_STATE_FN;
+    }
+    if (rx_data.at(80) == '1') {
+        sample->state |= SAMPLE_STATE_DOOR;
+    }
+    return true;
+}
+
+QByteArray TemperatureSample::tpalLogLine(const QByteArray &rx_data, const QString &time)
+{
+    QByteArray line;
+    line.append(time.toUtf8());
+    line.append(", TP01 ").append(rx_data.mid( 4, 5));
+    line.append(", TP02 ").append(rx_data.mid(13, 5));
+    line.append(", TP03 ").append(rx_data.mid(22, 5));
+    line.append(", TP04 ").append(rx_data.mid(31, 5));
+    line.append(", TP05 ").append(rx_data.mid(40, 5));
+    line.append(", TP06 ").append(rx_data.mid(49, 5));
+    line.append(", TP07 ").append(rx_data.mid(58, 5));
+    line.append(", TP08 ").append(rx_data.mid(67, 5));
+    line.append('\n');
+    return line;
+}
+
+void SampleBucket::add(const TemperatureSample &sample)
+{
+    if (count == 0) {
+        first_timestamp = sample.timestamp;
+        for (int i = 0; i < TP_CHANNEL_COUNT; i++) {
+            min[i] = sample.temperature[i];
+            max[i] = sample.temperature[i];
+        }
+    }
+    else {
+        for (int i = 0; i < TP_CHANNEL_COUNT; i++) {
+            min[i] = qMin(min[i], sample.temperature[i]);
+            max[i] = qMax(max[i], sample.temperature[i]);
+        }
+    }
+    last_timestamp = sample.timestamp;
+    state_any |= sample.state;
+    count++;
+}
+
+void SampleBucket::merge(const SampleBucket &other)
+{
+    if (other.count == 0) {
+        return;
+    }
+    if (count == 0) {
+        *this = other;
+        return;
+    }
+    for (int i = 0; i < TP_CHANNEL_COUNT; i++) {
+        min[i] = qMin(min[i], other.min[i]);
+        max[i] = qMax(max[i], other.max[i]);
+    }
+    last_timestamp = other.last_timestamp;
+    state_any |= other.state_any;
+    count += other.count;
+}
+
+SampleStore::SampleStore(int capacity, QObject *parent)
+    : QObject(parent)
+{
+    // allocate the whole ring once
+    samples_.resize(qMax(1, capacity));
+    blocks_.resize(samples_.size() / BLOCK_SIZE + 2);
+}
+
+SampleStore::~SampleStore()
+{
+
+}
+
+void SampleStore::append(const TemperatureSample &sample)
+{
+    qint64 sequence = next_sequence_++;
+    samples_[int(sequence % samples_.size())] = sample;
+
+    // update the block summary incrementally
+    SampleBucket &block = blocks_[int((sequence / BLOCK_SIZE) % blocks_.size())];
+    if (sequence % BLOCK_SIZE == 0) {
+        block = SampleBucket();
+    }
+    block.add(sample);
+
+    emit sampleAppended();
+}
+
+void SampleStore::clear()
+{
+    next_sequence_ = 0;
+}
+
+int SampleStore::count() const
+{
+    return int(next_sequence_ - oldestSequence());
+}
+
+int SampleStore::capacity() const
+{
+    return samples_.size();
+}
+
+bool SampleStore::latest(TemperatureSample *sample) const
+{
+    if (next_sequence_ == 0) {
+        return false;
+    }
+    *sample = at(next_sequence_ - 1);
+    return true;
+}
+
+int SampleStore::decimate(qint64 from, qint64 to, int bucket_count, QVector<SampleBucket> *buckets) const
+{
+    buckets->resize(0);
+
+    qint64 begin = lowerBound(from);
+    qint64 end = lowerBound(to + 1);
+    qint64 total = end - begin;
+    if (total <= 0 || bucket_count <= 0) {
+        return 0;
+    }
+
+    // split the range into buckets of equal sample count
+    int used = int(qMin<qint64>(bucket_count, total));
+    buckets->resize(used);
+    for (int i = 0; i < used; i++) {
+        qint64 bucket_begin = begin + total * i / used;
+        qint64 bucket_end = begin + total * (i + 1) / used;
+        summarize(bucket_begin, bucket_end, &(*buckets)[i]);
+    }
+    return used;
+}
+
+qint64 SampleStore::oldestSequence() const
+{
+    return qMax<qint64>(0, next_sequence_ - samples_.size());
+}
+
+qint64 SampleStore::lowerBound(qint64 timestamp) const
+{
+    // samples are appended in time order, binary search the ring
+    qint64 low = oldestSequence();
+    qint64 high = next_sequence_;
+    while (low < high) {
+        qint64 mid = low + (high - low) / 2;
+        if (at(mid).timestamp < timestamp) {
+            low = mid + 1;
+        }
+        else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+const TemperatureSample &SampleStore::at(qint64 sequence) const
+{
+    return samples_.at(int(sequence % samples_.size()));
+}
+
+void SampleStore::summarize(qint64 begin, qint64 end, SampleBucket *bucket) const
+{
+    *bucket = SampleBucket();
+
+    // raw samples up to the next block boundary
+    qint64 sequence = begin;
+    while (sequence < end && sequence % BLOCK_SIZE != 0) {
+        bucket->add(at(sequence++));
+    }
+
+    // whole blocks
+    while (sequence + BLOCK_SIZE <= end) {
+        bucket->merge(blocks_.at(int((sequence / BLOCK_SIZE) % blocks_.size())));
+        sequence += BLOCK_SIZE;
+    }
+
+    // remaining raw samples
+    while (sequence < end) {
+        bucket->add(at(sequence++));
+    }
+}
@@ -0,0 +1,81 @@
+#ifndef SAMPLE_STORE_H
+#define SAMPLE_STORE_H
+
+#include <QObject>
+#include <QVector>
+#include <QByteArray>
+#include <QMap>
+
+#define TP_CHANNEL_COUNT    8
+
+#define SAMPLE_STATE_CP     0x01
+#define SAMPLE_STATE_FN     0x02
+#define SAMPLE_STATE_DOOR   0x04
+
+// one decoded TPAL frame
+struct TemperatureSample
+{
+    qint64 timestamp = 0;   // msecs since epoch
+    float temperature[TP_CHANNEL_COUNT];
+    quint8 state = 0;       // SAMPLE_STATE_* flags
+
+    static bool fromTpal(const QByteArray &rx_data, qint64 timestamp, TemperatureSample *sample);
+
+    // raw frame helper shared by the daily log and the benchmark
+    static QByteArray tpalLogLine(const QByteArray &rx_data, const QString &time);
+};
+
+// min/max summary of a run of samples, used for decimated rendering
+struct SampleBucket
+{
+    qint64 first_timestamp = 0;
+    qint64 last_timestamp = 0;
+    float min[TP_CHANNEL_COUNT];
+    float max[TP_CHANNEL_COUNT];
+    quint8 state_any = 0;   // flags set in at least one sample
+    int count = 0;
+
+    void add(const TemperatureSample &sample);
+    void merge(const SampleBucket &other);
+};
+
+class SampleStore : public QObject
+{
+    Q_OBJECT
+
+public:
+    // default keeps 30 days of one sample per minute
+    SampleStore(int capacity = 30 * 24 * 60, QObject *parent = nullptr);
+    ~SampleStore();
+
+    void append(const TemperatureSample &sample);
+    void clear();
+
+    int count() const;
+    int capacity() const;
+    bool latest(TemperatureSample *sample) const;
+
+    // summarize [from, to] into at most bucket_count min/max buckets
+    int decimate(qint64 from, qint64 to, int bucket_count, QVector<SampleBucket> *buckets) const;
+
+Q_SIGNALS:
+    void sampleAppended();
+
+private:
+    qint64 oldestSequence() const;
+    qint64 lowerBound(qint64 timestamp) const;
+    const TemperatureSample &at(qint64 sequence) const;
+    void summarize(qint64 begin, qint64 end, SampleBucket *bucket) const;
+
+private:
+    // raw samples, addressed by a monotonic sequence number
+    QVector<TemperatureSample> samples_;
+    qint64 next_sequence_ = 0;
+
+    // one pre-aggregated block per BLOCK_SIZE samples so that wide
+    // buckets cost O(samples / BLOCK_SIZE) instead of O(samples)
+    enum { BLOCK_SIZE = 64 };
+    QVector<SampleBucket> blocks_;
+};
+
+#endif // SAMPLE_STORE_H
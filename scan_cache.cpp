@@ -0,0 +1,200 @@
+#include "scan_cache.h"
+
+#include <QFile>
+#include <QSaveFile>
+#include <QDataStream>
+#include <QDateTime>
+#include <QVector>
+#include <QPair>
+#include <QDebug>
+
+#include <algorithm>
+#include <cstring>
+
+#define SCAN_CACHE_VERSION      1
+
+// changed entries written at once, the rest waits for the next save
+#define SCAN_CACHE_SAVE_DIRTY   32
+
+ScanCache::ScanCache(int capacity, int ttl_sec)
+    : entries_(capacity)
+    , ttl_ms_(qMax(1, ttl_sec) * 1000LL)
+{
+
+}
+
+ScanCache::~ScanCache()
+{
+    if (dirty_ > 0) {
+        save();
+    }
+}
+
+bool ScanCache::setFile(QString file_path)
+{
+    file_path_ = file_path;
+    entries_.clear();
+    dirty_ = 0;
+    return load();
+}
+
+bool ScanCache::save()
+{
+    if (file_path_.isEmpty()) {
+        return false;
+    }
+
+    QSaveFile index_file(file_path_);
+    if (index_file.open(QFile::WriteOnly) == false) {
+        qDebug() << "[SCAN] save index failed:" << file_path_;
+        return false;
+    }
+
+    QDataStream out(&index_file);
+    out.setVersion(QDataStream::Qt_5_0);
+    out.writeRawData("IVSC", 4);
+    out << quint8(SCAN_CACHE_VERSION) << quint32(entries_.size());
+
+    // least recently used first, loading them in order rebuilds the LRU order
+    foreach (QString entry_key, keysByUse()) {
+        const Entry *entry = entries_.object(entry_key);
+        out << quint8(entry_key.at(0).toLatin1() - '0') << entry_key.mid(1)
+            << entry->stored_ms << entry->used_ms << entry->hits << entry->infos;
+    }
+
+    if (index_file.commit() == false) {
+        qDebug() << "[SCAN] save index failed:" << file_path_;
+        return false;
+    }
+    dirty_ = 0;
+    return true;
+}
+
+bool ScanCache::lookup(Kind kind, const QString &code, QByteArray *infos, bool allow_stale)
+{
+    Entry *entry = entries_.object(key(kind, code));
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
+    if (entry == nullptr || (allow_stale == false && now - entry->stored_ms > ttl_ms_)) {
+        return false;
+    }
+
+    entry->used_ms = now;
+    entry->hits++;
+    *infos = entry->infos;
+    return true;
+}
+
+void ScanCache::insert(Kind kind, const QString &code, const QByteArray &infos)
+{
+    QString entry_key = key(kind, code);
+    Entry *entry = new Entry();
+    entry->infos = infos;
+    entry->stored_ms = QDateTime::currentMSecsSinceEpoch();
+    entry->used_ms = entry->stored_ms;
+
+    // a refresh keeps the popularity of the code
+    const Entry *previous = entries_.object(entry_key);
+    if (previous != nullptr) {
+        entry->hits = previous->hits;
+    }
+    entries_.insert(entry_key, entry);
+
+    if (++dirty_ >= SCAN_CACHE_SAVE_DIRTY) {
+        save();
+    }
+}
+
+QStringList ScanCache::hotCodes(Kind kind, int max_count, int expiring_within_sec) const
+{
+    qint64 limit_ms = QDateTime::currentMSecsSinceEpoch() - ttl_ms_ + expiring_within_sec * 1000LL;
+    QString prefix = key(kind, QString());
+
+    QVector<QPair<quint32, QString> > candidates;
+    foreach (QString entry_key, keysByUse()) {
+        const Entry *entry = entries_.object(entry_key);
+        if (entry_key.startsWith(prefix) && entry->stored_ms <= limit_ms) {
+            candidates.append(qMakePair(entry->hits, entry_key.mid(1)));
+        }
+    }
+    std::sort(candidates.begin(), candidates.end(), [](const QPair<quint32, QString> &a, const QPair<quint32, QString> &b) {
+        return a.first > b.first;
+    });
+
+    QStringList codes;
+    for (int i = 0; i < candidates.size() && i < max_count; i++) {
+        codes.append(candidates.at(i).second);
+    }
+    return codes;
+}
+
+int ScanCache::size() const
+{
+    return entries_.size();
+}
+
+QString ScanCache::key(Kind kind, const QString &code)
+{
+    return QString::number(int(kind)) + code;
+}
+
+QList<QString> ScanCache::keysByUse() const
+{
+    // every object() call makes the entry the most recent one, so the
+    // entries are visited once for a snapshot and then in order of use,
+    // which leaves the LRU order as it was
+    QVector<QPair<qint64, QString> > uses;
+    foreach (QString entry_key, entries_.keys()) {
+        uses.append(qMakePair(entries_.object(entry_key)->used_ms, entry_key));
+    }
+    std::sort(uses.begin(), uses.end(), [](const QPair<qint64, QString> &a, const QPair<qint64, QString> &b) {
+        return a.first < b.first;
+    });
+
+    QList<QString> entry_keys;
+    for (int i = 0; i < uses.size(); i++) {
+        entries_.object(uses.at(i).second);
+        entry_keys.append(uses.at(i).second);
+    }
+    return entry_keys;
+}
+
+bool ScanCache::load()
+{
+    QFile index_file(file_path_);
+    if (index_file.exists() == false) {
+        return true;
+    }
+    if (index_file.open(QFile::ReadOnly) == false) {
+        qDebug() << "[SCAN] open index failed:" << file_path_;
+        return false;
+    }
+
+    QDataStream in(&index_file);
+    in.setVersion(QDataStream::Qt_5_0);
+    char magic[4];
+    quint8 version = 0;
+    quint32 count = 0;
+    if (in.readRawData(magic, 4) != 4 || memcmp(magic, "IVSC", 4) != 0) {
+        qDebug() << "[SCAN] not a scan cache index:" << file_path_;
+        return false;
+    }
+    in >> version >> count;
+    if (version != SCAN_CACHE_VERSION) {
+        qDebug() << "[SCAN] unknown index version:" << version;
+        return false;
+    }
+
+    for (quint32 i = 0; i < count && in.status() == QDataStream::Ok; i++) {
+        quint8 kind = 0;
+        QString code;
+        Entry *entry = new Entry();
+        in >> kind >> code >> entry->stored_ms >> entry->used_ms >> entry->hits >> entry->infos;
+        if (in.status() != QDataStream::Ok) {
+            delete entry;
+            break;
+        }
+        entries_.insert(key(Kind(kind), code), entry);
+    }
+    qDebug() << "[SCAN]" << entries_.size() << "cached codes loaded";
+    return true;
+}
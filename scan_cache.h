@@ -0,0 +1,58 @@
+#ifndef SCAN_CACHE_H
+#define SCAN_CACHE_H
+
+#include <QString>
+#include <QByteArray>
+#include <QStringList>
+#include <QCache>
+
+// LRU cache of barcode and love-code lookups with a TTL. A fresh entry
+// answers a scan without the CMS, a stale one is still used while the CMS
+// is unreachable. The entries are saved to a compact binary index so the
+// cache survives restarts:
+//
+// header : "IVSC", version (1 byte), entry count (4 bytes)
+// entry  : kind (1 byte), code, stored ms, used ms, hits, infos (QDataStream)
+class ScanCache
+{
+public:
+    enum Kind {
+        BARCODE,
+        LOVE_CODE
+    };
+
+    ScanCache(int capacity = 4096, int ttl_sec = 24 * 60 * 60);
+    ~ScanCache();
+
+    bool setFile(QString file_path);
+    bool save();
+
+    // stale entries are only returned with allow_stale
+    bool lookup(Kind kind, const QString &code, QByteArray *infos, bool allow_stale = false);
+    void insert(Kind kind, const QString &code, const QByteArray &infos);
+
+    // most used codes first, for the prefetch in quiet hours
+    QStringList hotCodes(Kind kind, int max_count, int expiring_within_sec) const;
+
+    int size() const;
+
+private:
+    struct Entry {
+        QByteArray infos;
+        qint64 stored_ms = 0;
+        qint64 used_ms = 0;
+        quint32 hits = 0;
+    };
+
+    static QString key(Kind kind, const QString &code);
+    QList<QString> keysByUse() const;
+    bool load();
+
+private:
+    QString file_path_;
+    QCache<QString, Entry> entries_;
+    qint64 ttl_ms_;
+    int dirty_ = 0;
+};
+
+#endif // SCAN_CACHE_H
@@ -0,0 +1,118 @@
+#include "serial_replay.h"
+
+#include <QElapsedTimer>
+
+#include "vm_controller.h"
+
+SerialReplay::SerialReplay(QObject *parent)
+    : QObject(parent)
+{
+    vm_controller_ = new VMController(this);
+    vm_controller_->setReplayMode(true);
+
+    connect(vm_controller_, SIGNAL(timeoutWithState(QString,int)), this, SLOT(timeoutWithState(QString,int)));
+    connect(vm_controller_, SIGNAL(getFirmwareInfosResponse(QString)), this, SLOT(firmwareInfosResponse(QString)));
+    connect(vm_controller_, SIGNAL(getTemperatureStatusResponse(QString)), this, SLOT(temperatureStatusResponse(QString)));
+    connect(vm_controller_, SIGNAL(setCompressorSwitchResponse(bool)), this, SLOT(compressorSwitchResponse(bool)));
+    connect(vm_controller_, SIGNAL(setDoorSwitchResponse(bool)), this, SLOT(doorSwitchResponse(bool)));
+    connect(vm_controller_, SIGNAL(executeChannelResponse(bool,int)), this, SLOT(channelResponse(bool,int)));
+    connect(vm_controller_, SIGNAL(rawDataReceived(QByteArray)), this, SLOT(rawDataReceived(QByteArray)));
+}
+
+SerialReplay::~SerialReplay()
+{
+
+}
+
+bool SerialReplay::load(QString file_path)
+{
+    return SerialTrace::load(file_path, &records_);
+}
+
+void SerialReplay::run()
+{
+    transcript_.clear();
+
+    QElapsedTimer timer;
+    timer.start();
+
+    // no event loop runs here, so the receive timer never fires and the
+    // recorded timeouts are replayed instead
+    foreach (const SerialTrace::Record &record, records_) {
+        current_us_ = record.timestamp_us;
+        switch (record.type) {
+        case SerialTrace::TX:
+            log(QString("TX %1").arg(QString::fromUtf8(record.data.toHex())));
+            vm_controller_->replayTransmit(record.data);
+            break;
+        case SerialTrace::RX:
+            vm_controller_->replayReceive(record.data);
+            break;
+        case SerialTrace::TIMEOUT:
+            vm_controller_->replayTimeout();
+            break;
+        }
+    }
+
+    replay_us_ = timer.nsecsElapsed() / 1000;
+}
+
+QStringList SerialReplay::transcript() const
+{
+    return transcript_;
+}
+
+int SerialReplay::recordCount() const
+{
+    return records_.size();
+}
+
+qint64 SerialReplay::traceDuration() const
+{
+    return (records_.isEmpty())? 0 : records_.last().timestamp_us;
+}
+
+qint64 SerialReplay::replayDuration() const
+{
+    return replay_us_;
+}
+
+void SerialReplay::timeoutWithState(QString err_msg, int state)
+{
+    log(QString("timeout state=%1 %2").arg(state).arg(err_msg));
+}
+
+void SerialReplay::firmwareInfosResponse(QString infos)
+{
+    log(QString("firmware %1").arg(infos));
+}
+
+void SerialReplay::temperatureStatusResponse(QString status)
+{
+    log(QString("temperature %1").arg(status));
+}
+
+void SerialReplay::compressorSwitchResponse(bool result)
+{
+    log(QString("compressor %1").arg(result));
+}
+
+void SerialReplay::doorSwitchResponse(bool result)
+{
+    log(QString("door %1").arg(result));
+}
+
+void SerialReplay::channelResponse(bool result, int state)
+{
+    log(QString("channel %1 state=%2").arg(result).arg(state));
+}
+
+void SerialReplay::rawDataReceived(QByteArray rx_data)
+{
+    log(QString("raw %1").arg(QString::fromUtf8(rx_data.toHex())));
+}
+
+void SerialReplay::log(const QString &line)
+{
+    transcript_.append(QString("%1 %2").arg(current_us_, 12).arg(line));
+}
@@ -0,0 +1,50 @@
+#ifndef SERIAL_REPLAY_H
+#define SERIAL_REPLAY_H
+
+#include <QObject>
+#include <QStringList>
+#include <QVector>
+
+#include "serial_trace.h"
+
+class VMController;
+
+// Feeds a recorded trace through VMController's parser and state machine
+// as fast as possible and keeps a transcript of the emitted responses.
+class SerialReplay : public QObject
+{
+    Q_OBJECT
+
+public:
+    SerialReplay(QObject *parent = nullptr);
+    ~SerialReplay();
+
+    bool load(QString file_path);
+    void run();
+
+    QStringList transcript() const;
+    int recordCount() const;
+    qint64 traceDuration() const;   // usecs of the recorded session
+    qint64 replayDuration() const;  // usecs spent replaying it
+
+private slots:
+    void timeoutWithState(QString err_msg, int state);
+    void firmwareInfosResponse(QString infos);
+    void temperatureStatusResponse(QString status);
+    void compressorSwitchResponse(bool result);
+    void doorSwitchResponse(bool result);
+    void channelResponse(bool result, int state);
+    void rawDataReceived(QByteArray rx_data);
+
+private:
+    void log(const QString &line);
+
+private:
+    VMController *vm_controller_;
+    QVector<SerialTrace::Record> records_;
+    QStringList transcript_;
+    qint64 current_us_ = 0;
+    qint64 replay_us_ = 0;
+};
+
+#endif // SERIAL_REPLAY_H
@@ -0,0 +1,145 @@
+#include "serial_trace.h"
+
+#include <QDateTime>
+#include <QtEndian>
+
+#define TRACE_MAGIC     "IVMT"
+#define TRACE_VERSION   1
+
+SerialTrace::SerialTrace()
+{
+
+}
+
+SerialTrace::~SerialTrace()
+{
+    close();
+}
+
+bool SerialTrace::open(QString file_path)
+{
+    close();
+
+    file_.setFileName(file_path);
+    if (file_.open(QFile::WriteOnly | QFile::Truncate) == false) {
+        return false;
+    }
+
+    // write file header
+    QByteArray header;
+    header.append(TRACE_MAGIC);
+    header.append(char(TRACE_VERSION));
+    uchar start[8];
+    qToLittleEndian<qint64>(QDateTime::currentMSecsSinceEpoch(), start);
+    header.append(reinterpret_cast<const char *>(start), 8);
+    file_.write(header);
+    file_.flush();
+
+    clock_.start();
+    last_us_ = 0;
+    return true;
+}
+
+void SerialTrace::close()
+{
+    if (file_.isOpen()) {
+        file_.flush();
+        file_.close();
+    }
+}
+
+bool SerialTrace::isOpen() const
+{
+    return file_.isOpen();
+}
+
+void SerialTrace::record(Type type, const QByteArray &data)
+{
+    if (file_.isOpen() == false) {
+        return;
+    }
+
+    // timestamps are stored as deltas to keep records small
+    qint64 now_us = clock_.nsecsElapsed() / 1000;
+    buffer_.resize(0);
+    buffer_.append(char(type));
+    appendVarint(&buffer_, quint64(now_us - last_us_));
+    appendVarint(&buffer_, quint64(data.length()));
+    buffer_.append(data);
+    last_us_ = now_us;
+
+    // flush every record so a crash keeps the tail of the session
+    file_.write(buffer_);
+    file_.flush();
+}
+
+bool SerialTrace::load(QString file_path, QVector<Record> *records, qint64 *start_msecs)
+{
+    QFile file(file_path);
+    if (file.open(QFile::ReadOnly) == false) {
+        return false;
+    }
+    QByteArray content = file.readAll();
+    file.close();
+
+    // check file header
+    if (content.length() < 13 || content.startsWith(TRACE_MAGIC) == false || content.at(4) != TRACE_VERSION) {
+        return false;
+    }
+    if (start_msecs != nullptr) {
+        *start_msecs = qFromLittleEndian<qint64>(reinterpret_cast<const uchar *>(content.constData() + 5));
+    }
+
+    // decode records, a truncated tail record is ignored
+    records->clear();
+    qint64 timestamp_us = 0;
+    int offset = 13;
+    while (offset < content.length()) {
+        Record record;
+        quint64 delta_us = 0;
+        quint64 length = 0;
+
+        int type = content.at(offset++);
+        if (type < TX || type > TIMEOUT) {
+            return false;
+        }
+        if (readVarint(content, &offset, &delta_us) == false ||
+            readVarint(content, &offset, &length) == false ||
+            quint64(content.length() - offset) < length) {
+            break;
+        }
+
+        timestamp_us += qint64(delta_us);
+        record.type = Type(type);
+        record.timestamp_us = timestamp_us;
+        record.data = content.mid(offset, int(length));
+        records->append(record);
+        offset += int(length);
+    }
+    return true;
+}
+
+void SerialTrace::appendVarint(QByteArray *buffer, quint64 value)
+{
+    while (value >= 0x80) {
+        buffer->append(char((value & 0x7f) | 0x80));
+        value >>= 7;
+    }
+    buffer->append(char(value));
+}
+
+bool SerialTrace::readVarint(const QByteArray &buffer, int *offset, quint64 *value)
+{
+    *value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        if (*offset >= buffer.length()) {
+            return false;
+        }
+        quint8 byte = quint8(buffer.at((*offset)++));
+        *value |= quint64(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,53 @@
+#ifndef SERIAL_TRACE_H
+#define SERIAL_TRACE_H
+
+#include <QFile>
+#include <QVector>
+#include <QByteArray>
+#include <QElapsedTimer>
+
+// Compact binary trace of a serial session.
+//
+// header : "IVMT", version (1 byte), wall clock start in msecs (8 bytes LE)
+// record : type (1 byte), delta usecs (varint), length (varint), data
+class SerialTrace
+{
+public:
+    enum Type {
+        TX,
+        RX,
+        TIMEOUT
+    };
+
+    struct Record {
+        Type type;
+        qint64 timestamp_us;    // monotonic, relative to the start of the trace
+        QByteArray data;
+    };
+
+public:
+    SerialTrace();
+    ~SerialTrace();
+
+    bool open(QString file_path);
+    void close();
+    bool isOpen() const;
+
+    void record(Type type, const QByteArray &data);
+
+    static bool load(QString file_path, QVector<Record> *records, qint64 *start_msecs = nullptr);
+
+private:
+    static void appendVarint(QByteArray *buffer, quint64 value);
+    static bool readVarint(const QByteArray &buffer, int *offset, quint64 *value);
+
+private:
+    QFile file_;
+    QElapsedTimer clock_;
+    qint64 last_us_ = 0;
+
+    // reused for encoding each record
+    QByteArray buffer_;
+};
+
+#endif // SERIAL_TRACE_H
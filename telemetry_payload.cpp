@@ -0,0 +1,208 @@
+#include "telemetry_payload.h"
+
+#include <QJsonArray>
+#include <QJsonDocument>
+
+#include <stdio.h>
+#include <string.h>
+
+static_assert(TelemetryPayload::FIELD_COUNT <= 64, "present_ holds one bit per field");
+
+struct KeySegment {
+    const char *key;
+    const char *text;       // ,"key":"
+    int length;
+};
+
+#define KEY_SEGMENT(name)   { name, ",\"" name "\":\"", int(sizeof(",\"" name "\":\"") - 1) }
+
+// the JSON skeleton, one interned segment per field in upload order
+static const KeySegment key_segments[TelemetryPayload::FIELD_COUNT] = {
+    KEY_SEGMENT("temperature_1"),
+    KEY_SEGMENT("temperature_2"),
+    KEY_SEGMENT("temperature_3"),
+    KEY_SEGMENT("temperature_4"),
+    KEY_SEGMENT("temperature_5"),
+    KEY_SEGMENT("temperature_6"),
+    KEY_SEGMENT("temperature_7"),
+    KEY_SEGMENT("temperature_8"),
+    KEY_SEGMENT("temperature_1_min"),
+    KEY_SEGMENT("temperature_2_min"),
+    KEY_SEGMENT("temperature_3_min"),
+    KEY_SEGMENT("temperature_4_min"),
+    KEY_SEGMENT("temperature_5_min"),
+    KEY_SEGMENT("temperature_6_min"),
+    KEY_SEGMENT("temperature_7_min"),
+    KEY_SEGMENT("temperature_8_min"),
+    KEY_SEGMENT("temperature_1_max"),
+    KEY_SEGMENT("temperature_2_max"),
+    KEY_SEGMENT("temperature_3_max"),
+    KEY_SEGMENT("temperature_4_max"),
+    KEY_SEGMENT("temperature_5_max"),
+    KEY_SEGMENT("temperature_6_max"),
+    KEY_SEGMENT("temperature_7_max"),
+    KEY_SEGMENT("temperature_8_max"),
+    KEY_SEGMENT("temperature_1_var"),
+    KEY_SEGMENT("temperature_2_var"),
+    KEY_SEGMENT("temperature_3_var"),
+    KEY_SEGMENT("temperature_4_var"),
+    KEY_SEGMENT("temperature_5_var"),
+    KEY_SEGMENT("temperature_6_var"),
+    KEY_SEGMENT("temperature_7_var"),
+    KEY_SEGMENT("temperature_8_var"),
+    KEY_SEGMENT("temperature_1_above_s"),
+    KEY_SEGMENT("temperature_2_above_s"),
+    KEY_SEGMENT("temperature_3_above_s"),
+    KEY_SEGMENT("temperature_4_above_s"),
+    KEY_SEGMENT("temperature_5_above_s"),
+    KEY_SEGMENT("temperature_6_above_s"),
+    KEY_SEGMENT("temperature_7_above_s"),
+    KEY_SEGMENT("temperature_8_above_s"),
+    KEY_SEGMENT("cp"),
+    KEY_SEGMENT("fn"),
+    KEY_SEGMENT("door"),
+    KEY_SEGMENT("cp_ratio"),
+    KEY_SEGMENT("fn_ratio"),
+    KEY_SEGMENT("door_ratio"),
+    KEY_SEGMENT("sample_count"),
+    KEY_SEGMENT("sample_dropped"),
+    KEY_SEGMENT("jitter_avg_ms"),
+    KEY_SEGMENT("jitter_max_ms"),
+    KEY_SEGMENT("window_start"),
+    KEY_SEGMENT("window_s")
+};
+
+// TPAL frame: 8 x (4 bytes tag + 5 bytes value), then cp, fn and door flags
+static const int tpal_offsets[TP_CHANNEL_COUNT] = {
+    4, 13, 22, 31, 40, 49, 58, 67
+};
+
+TelemetryPayload::TelemetryPayload()
+{
+    clear();
+}
+
+void TelemetryPayload::clear()
+{
+    present_ = 0;
+    memset(lengths_, 0, sizeof(lengths_));
+}
+
+bool TelemetryPayload::isEmpty() const
+{
+    return present_ == 0;
+}
+
+bool TelemetryPayload::fromTpal(const QByteArray &rx_data)
+{
+    clear();
+    if (rx_data.length() < 81) {
+        return false;
+    }
+
+    const char *data = rx_data.constData();
+    for (int i = 0; i < TP_CHANNEL_COUNT; i++) {
+        setText(Field(TEMPERATURE + i), data + tpal_offsets[i], 5);
+    }
+    setText(CP,   data + 74, 1);
+    setText(FN,   data + 77, 1);
+    setText(DOOR, data + 80, 1);
+    return true;
+}
+
+void TelemetryPayload::setText(Field field, const char *text, int length)
+{
+    length = qMin(length, TELEMETRY_VALUE_SIZE);
+    char *value = values_[field];
+    for (int i = 0; i < length; i++) {
+        // values are written into the JSON as they are, keep out anything
+        // that would need escaping
+        char c = text[i];
+        value[i] = (c < 0x20 || c > 0x7e || c == '"' || c == '\\')? '?' : c;
+    }
+    lengths_[field] = quint8(length);
+    present_ |= (quint64(1) << field);
+}
+
+void TelemetryPayload::setTemperature(Field field, double value)
+{
+    // same layout as the TPAL frame
+    char buffer[32];
+    int length = snprintf(buffer, sizeof(buffer), "%+05.1f", value);
+    setText(field, buffer, length);
+}
+
+void TelemetryPayload::setFlag(Field field, bool on)
+{
+    setText(field, on? "1" : "0", 1);
+}
+
+void TelemetryPayload::setDecimal(Field field, double value, int decimals)
+{
+    char buffer[64];
+    int length = snprintf(buffer, sizeof(buffer), "%.*f", decimals, value);
+    setText(field, buffer, length);
+}
+
+void TelemetryPayload::setNumber(Field field, qint64 value)
+{
+    char buffer[32];
+    int length = snprintf(buffer, sizeof(buffer), "%lld", (long long)value);
+    setText(field, buffer, length);
+}
+
+bool TelemetryPayload::has(Field field) const
+{
+    return (present_ & (quint64(1) << field)) != 0;
+}
+
+QByteArray TelemetryPayload::value(Field field) const
+{
+    if (has(field) == false) {
+        return QByteArray();
+    }
+    return QByteArray(values_[field], lengths_[field]);
+}
+
+const char *TelemetryPayload::key(Field field)
+{
+    return key_segments[field].key;
+}
+
+QByteArray TelemetryPayload::head(const QString &machine_code)
+{
+    // let QJsonDocument escape the code: ["..."] -> {"machine_code":"..."
+    QByteArray code = QJsonDocument(QJsonArray() << machine_code).toJson(QJsonDocument::Compact);
+    return QByteArray("{\"machine_code\":") + code.mid(1, code.length() - 2);
+}
+
+void TelemetryPayload::write(const QByteArray &head, QByteArray *buffer) const
+{
+    int length = head.length() + 1;
+    for (int i = 0; i < FIELD_COUNT; i++) {
+        if (has(Field(i))) {
+            length += key_segments[i].length + lengths_[i] + 1;
+        }
+    }
+
+    // a reserved buffer keeps its capacity when it shrinks
+    if (buffer->capacity() < length) {
+        buffer->reserve(length * 2);
+    }
+    buffer->resize(length);
+
+    char *out = buffer->data();
+    memcpy(out, head.constData(), head.length());
+    out += head.length();
+    for (int i = 0; i < FIELD_COUNT; i++) {
+        if (has(Field(i)) == false) {
+            continue;
+        }
+        memcpy(out, key_segments[i].text, key_segments[i].length);
+        out += key_segments[i].length;
+        memcpy(out, values_[i], lengths_[i]);
+        out += lengths_[i];
+        *out++ = '"';
+    }
+    *out = '}';
+}
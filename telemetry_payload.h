@@ -0,0 +1,69 @@
+#ifndef TELEMETRY_PAYLOAD_H
+#define TELEMETRY_PAYLOAD_H
+
+#include <QByteArray>
+#include <QString>
+
+#include "sample_store.h"
+
+#define TELEMETRY_VALUE_SIZE    16
+
+// Fixed-layout monitoring upload. Values are kept in place as the text the
+// cloud expects, write() appends them between precomputed JSON key segments
+// into a reused buffer, so filling and serializing a sample does not touch
+// the heap once the buffer has grown to its working size.
+class TelemetryPayload
+{
+public:
+    enum Field {
+        TEMPERATURE       = 0,                                  // temperature_1..8
+        TEMPERATURE_MIN   = TEMPERATURE + TP_CHANNEL_COUNT,     // temperature_N_min
+        TEMPERATURE_MAX   = TEMPERATURE_MIN + TP_CHANNEL_COUNT,
+        TEMPERATURE_VAR   = TEMPERATURE_MAX + TP_CHANNEL_COUNT,
+        TEMPERATURE_ABOVE = TEMPERATURE_VAR + TP_CHANNEL_COUNT, // secs above threshold
+        CP                = TEMPERATURE_ABOVE + TP_CHANNEL_COUNT,
+        FN,
+        DOOR,
+        CP_RATIO,
+        FN_RATIO,
+        DOOR_RATIO,
+        SAMPLE_COUNT,
+        SAMPLE_DROPPED,
+        JITTER_AVG_MS,
+        JITTER_MAX_MS,
+        WINDOW_START,       // secs since epoch
+        WINDOW_SEC,
+        FIELD_COUNT
+    };
+
+    TelemetryPayload();
+
+    void clear();
+    bool isEmpty() const;
+
+    // the 11 raw fields of a TPAL frame, false if the frame is too short
+    bool fromTpal(const QByteArray &rx_data);
+
+    void setText(Field field, const char *text, int length);
+    void setTemperature(Field field, double value);     // +04.5, -18.0
+    void setFlag(Field field, bool on);
+    void setDecimal(Field field, double value, int decimals);
+    void setNumber(Field field, qint64 value);
+
+    bool has(Field field) const;
+    QByteArray value(Field field) const;
+    static const char *key(Field field);
+
+    // {"machine_code":"..." with the code escaped, built once per code
+    static QByteArray head(const QString &machine_code);
+
+    // head, the fields that are set and the closing brace
+    void write(const QByteArray &head, QByteArray *buffer) const;
+
+private:
+    char values_[FIELD_COUNT][TELEMETRY_VALUE_SIZE];
+    quint8 lengths_[FIELD_COUNT];
+    quint64 present_ = 0;
+};
+
+#endif // TELEMETRY_PAYLOAD_H
@@ -0,0 +1,183 @@
+#include "telemetry_sampler.h"
+
+#include <QDateTime>
+#include <QDebug>
+
+#include "metrics.h"
+#include "vm_controller.h"
+
+TelemetrySampler::TelemetrySampler(VMController *vm_controller, QObject *parent)
+    : QObject(parent)
+    , vm_controller_(vm_controller)
+{
+    connect(vm_controller_, SIGNAL(pollIssued(int)), this, SLOT(pollIssued(int)));
+    connect(vm_controller_, SIGNAL(pollSkipped(int,int)), this, SLOT(pollSkipped(int,int)));
+    connect(vm_controller_, SIGNAL(pollResponse(int,bool,QString)), this, SLOT(pollResponse(int,bool,QString)));
+
+    resetAggregate();
+}
+
+TelemetrySampler::~TelemetrySampler()
+{
+
+}
+
+void TelemetrySampler::setInterval(int msecs)
+{
+    interval_ms_ = qMax(1000, msecs);
+    if (active_) {
+        vm_controller_->setPollPeriod(VMController::POLL_TPAL, interval_ms_);
+    }
+}
+
+int TelemetrySampler::interval() const
+{
+    return interval_ms_;
+}
+
+void TelemetrySampler::start()
+{
+    active_ = true;
+    last_tick_ms_ = -1;
+    tick_clock_.start();
+    vm_controller_->setPollPeriod(VMController::POLL_TPAL, interval_ms_);
+}
+
+void TelemetrySampler::stop()
+{
+    active_ = false;
+    vm_controller_->setPollPeriod(VMController::POLL_TPAL, 0);
+}
+
+bool TelemetrySampler::isActive() const
+{
+    return active_;
+}
+
+bool TelemetrySampler::takeAggregate(TelemetryPayload *payload)
+{
+    if (aggregate_count_ == 0) {
+        resetAggregate();
+        return false;
+    }
+
+    // mean keeps the original field names, min/max are added next to it
+    payload->clear();
+    for (int i = 0; i < TP_CHANNEL_COUNT; i++) {
+        payload->setTemperature(TelemetryPayload::Field(TelemetryPayload::TEMPERATURE + i), sum_[i] / aggregate_count_);
+        payload->setTemperature(TelemetryPayload::Field(TelemetryPayload::TEMPERATURE_MIN + i), min_[i]);
+        payload->setTemperature(TelemetryPayload::Field(TelemetryPayload::TEMPERATURE_MAX + i), max_[i]);
+    }
+    payload->setFlag(TelemetryPayload::CP,   last_sample_.state & SAMPLE_STATE_CP);
+    payload->setFlag(TelemetryPayload::FN,   last_sample_.state & SAMPLE_STATE_FN);
+    payload->setFlag(TelemetryPayload::DOOR, last_sample_.state & SAMPLE_STATE_DOOR);
+    payload->setDecimal(TelemetryPayload::CP_RATIO,   double(cp_on_count_) / aggregate_count_, 3);
+    payload->setDecimal(TelemetryPayload::FN_RATIO,   double(fn_on_count_) / aggregate_count_, 3);
+    payload->setDecimal(TelemetryPayload::DOOR_RATIO, double(door_open_count_) / aggregate_count_, 3);
+    payload->setNumber(TelemetryPayload::SAMPLE_COUNT,   aggregate_count_);
+    payload->setNumber(TelemetryPayload::SAMPLE_DROPPED, aggregate_dropped_);
+
+    resetAggregate();
+    return true;
+}
+
+qint64 TelemetrySampler::sampleCount() const
+{
+    return sample_count_;
+}
+
+qint64 TelemetrySampler::droppedCount() const
+{
+    return dropped_count_;
+}
+
+double TelemetrySampler::averageJitter() const
+{
+    return (jitter_count_ > 0)? jitter_sum_ / jitter_count_ : 0.0;
+}
+
+qint64 TelemetrySampler::maxJitter() const
+{
+    return jitter_max_;
+}
+
+void TelemetrySampler::pollIssued(int command)
+{
+    if (active_ == false || command != VMController::POLL_TPAL) {
+        return;
+    }
+
+    // measure how far the poll is from the nominal interval
+    qint64 now_ms = tick_clock_.elapsed();
+    if (last_tick_ms_ >= 0) {
+        qint64 jitter = qAbs(now_ms - last_tick_ms_ - interval_ms_);
+        jitter_sum_ += jitter;
+        jitter_max_ = qMax(jitter_max_, jitter);
+        jitter_count_++;
+    }
+    last_tick_ms_ = now_ms;
+}
+
+void TelemetrySampler::pollSkipped(int command, int missed)
+{
+    // the scheduler found no free slot, e.g. during a vend sequence
+    if (active_ && command == VMController::POLL_TPAL) {
+        dropped_count_ += missed;
+        aggregate_dropped_ += missed;
+    }
+}
+
+void TelemetrySampler::pollResponse(int command, bool result, QString response)
+{
+    if (active_ == false || command != VMController::POLL_TPAL) {
+        return;
+    }
+
+    QByteArray rx_data = response.toUtf8();
+    TemperatureSample sample;
+    if (result == false || TemperatureSample::fromTpal(rx_data, QDateTime::currentMSecsSinceEpoch(), &sample) == false) {
+        qDebug() << "[SAMPLER] invalid TPAL frame:" << rx_data;
+        if (result) {
+            Metrics::increment(Metrics::FRAME_ERRORS);
+        }
+        dropped_count_++;
+        aggregate_dropped_++;
+        return;
+    }
+    sample_count_++;
+
+    // accumulate for the next upload
+    for (int i = 0; i < TP_CHANNEL_COUNT; i++) {
+        float value = sample.temperature[i];
+        sum_[i] += value;
+        min_[i] = (aggregate_count_ == 0)? value : qMin(min_[i], value);
+        max_[i] = (aggregate_count_ == 0)? value : qMax(max_[i], value);
+    }
+    if (sample.state & SAMPLE_STATE_CP) {
+        cp_on_count_++;
+    }
+    if (sample.state & SAMPLE_STATE_FN) {
+        fn_on_count_++;
+    }
+    if (sample.state & SAMPLE_STATE_DOOR) {
+        door_open_count_++;
+    }
+    last_sample_ = sample;
+    aggregate_count_++;
+
+    emit sampleReady(sample, rx_data);
+}
+
+void TelemetrySampler::resetAggregate()
+{
+    aggregate_count_ = 0;
+    aggregate_dropped_ = 0;
+    cp_on_count_ = 0;
+    fn_on_count_ = 0;
+    door_open_count_ = 0;
+    for (int i = 0; i < TP_CHANNEL_COUNT; i++) {
+        sum_[i] = 0;
+        min_[i] = 0;
+        max_[i] = 0;
+    }
+}
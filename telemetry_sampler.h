@@ -0,0 +1,75 @@
+#ifndef TELEMETRY_SAMPLER_H
+#define TELEMETRY_SAMPLER_H
+
+#include <QObject>
+#include <QElapsedTimer>
+
+#include "sample_store.h"
+#include "telemetry_payload.h"
+
+class VMController;
+
+// Polls TPAL through the VMController slot scheduler at a fixed rate (down
+// to 1 Hz), keeps sampling jitter and dropped-sample counters, and
+// aggregates samples between uploads.
+class TelemetrySampler : public QObject
+{
+    Q_OBJECT
+
+public:
+    TelemetrySampler(VMController *vm_controller, QObject *parent = nullptr);
+    ~TelemetrySampler();
+
+    void setInterval(int msecs);
+    int interval() const;
+
+    void start();
+    void stop();
+    bool isActive() const;
+
+    // upload fields for the samples since the previous call
+    bool takeAggregate(TelemetryPayload *payload);
+
+    qint64 sampleCount() const;
+    qint64 droppedCount() const;
+    double averageJitter() const;   // msecs
+    qint64 maxJitter() const;       // msecs
+
+Q_SIGNALS:
+    void sampleReady(const TemperatureSample &sample, const QByteArray &rx_data);
+
+private slots:
+    void pollIssued(int command);
+    void pollSkipped(int command, int missed);
+    void pollResponse(int command, bool result, QString response);
+
+private:
+    void resetAggregate();
+
+private:
+    VMController *vm_controller_;
+    int interval_ms_ = 1000;
+    bool active_ = false;
+
+    // tick timing
+    QElapsedTimer tick_clock_;
+    qint64 last_tick_ms_ = -1;
+    qint64 sample_count_ = 0;
+    qint64 dropped_count_ = 0;
+    qint64 jitter_count_ = 0;
+    double jitter_sum_ = 0;
+    qint64 jitter_max_ = 0;
+
+    // aggregate since the previous upload
+    int aggregate_count_ = 0;
+    int aggregate_dropped_ = 0;
+    int cp_on_count_ = 0;
+    int fn_on_count_ = 0;
+    int door_open_count_ = 0;
+    double sum_[TP_CHANNEL_COUNT];
+    float min_[TP_CHANNEL_COUNT];
+    float max_[TP_CHANNEL_COUNT];
+    TemperatureSample last_sample_;
+};
+
+#endif // TELEMETRY_SAMPLER_H
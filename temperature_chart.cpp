@@ -0,0 +1,149 @@
+#include "temperature_chart.h"
+
+#include <QPainter>
+#include <QDateTime>
+#include <QElapsedTimer>
+
+static const QColor channel_colors[TP_CHANNEL_COUNT] = {
+    QColor(0x1f, 0x77, 0xb4), QColor(0xff, 0x7f, 0x0e),
+    QColor(0x2c, 0xa0, 0x2c), QColor(0xd6, 0x27, 0x28),
+    QColor(0x94, 0x67, 0xbd), QColor(0x8c, 0x56, 0x4b),
+    QColor(0xe3, 0x77, 0xc2), QColor(0x7f, 0x7f, 0x7f)
+};
+
+TemperatureChart::TemperatureChart(QWidget *parent)
+    : QWidget(parent)
+{
+    polylines_.resize(TP_CHANNEL_COUNT);
+    setMinimumHeight(160);
+}
+
+TemperatureChart::~TemperatureChart()
+{
+
+}
+
+void TemperatureChart::setSampleStore(SampleStore *sample_store)
+{
+    if (sample_store_ != nullptr) {
+        disconnect(sample_store_, SIGNAL(sampleAppended()), this, SLOT(update()));
+    }
+    sample_store_ = sample_store;
+    if (sample_store_ != nullptr) {
+        connect(sample_store_, SIGNAL(sampleAppended()), this, SLOT(update()));
+    }
+    update();
+}
+
+void TemperatureChart::setTimeSpan(qint64 msecs)
+{
+    time_span_ = qMax<qint64>(60 * 1000, msecs);
+    update();
+}
+
+qint64 TemperatureChart::lastFrameTime() const
+{
+    return last_frame_us_;
+}
+
+qint64 TemperatureChart::maxFrameTime() const
+{
+    return max_frame_us_;
+}
+
+double TemperatureChart::averageFrameTime() const
+{
+    return avg_frame_us_;
+}
+
+void TemperatureChart::paintEvent(QPaintEvent *event)
+{
+    Q_UNUSED(event);
+
+    QElapsedTimer frame_timer;
+    frame_timer.start();
+
+    QPainter painter(this);
+    painter.fillRect(rect(), Qt::white);
+
+    // plot area on top, one state strip each for cp, fn and door below
+    const int strip_height = 6;
+    QRectF plot = QRectF(rect()).adjusted(36, 6, -6, -(6 + 3 * (strip_height + 2)));
+    if (sample_store_ == nullptr || plot.width() < 2 || plot.height() < 2) {
+        return;
+    }
+
+    // decimate into at most one min/max bucket per pixel column
+    qint64 to = QDateTime::currentMSecsSinceEpoch();
+    qint64 from = to - time_span_;
+    int count = sample_store_->decimate(from, to, int(plot.width()), &buckets_);
+
+    // vertical range over the visible buckets
+    float y_min = 0;
+    float y_max = 0;
+    for (int i = 0; i < count; i++) {
+        for (int ch = 0; ch < TP_CHANNEL_COUNT; ch++) {
+            if ((i == 0 && ch == 0) || buckets_.at(i).min[ch] < y_min) {
+                y_min = buckets_.at(i).min[ch];
+            }
+            if ((i == 0 && ch == 0) || buckets_.at(i).max[ch] > y_max) {
+                y_max = buckets_.at(i).max[ch];
+            }
+        }
+    }
+    y_min -= 1;
+    y_max += 1;
+
+    // axis and labels
+    painter.setPen(Qt::lightGray);
+    painter.drawRect(plot);
+    painter.setPen(Qt::darkGray);
+    painter.drawText(QRectF(0, plot.top(), 34, 14), Qt::AlignRight, QString::number(y_max, 'f', 1));
+    painter.drawText(QRectF(0, plot.bottom() - 14, 34, 14), Qt::AlignRight, QString::number(y_min, 'f', 1));
+
+    double x_scale = plot.width() / double(time_span_);
+    double y_scale = plot.height() / double(y_max - y_min);
+
+    // min/max envelope of each channel, spikes survive decimation
+    painter.setRenderHint(QPainter::Antialiasing, false);
+    for (int ch = 0; ch < TP_CHANNEL_COUNT; ch++) {
+        QPolygonF &polyline = polylines_[ch];
+        polyline.resize(0);
+        for (int i = 0; i < count; i++) {
+            const SampleBucket &bucket = buckets_.at(i);
+            double x = plot.left() + (bucket.first_timestamp - from) * x_scale;
+            polyline.append(QPointF(x, plot.bottom() - (bucket.max[ch] - y_min) * y_scale));
+            polyline.append(QPointF(x, plot.bottom() - (bucket.min[ch] - y_min) * y_scale));
+        }
+        painter.setPen(channel_colors[ch]);
+        painter.drawPolyline(polyline);
+    }
+
+    // compressor, fan and door state strips
+    const quint8 states[3] = { SAMPLE_STATE_CP, SAMPLE_STATE_FN, SAMPLE_STATE_DOOR };
+    const QColor state_colors[3] = { QColor(0x1f, 0x77, 0xb4), QColor(0x2c, 0xa0, 0x2c), QColor(0xd6, 0x27, 0x28) };
+    for (int s = 0; s < 3; s++) {
+        double y = plot.bottom() + 2 + s * (strip_height + 2);
+        painter.drawText(QRectF(0, y - 4, 34, strip_height + 8), Qt::AlignRight | Qt::AlignVCenter,
+                         (s == 0)? "CP" : (s == 1)? "FN" : "DR");
+        for (int i = 0; i < count; i++) {
+            const SampleBucket &bucket = buckets_.at(i);
+            if (bucket.state_any & states[s]) {
+                double x1 = plot.left() + (bucket.first_timestamp - from) * x_scale;
+                double x2 = plot.left() + (bucket.last_timestamp - from) * x_scale;
+                painter.fillRect(QRectF(x1, y, qMax(1.0, x2 - x1), strip_height), state_colors[s]);
+            }
+        }
+    }
+
+    // show the cost of the previous frame
+    painter.setPen(Qt::darkGray);
+    painter.drawText(plot.adjusted(4, 2, -4, -2), Qt::AlignRight | Qt::AlignTop,
+                     QString("%1 ms / %2 pts").arg(last_frame_us_ / 1000.0, 0, 'f', 2).arg(count));
+
+    // update frame time statistics
+    last_frame_us_ = frame_timer.nsecsElapsed() / 1000;
+    max_frame_us_ = qMax(max_frame_us_, last_frame_us_);
+    avg_frame_us_ = (frame_count_ == 0)? last_frame_us_ : avg_frame_us_ * 0.9 + last_frame_us_ * 0.1;
+    frame_count_++;
+}
@@ -0,0 +1,43 @@
+#ifndef TEMPERATURE_CHART_H
+#define TEMPERATURE_CHART_H
+
+#include <QWidget>
+#include <QVector>
+#include <QPolygonF>
+
+#include "sample_store.h"
+
+class TemperatureChart : public QWidget
+{
+    Q_OBJECT
+
+public:
+    TemperatureChart(QWidget *parent = nullptr);
+    ~TemperatureChart();
+
+    void setSampleStore(SampleStore *sample_store);
+    void setTimeSpan(qint64 msecs);
+
+    // redraw cost of the rendered frames in microseconds
+    qint64 lastFrameTime() const;
+    qint64 maxFrameTime() const;
+    double averageFrameTime() const;
+
+protected:
+    void paintEvent(QPaintEvent *event) override;
+
+private:
+    SampleStore *sample_store_ = nullptr;
+    qint64 time_span_ = 60 * 60 * 1000;
+
+    // reused between frames to avoid per-frame allocations
+    QVector<SampleBucket> buckets_;
+    QVector<QPolygonF> polylines_;
+
+    qint64 frame_count_ = 0;
+    qint64 last_frame_us_ = 0;
+    qint64 max_frame_us_ = 0;
+    double avg_frame_us_ = 0;
+};
+
+#endif // TEMPERATURE_CHART_H
@@ -0,0 +1,253 @@
+#include "thermostat_controller.h"
+
+#include <QFile>
+#include <QTextStream>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QDateTime>
+#include <QDebug>
+
+#include "vm_controller.h"
+
+ThermostatController::ThermostatController(VMController *vm_controller, QObject *parent)
+    : QObject(parent)
+    , vm_controller_(vm_controller)
+{
+    connect(vm_controller_, SIGNAL(setCompressorSwitchResponse(bool)), this, SLOT(compressorSwitchResponse(bool)));
+    connect(vm_controller_, SIGNAL(timeoutWithState(QString,int)), this, SLOT(timeoutWithState(QString,int)));
+}
+
+ThermostatController::~ThermostatController()
+{
+
+}
+
+bool ThermostatController::loadConfig(QString file_path)
+{
+    QFile config_file(file_path);
+    if (config_file.open(QFile::ReadOnly) == false) {
+        qDebug() << "[THERMO] open config file failed:" << file_path;
+        return false;
+    }
+
+    QJsonParseError parse_error;
+    QJsonObject config_obj = QJsonDocument::fromJson(config_file.readAll(), &parse_error).object();
+    if (parse_error.error != QJsonParseError::NoError) {
+        qDebug() << "[THERMO] parse config file failed:" << parse_error.errorString();
+        return false;
+    }
+
+    config_path_ = file_path;
+    setChannel(config_obj.value("channel").toInt(channel_));
+    setSetpoint(config_obj.value("setpoint").toDouble(setpoint_));
+    setHysteresis(config_obj.value("hysteresis").toDouble(hysteresis_));
+    setMinimumTimes(config_obj.value("min_on_sec").toInt(min_on_sec_), config_obj.value("min_off_sec").toInt(min_off_sec_));
+    setEnabled(config_obj.value("enabled").toBool(true));
+    return true;
+}
+
+bool ThermostatController::saveConfig()
+{
+    if (config_path_.isEmpty()) {
+        return false;
+    }
+
+    QJsonObject config_obj;
+    config_obj.insert("enabled", enabled_);
+    config_obj.insert("channel", channel_);
+    config_obj.insert("setpoint", setpoint_);
+    config_obj.insert("hysteresis", hysteresis_);
+    config_obj.insert("min_on_sec", min_on_sec_);
+    config_obj.insert("min_off_sec", min_off_sec_);
+
+    QFile config_file(config_path_);
+    if (config_file.open(QFile::WriteOnly | QFile::Truncate) == false) {
+        qDebug() << "[THERMO] save config file failed:" << config_path_;
+        return false;
+    }
+    config_file.write(QJsonDocument(config_obj).toJson());
+    config_file.close();
+    return true;
+}
+
+void ThermostatController::setEnabled(bool enabled)
+{
+    enabled_ = enabled;
+    pending_ = false;
+    writeLog(QString("%1, channel %2 setpoint %3 hysteresis %4 min on/off %5/%6 s")
+             .arg((enabled)? "enabled" : "disabled")
+             .arg(channel_)
+             .arg(setpoint_, 0, 'f', 1)
+             .arg(hysteresis_, 0, 'f', 1)
+             .arg(min_on_sec_)
+             .arg(min_off_sec_));
+}
+
+bool ThermostatController::isEnabled() const
+{
+    return enabled_;
+}
+
+void ThermostatController::setChannel(int channel)
+{
+    channel_ = channel;
+}
+
+void ThermostatController::setSetpoint(float setpoint)
+{
+    setpoint_ = setpoint;
+}
+
+float ThermostatController::setpoint() const
+{
+    return setpoint_;
+}
+
+void ThermostatController::setHysteresis(float hysteresis)
+{
+    hysteresis_ = qMax(0.0f, hysteresis);
+}
+
+void ThermostatController::setMinimumTimes(int min_on_sec, int min_off_sec)
+{
+    min_on_sec_ = qMax(0, min_on_sec);
+    min_off_sec_ = qMax(0, min_off_sec);
+}
+
+void ThermostatController::setLogDir(QString dir)
+{
+    log_dir_ = dir;
+}
+
+void ThermostatController::evaluate(const TemperatureSample &sample)
+{
+    if (channel_ < 1 || channel_ > TP_CHANNEL_COUNT) {
+        return;
+    }
+
+    // minimum times count from any switch, not only from our own commands
+    bool sample_on = (sample.state & SAMPLE_STATE_CP);
+    if (state_known_ == false || sample_on != compressor_on_) {
+        state_known_ = true;
+        compressor_on_ = sample_on;
+        last_switch_ms_ = sample.timestamp;
+    }
+
+    // the command took effect when a sample shows the new state
+    if (pending_) {
+        if (sample_on == pending_on_) {
+            writeLog(QString("CP %1 confirmed after %2 ms").arg((sample_on)? "ON" : "OFF").arg(decision_clock_.elapsed()));
+            pending_ = false;
+        }
+        else if (decision_clock_.elapsed() > 60 * 1000) {
+            writeLog(QString("CP %1 not confirmed after %2 ms").arg((pending_on_)? "ON" : "OFF").arg(decision_clock_.elapsed()));
+            pending_ = false;
+        }
+        return;
+    }
+
+    if (enabled_ == false) {
+        return;
+    }
+
+    float temperature = sample.temperature[channel_ - 1];
+    bool want_on = compressor_on_;
+    if (temperature > setpoint_ + hysteresis_ / 2) {
+        want_on = true;
+    }
+    else if (temperature < setpoint_ - hysteresis_ / 2) {
+        want_on = false;
+    }
+    if (want_on == compressor_on_) {
+        return;
+    }
+
+    // protect the compressor from short cycling
+    qint64 since_switch_ms = sample.timestamp - last_switch_ms_;
+    qint64 minimum_ms = ((compressor_on_)? min_on_sec_ : min_off_sec_) * 1000LL;
+    if (since_switch_ms < minimum_ms) {
+        return;
+    }
+
+    // never interleave with a vend, try again on the next sample
+    if (vm_controller_->isBusy() || vm_controller_->isVendActive()) {
+        return;
+    }
+
+    writeLog(QString("CP %1 at %2 (setpoint %3 +/- %4), %5 for %6 s")
+             .arg((want_on)? "ON" : "OFF")
+             .arg(temperature, 0, 'f', 1)
+             .arg(setpoint_, 0, 'f', 1)
+             .arg(hysteresis_ / 2, 0, 'f', 1)
+             .arg((compressor_on_)? "on" : "off")
+             .arg(since_switch_ms / 1000));
+
+    pending_ = true;
+    pending_on_ = want_on;
+    acknowledged_ = false;
+    decision_clock_.start();
+
+    // evaluate runs inside the receive path, the switch is sent from the event loop
+    QMetaObject::invokeMethod(this, "sendSwitch", Qt::QueuedConnection);
+}
+
+void ThermostatController::sendSwitch()
+{
+    if (pending_ == false || acknowledged_) {
+        return;
+    }
+
+    // a command took the link meanwhile, decide again on the next sample
+    if (vm_controller_->isBusy() || vm_controller_->isVendActive()) {
+        writeLog("CP switch deferred, link busy");
+        pending_ = false;
+        return;
+    }
+    if (vm_controller_->startCompressorSwitch(pending_on_) == false) {
+        writeLog("CP switch not sent, device not opened");
+        pending_ = false;
+    }
+}
+
+void ThermostatController::compressorSwitchResponse(bool result)
+{
+    if (pending_ == false || acknowledged_) {
+        return;
+    }
+    acknowledged_ = true;
+
+    writeLog(QString("CP %1 %2 in %3 ms").arg((pending_on_)? "ON" : "OFF")
+                                        .arg((result)? "acknowledged" : "rejected")
+                                        .arg(decision_clock_.elapsed()));
+    if (result == false) {
+        pending_ = false;
+    }
+}
+
+void ThermostatController::timeoutWithState(QString err_msg, int state)
+{
+    Q_UNUSED(err_msg);
+
+    if (pending_ && acknowledged_ == false && state == VMController::WAIT_CP_ONOFF) {
+        writeLog(QString("CP %1 timeout after %2 ms").arg((pending_on_)? "ON" : "OFF").arg(decision_clock_.elapsed()));
+        pending_ = false;
+    }
+}
+
+void ThermostatController::writeLog(const QString &message)
+{
+    qDebug() << "[THERMO]" << message;
+
+    if (log_dir_.isEmpty()) {
+        return;
+    }
+
+    QFile log_file(QString("%1/thermostat_%2.txt").arg(log_dir_).arg(QDateTime::currentDateTime().toString("yyyyMMdd")));
+    if (log_file.open(QFile::Append | QFile::Text) == false) {
+        return;
+    }
+    QTextStream out(&log_file);
+    out << QDateTime::currentDateTime().toString("hh:mm:ss.zzz") << " " << message << "\n";
+    out.flush();
+    log_file.close();
+}
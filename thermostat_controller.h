@@ -0,0 +1,72 @@
+#ifndef THERMOSTAT_CONTROLLER_H
+#define THERMOSTAT_CONTROLLER_H
+
+#include <QObject>
+#include <QElapsedTimer>
+
+#include "sample_store.h"
+
+class VMController;
+
+// Local on/off compressor loop. The compressor is switched on above
+// setpoint + hysteresis / 2 and off below setpoint - hysteresis / 2, never
+// before the minimum on/off time has passed since the last switch.
+class ThermostatController : public QObject
+{
+    Q_OBJECT
+
+public:
+    ThermostatController(VMController *vm_controller, QObject *parent = nullptr);
+    ~ThermostatController();
+
+    // JSON file, e.g. {"enabled": true, "channel": 1, "setpoint": 4.0,
+    // "hysteresis": 2.0, "min_on_sec": 180, "min_off_sec": 300}
+    bool loadConfig(QString file_path);
+    bool saveConfig();
+
+    void setEnabled(bool enabled);
+    bool isEnabled() const;
+    void setChannel(int channel);
+    void setSetpoint(float setpoint);
+    float setpoint() const;
+    void setHysteresis(float hysteresis);
+    void setMinimumTimes(int min_on_sec, int min_off_sec);
+
+    // decisions and their latency are appended to <dir>/thermostat_yyyyMMdd.txt
+    void setLogDir(QString dir);
+
+    void evaluate(const TemperatureSample &sample);
+
+private slots:
+    void sendSwitch();
+    void compressorSwitchResponse(bool result);
+    void timeoutWithState(QString err_msg, int state);
+
+private:
+    void writeLog(const QString &message);
+
+private:
+    VMController *vm_controller_;
+    QString config_path_;
+    QString log_dir_;
+
+    bool enabled_ = false;
+    int channel_ = 1;
+    float setpoint_ = 4.0;
+    float hysteresis_ = 2.0;
+    int min_on_sec_ = 3 * 60;
+    int min_off_sec_ = 5 * 60;
+
+    // observed compressor state
+    bool state_known_ = false;
+    bool compressor_on_ = false;
+    qint64 last_switch_ms_ = 0;
+
+    // command sent and not yet seen in a sample
+    bool pending_ = false;
+    bool pending_on_ = false;
+    bool acknowledged_ = false;
+    QElapsedTimer decision_clock_;
+};
+
+#endif // THERMOSTAT_CONTROLLER_H
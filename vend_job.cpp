@@ -0,0 +1,289 @@
+#include "vend_job.h"
+
+#include <QJsonArray>
+#include <QDebug>
+
+#include "vm_controller.h"
+
+VendJob::VendJob(VMController *vm_controller, QObject *parent)
+    : QObject(parent)
+    , vm_controller_(vm_controller)
+{
+    connect(vm_controller_, SIGNAL(executeChannelResponse(bool,int)), this, SLOT(channelResponse(bool,int)));
+    connect(vm_controller_, SIGNAL(timeoutWithState(QString,int)), this, SLOT(timeoutWithState(QString,int)));
+}
+
+VendJob::~VendJob()
+{
+
+}
+
+void VendJob::setPairing(bool enabled)
+{
+    pairing_ = enabled;
+}
+
+bool VendJob::start(const QList<QPair<int, int>> &cart)
+{
+    if (isRunning() || cart.isEmpty()) {
+        return false;
+    }
+
+    items_.clear();
+    for (int i = 0; i < cart.size(); i++) {
+        Item item;
+        item.row = cart.at(i).first;
+        item.col = cart.at(i).second;
+        items_.append(item);
+    }
+    planDrops();
+
+    current_drop_ = -1;
+    dispensed_ = 0;
+    picked_up_ = false;
+    door_closed_ = false;
+    drops_ms_ = 0;
+    elapsed_ms_ = 0;
+    clock_.start();
+
+    qDebug() << "[VEND] start" << items_.size() << "items in" << drops_.size() << "drops";
+    phase_ = DROP_PHASE;
+    nextDrop();
+    return true;
+}
+
+bool VendJob::isRunning() const
+{
+    return phase_ != IDLE_PHASE;
+}
+
+const QList<VendJob::Item> &VendJob::items() const
+{
+    return items_;
+}
+
+QJsonObject VendJob::report() const
+{
+    static const char *const outcomes[] = { "pending", "dispensed", "failed", "skipped" };
+
+    QJsonArray items_array;
+    for (int i = 0; i < items_.size(); i++) {
+        const Item &item = items_.at(i);
+        QJsonObject item_obj;
+        item_obj.insert("row", item.row);
+        item_obj.insert("col", item.col);
+        item_obj.insert("outcome", outcomes[item.outcome]);
+        item_obj.insert("state", VMController::stateName(item.state));
+        item_obj.insert("drop", item.drop);
+        item_obj.insert("finished_ms", double(item.finished_ms));
+        items_array.append(item_obj);
+    }
+
+    QJsonObject report_obj;
+    report_obj.insert("items", items_array);
+    report_obj.insert("drops", drops_.size());
+    report_obj.insert("dispensed", dispensed_);
+    report_obj.insert("picked_up", picked_up_);
+    report_obj.insert("door_closed", door_closed_);
+    report_obj.insert("drops_ms", double(drops_ms_));
+    report_obj.insert("elapsed_ms", double(elapsed_ms_));
+    return report_obj;
+}
+
+void VendJob::planDrops()
+{
+    drops_.clear();
+
+    QList<int> pending;
+    for (int i = 0; i < items_.size(); i++) {
+        pending.append(i);
+    }
+
+    while (pending.isEmpty() == false) {
+        int first = pending.takeFirst();
+        const Item &item = items_.at(first);
+        QList<int> drop;
+        drop.append(first);
+
+        // a lane drops one item at a time and the D command takes single
+        // digit lanes, prefer a partner in the same row
+        int partner = -1;
+        bool pairable = (pairing_ && item.row >= 0 && item.row <= 9 && item.col >= 0 && item.col <= 9);
+        for (int i = 0; pairable && i < pending.size(); i++) {
+            const Item &other = items_.at(pending.at(i));
+            if (other.row < 0 || other.row > 9 || other.col < 0 || other.col > 9) {
+                continue;
+            }
+            if (other.row == item.row && other.col == item.col) {
+                continue;
+            }
+            if (partner < 0 || (other.row == item.row && items_.at(pending.at(partner)).row != item.row)) {
+                partner = i;
+            }
+        }
+        if (partner >= 0) {
+            drop.append(pending.takeAt(partner));
+        }
+
+        for (int i = 0; i < drop.size(); i++) {
+            items_[drop.at(i)].drop = drops_.size();
+        }
+        drops_.append(drop);
+    }
+}
+
+void VendJob::nextDrop()
+{
+    current_drop_++;
+    if (current_drop_ >= drops_.size()) {
+        drops_ms_ = clock_.elapsed();
+        checkCargo();
+        return;
+    }
+
+    const QList<int> &drop = drops_.at(current_drop_);
+    const Item &first = items_.at(drop.first());
+    bool started = false;
+    if (drop.size() > 1) {
+        const Item &second = items_.at(drop.at(1));
+        started = vm_controller_->executeChannel(first.row, first.col, second.row, second.col);
+    }
+    else {
+        started = vm_controller_->executeChannel(first.row, first.col);
+    }
+
+    if (started == false) {
+        qDebug() << "[VEND] drop" << current_drop_ << "not sent, device not opened";
+        finishDrop(FAILED, VMController::ERROR_TIMEOUT);
+        skipRemaining();
+        checkCargo();
+    }
+}
+
+void VendJob::finishDrop(int outcome, int state)
+{
+    const QList<int> &drop = drops_.at(current_drop_);
+    for (int i = 0; i < drop.size(); i++) {
+        Item &item = items_[drop.at(i)];
+        item.outcome = outcome;
+        item.state = state;
+        item.finished_ms = clock_.elapsed();
+        if (outcome == DISPENSED) {
+            dispensed_++;
+        }
+        emit itemFinished(drop.at(i), outcome, state);
+    }
+}
+
+void VendJob::skipRemaining()
+{
+    for (int i = current_drop_ + 1; i < drops_.size(); i++) {
+        const QList<int> &drop = drops_.at(i);
+        for (int j = 0; j < drop.size(); j++) {
+            items_[drop.at(j)].outcome = SKIPPED;
+            emit itemFinished(drop.at(j), SKIPPED, VMController::IDLE);
+        }
+    }
+    current_drop_ = drops_.size();
+    drops_ms_ = clock_.elapsed();
+}
+
+void VendJob::checkCargo()
+{
+    // nothing reached the pickup port, no need to wait for it
+    if (dispensed_ == 0) {
+        finish();
+        return;
+    }
+
+    phase_ = CARGO_PHASE;
+    if (vm_controller_->checkCargoState() == false) {
+        finish();
+    }
+}
+
+void VendJob::finish()
+{
+    elapsed_ms_ = clock_.elapsed();
+    phase_ = IDLE_PHASE;
+
+    bool result = (dispensed_ == items_.size() && picked_up_ && door_closed_);
+    qDebug() << "[VEND] finished" << dispensed_ << "/" << items_.size() << "dispensed in" << elapsed_ms_ << "ms,"
+             << "picked up" << picked_up_ << "door closed" << door_closed_;
+    emit finished(result);
+}
+
+void VendJob::channelResponse(bool result, int state)
+{
+    switch (phase_) {
+
+    case DROP_PHASE:
+        // dropping, wait for done
+        if (result && state == VMController::WAIT_CH_DONE) {
+            break;
+        }
+
+        // done, the next drop starts without waiting for the pickup
+        if (result) {
+            finishDrop(DISPENSED, VMController::IDLE);
+            nextDrop();
+            break;
+        }
+
+        // a door error stops the cart, a lane error only its own drop
+        finishDrop(FAILED, state);
+        if (state == VMController::ERROR_DOOR) {
+            skipRemaining();
+            checkCargo();
+        }
+        else {
+            nextDrop();
+        }
+        break;
+
+    case CARGO_PHASE:
+        picked_up_ = result;
+        if (result) {
+            phase_ = DOOR_PHASE;
+            if (vm_controller_->checkDoorState() == false) {
+                finish();
+            }
+        }
+        else {
+            finish();
+        }
+        break;
+
+    case DOOR_PHASE:
+        door_closed_ = result;
+        finish();
+        break;
+
+    default:
+        break;
+    }
+}
+
+void VendJob::timeoutWithState(QString err_msg, int state)
+{
+    Q_UNUSED(err_msg);
+
+    switch (phase_) {
+
+    case DROP_PHASE:
+        // the board state is unknown, do not start more drops
+        qDebug() << "[VEND] drop" << current_drop_ << "timeout in" << VMController::stateName(state);
+        finishDrop(FAILED, VMController::ERROR_TIMEOUT);
+        skipRemaining();
+        checkCargo();
+        break;
+
+    case CARGO_PHASE:
+    case DOOR_PHASE:
+        finish();
+        break;
+
+    default:
+        break;
+    }
+}
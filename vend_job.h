@@ -0,0 +1,89 @@
+#ifndef VEND_JOB_H
+#define VEND_JOB_H
+
+#include <QObject>
+#include <QList>
+#include <QPair>
+#include <QElapsedTimer>
+#include <QJsonObject>
+
+class VMController;
+
+// Dispenses a whole cart. Items on different lanes are paired into combined
+// D drops, the drops run back to back as soon as the previous one is done,
+// and the cargo and door checks run once after the last drop instead of
+// after every item.
+class VendJob : public QObject
+{
+    Q_OBJECT
+
+public:
+    enum Outcome {
+        PENDING,
+        DISPENSED,
+        FAILED,
+        SKIPPED
+    };
+
+    struct Item {
+        int row = 0;
+        int col = 0;
+        int outcome = PENDING;
+        int state = 0;              // VMController::State that ended the drop
+        int drop = -1;
+        qint64 finished_ms = 0;
+    };
+
+    VendJob(VMController *vm_controller, QObject *parent = nullptr);
+    ~VendJob();
+
+    // combined drops need a board with the D command, on by default
+    void setPairing(bool enabled);
+
+    // lanes as (row, column)
+    bool start(const QList<QPair<int, int>> &cart);
+    bool isRunning() const;
+    const QList<Item> &items() const;
+    QJsonObject report() const;
+
+Q_SIGNALS:
+    void itemFinished(int index, int outcome, int state);
+    void finished(bool result);
+
+private slots:
+    void channelResponse(bool result, int state);
+    void timeoutWithState(QString err_msg, int state);
+
+private:
+    void planDrops();
+    void nextDrop();
+    void finishDrop(int outcome, int state);
+    void skipRemaining();
+    void checkCargo();
+    void finish();
+
+private:
+    enum Phase {
+        IDLE_PHASE,
+        DROP_PHASE,
+        CARGO_PHASE,
+        DOOR_PHASE
+    };
+
+    VMController *vm_controller_;
+    bool pairing_ = true;
+
+    Phase phase_ = IDLE_PHASE;
+    QList<Item> items_;
+    QList<QList<int>> drops_;       // item indexes of each drop
+    int current_drop_ = -1;
+    int dispensed_ = 0;
+    bool picked_up_ = false;
+    bool door_closed_ = false;
+
+    QElapsedTimer clock_;
+    qint64 drops_ms_ = 0;
+    qint64 elapsed_ms_ = 0;
+};
+
+#endif // VEND_JOB_H
@@ -3,6 +3,14 @@
 #include <QDebug>
 #include <QDateTime>
 
+#include <cstring>
+
+#include "lane_profiler.h"
+#include "latency_trace.h"
+#include "metrics.h"
+#include "serial_trace.h"
+#include "vmc_protocol.h"
+
 VMController::VMController(QObject *parent)
     : QSerialPort(parent)
 {
@@ -14,475 +22,785 @@ VMController::VMController(QObject *parent)
 
     // initialize single shot timer
     tmr_wait_receive_ = new QTimer(this);
-    tmr_wait_receive_->setInterval(3000);
     tmr_wait_receive_->setSingleShot(true);
 
     // initialize signals and slots
     connect(tmr_wait_receive_, SIGNAL(timeout()), this, SLOT(receiveTimeout()));
     connect(this, SIGNAL(readyRead()), this, SLOT(rxDataReady()));
 
+    // initialize background poll scheduler
+    tmr_slot_ = new QTimer(this);
+    tmr_slot_->setTimerType(Qt::PreciseTimer);
+    tmr_slot_->setInterval(SLOT_LENGTH_MS);
+    connect(tmr_slot_, SIGNAL(timeout()), this, SLOT(schedulerTick()));
+    link_clock_.start();
+
     // initialize control state
     state_ = IDLE;
+    echo_len_ = 0;
+    rx_expected_len_ = 0;
+    receive_timeout_ms_ = 3000;
+    read_fw_info_retry_ = 0;
+    exe_channel_retry_ = 0;
 }
 
 VMController::~VMController()
 {
-
+    stopRecording();
 }
 
 void VMController::setReceiveTimeout(int timeout)
 {
-    tmr_wait_receive_->setInterval(timeout * 1000);
+    receive_timeout_ms_ = timeout * 1000;
 }
 
-bool VMController::getFirmwareInfos()
+void VMController::setAdaptiveTimeouts(bool enabled)
 {
-    read_fw_info_retry_ = 0;
-    qDebug() << "[VMC] get firmware information start...";
+    adaptive_timeouts_ = enabled;
+}
 
-    // check serial port is opened
-    if (isOpened() == false) {
-        qDebug() << "[VMC] device open failed";
-        return false;
+int VMController::adaptiveTimeout(int state, int fixed_ms) const
+{
+    const VmcProtocol::ResponseRule *rule = VmcProtocol::rule(state);
+    if (adaptive_timeouts_ == false || rule == nullptr || rule->rto_min_ms <= 0) {
+        return fixed_ms;
     }
 
-    // create tx data
-    QByteArray tx_data;
-    tx_data.append(CMD_INFO);
-    tx_data.append('\n');
+    // keep the fixed timeout until a few responses were measured
+    const RttEstimator &rtt = rtt_[state];
+    if (rtt.samples < RTO_MIN_SAMPLES) {
+        return fixed_ms;
+    }
 
-    // change control state
-    state_ = WAIT_FW_INFO;
+    qint64 rto_ms = (rtt.srtt_us + 4 * rtt.rttvar_us) / 1000;
+    rto_ms <<= rtt.backoff;
+    return int(qBound(qint64(rule->rto_min_ms), rto_ms, qint64(fixed_ms)));
+}
 
-    // set expected length of rx data
-    rx_expected_len_ = RX_LEN_INFO;
+int VMController::fixedTimeout(int state) const
+{
+    // the timeout of the command that enters the state
+    for (int i = 0; i < VmcProtocol::COMMAND_COUNT; i++) {
+        const VmcProtocol::CommandDescriptor &descriptor = VmcProtocol::commands[i];
+        if (descriptor.state == state) {
+            return (descriptor.timeout_ms > 0)? descriptor.timeout_ms : receive_timeout_ms_;
+        }
+    }
+    return receive_timeout_ms_;
+}
 
-    // write data
-    this->clear();
-    this->write(tx_data);
-    this->flush();
-    //this->waitForBytesWritten(3000);
+VMController::State VMController::state() const
+{
+    return state_;
+}
 
-    // start receive timeout timer
-    tmr_wait_receive_->start();
-    return true;
+const char *VMController::stateName(int state)
+{
+    static const char *const names[] = {
+        "IDLE", "ERROR_TIMEOUT", "ERROR_DROP", "ERROR_CARGO", "ERROR_DOOR", "WARNING_NOT_PICKUP",
+        "WAIT_FW_INFO", "WAIT_TP_INFO", "WAIT_CP_ONOFF", "WAIT_DR_ONOFF", "WAIT_CH_OK", "WAIT_CH_OP",
+        "WAIT_CH_DONE", "WAIT_CH_RETRY", "WAIT_CARS", "WAIT_CDOS"
+    };
+    if (state < 0 || state >= int(sizeof(names) / sizeof(names[0]))) {
+        return "UNKNOWN";
+    }
+    return names[state];
 }
 
-bool VMController::getTemperatureStatus()
+bool VMController::isBusy() const
 {
-    qDebug() << "[VMC] get temperature status start...";
+    return isWaiting();
+}
 
-    // check serial port is opened
-    if (isOpened() == false) {
-        qDebug() << "[VMC] device open failed";
-        return false;
-    }
+qint64 VMController::lastTpalTransmitTime() const
+{
+    return last_tpal_tx_us_;
+}
 
-    // create tx data
-    QByteArray tx_data;
-    tx_data.append(CMD_TPAL);
-    tx_data.append('\n');
+qint64 VMController::lastFrameTime() const
+{
+    return last_frame_us_;
+}
 
-    qDebug() << "[VMC] TX data:" << tx_data;
+void VMController::setSlotLength(int msecs)
+{
+    tmr_slot_->setInterval(qMax(10, msecs));
+}
 
-    // change control state
-    state_ = WAIT_TP_INFO;
+void VMController::setPollPeriod(PollCommand command, int msecs)
+{
+    PollSlot &slot = poll_slots_[command];
+    slot.period_ms = qMax(0, msecs);
 
-    // write data
-    this->clear();
-    this->write(tx_data);
-    this->flush();
-    //this->waitForBytesWritten(3000);
+    // stagger the first run so polls with the same period use different slots
+    slot.next_due_ms = link_clock_.elapsed() + command * tmr_slot_->interval();
 
-    // start reading timeout timer
-    rx_expected_len_ = RX_LEN_TPAL;
-    tmr_wait_receive_->start();
-    return true;
+    // the slot timer only runs while some poll is enabled
+    bool enabled = false;
+    for (int i = 0; i < POLL_COUNT; i++) {
+        enabled |= (poll_slots_[i].period_ms > 0);
+    }
+    if (enabled && tmr_slot_->isActive() == false) {
+        tmr_slot_->start();
+    }
+    else if (enabled == false) {
+        tmr_slot_->stop();
+    }
 }
 
-bool VMController::setCompressorSwitch(bool on_off)
+int VMController::pollPeriod(PollCommand command) const
 {
-    qDebug() << "[VMC] set compressor switch start...";
+    return poll_slots_[command].period_ms;
+}
 
-    // check serial port is opened
-    if (isOpened() == false) {
-        qDebug() << "[VMC] device open failed";
-        return false;
-    }
+bool VMController::isVendActive() const
+{
+    return vend_active_;
+}
 
-    // create tx data
-    QByteArray tx_data;
-    QByteArray rx_data;
-    tx_data.append((on_off)? CMD_CPON : CMD_CPOFF);
-    tx_data.append('\n');
+double VMController::linkUtilization() const
+{
+    qint64 now_us = link_clock_.nsecsElapsed() / 1000;
+    qint64 busy_us = foreground_busy_us_ + background_busy_us_;
+    if (busy_since_us_ >= 0) {
+        busy_us += now_us - qMax(busy_since_us_, stats_since_us_);
+    }
+    qint64 wall_us = now_us - stats_since_us_;
+    return (wall_us > 0)? double(busy_us) / wall_us : 0.0;
+}
 
-    // change control state
-    state_ = WAIT_CP_ONOFF;
+QJsonObject VMController::linkStatistics() const
+{
+    static const char *const names[POLL_COUNT] = { CMD_INFO, CMD_TPAL, CMD_CARS, CMD_CDOS };
+    qint64 wall_us = link_clock_.nsecsElapsed() / 1000 - stats_since_us_;
+
+    QJsonObject polls_obj;
+    for (int i = 0; i < POLL_COUNT; i++) {
+        const PollSlot &slot = poll_slots_[i];
+        if (slot.period_ms <= 0 && slot.issued == 0 && slot.skipped == 0) {
+            continue;
+        }
+        QJsonObject poll_obj;
+        poll_obj.insert("period_ms", slot.period_ms);
+        poll_obj.insert("issued", double(slot.issued));
+        poll_obj.insert("completed", double(slot.completed));
+        poll_obj.insert("skipped", double(slot.skipped));
+        poll_obj.insert("timeouts", double(slot.timeouts));
+        poll_obj.insert("deferred", double(slot.deferred));
+        polls_obj.insert(names[i], poll_obj);
+    }
 
-    // set expected length of rx data
-    rx_expected_len_ = RX_LEN_CP_ONOFF;
+    QJsonObject rtt_obj;
+    for (int state = WAIT_FW_INFO; state <= WAIT_CDOS; state++) {
+        const RttEstimator &rtt = rtt_[state];
+        if (rtt.samples == 0 && rtt.timeouts == 0) {
+            continue;
+        }
+        QJsonObject state_obj;
+        state_obj.insert("srtt_ms", rtt.srtt_us / 1000.0);
+        state_obj.insert("rttvar_ms", rtt.rttvar_us / 1000.0);
+        state_obj.insert("samples", double(rtt.samples));
+        state_obj.insert("timeouts", double(rtt.timeouts));
+        state_obj.insert("backoff", rtt.backoff);
+        if (VmcProtocol::rule(state)->rto_min_ms > 0 && rtt.samples >= RTO_MIN_SAMPLES) {
+            state_obj.insert("rto_ms", adaptiveTimeout(state, fixedTimeout(state)));
+        }
+        rtt_obj.insert(stateName(state), state_obj);
+    }
 
-    // write data and wait for ready read
-    if (writeAndWaitForReadyRead(tx_data, rx_expected_len_, &rx_data)) {
+    QJsonObject stats_obj;
+    stats_obj.insert("elapsed_sec", wall_us / 1000000.0);
+    stats_obj.insert("utilization", linkUtilization());
+    stats_obj.insert("background_utilization", (wall_us > 0)? double(background_busy_us_) / wall_us : 0.0);
+    stats_obj.insert("vends", double(vend_count_));
+    stats_obj.insert("vend_defer_avg_ms", (vend_count_ > 0)? vend_defer_total_us_ / 1000.0 / vend_count_ : 0.0);
+    stats_obj.insert("vend_defer_max_ms", vend_defer_max_us_ / 1000.0);
+    stats_obj.insert("polls", polls_obj);
+    stats_obj.insert("response_times", rtt_obj);
+    return stats_obj;
+}
 
-        // emit response
-        emit setCompressorSwitchResponse((QString::fromUtf8(rx_data).indexOf("OK") > 0));
-        state_ = IDLE;
+void VMController::resetLinkStatistics()
+{
+    stats_since_us_ = link_clock_.nsecsElapsed() / 1000;
+    if (busy_since_us_ >= 0) {
+        busy_since_us_ = stats_since_us_;
     }
-    else {
-        // start receive timeout timer
-        tmr_wait_receive_->start();
+    foreground_busy_us_ = 0;
+    background_busy_us_ = 0;
+    vend_count_ = 0;
+    vend_defer_total_us_ = 0;
+    vend_defer_max_us_ = 0;
+    for (int i = 0; i < POLL_COUNT; i++) {
+        PollSlot &slot = poll_slots_[i];
+        slot.issued = 0;
+        slot.completed = 0;
+        slot.skipped = 0;
+        slot.timeouts = 0;
+        slot.deferred = 0;
     }
-    return true;
 }
 
-bool VMController::setDoorSwitch(int numbering, bool on_off)
+bool VMController::startRecording(QString file_path)
 {
-    qDebug() << "[VMC] set door" << numbering << "switch start...";
+    stopRecording();
 
-    // check serial port is opened
-    if (isOpened() == false) {
-        qDebug() << "[VMC] device open failed";
+    trace_ = new SerialTrace();
+    if (trace_->open(file_path) == false) {
+        qDebug() << "[VMC] open trace file failed:" << file_path;
+        delete trace_;
+        trace_ = nullptr;
         return false;
     }
+    qDebug() << "[VMC] recording serial session to" << file_path;
+    return true;
+}
 
-    // create tx data
-    QByteArray tx_data;
-    tx_data.append('C');
-    tx_data.append(QString::number(numbering).toUtf8());
-    tx_data.append((on_off)? "ON" : "OF");
-    tx_data.append('\n');
-
-    qDebug() << "[VMC] TX data:" << tx_data;
-
-    // change control state
-    state_ = WAIT_DR_ONOFF;
-
-    // write data
-    this->clear();
-    this->write(tx_data);
-    this->flush();
-    //this->waitForBytesWritten(3000);
+void VMController::stopRecording()
+{
+    if (trace_ != nullptr) {
+        trace_->close();
+        delete trace_;
+        trace_ = nullptr;
+    }
+}
 
-    // start reading timeout timer
-    rx_expected_len_ = RX_LEN_DR_ONOFF;
-    tmr_wait_receive_->start();
-    return true;
+void VMController::setLaneProfiler(LaneProfiler *profiler)
+{
+    lane_profiler_ = profiler;
 }
 
-bool VMController::executeChannel(int ch1_row, int ch1_col, int ch2_row, int ch2_col)
+void VMController::setReplayMode(bool enabled)
 {
-    exe_channel_retry_ = 0;
-    qDebug() << "[VMC] execute channel" << ch1_row << ch1_col << ch2_row << ch2_col << "start...";
+    replay_mode_ = enabled;
+}
 
-    // check serial port is opened
-    if (isOpened() == false) {
-        qDebug() << "[VMC] device open failed";
-        return false;
+void VMController::replayTransmit(const QByteArray &tx_data)
+{
+    int command = VmcProtocol::classify(tx_data);
+    rx_buffer_.clear();
+    vend_parked_ = false;
+    if (command < 0) {
+        state_ = IDLE;
+        return;
     }
 
-    // create tx data
-    QByteArray tx_data;
-    if (ch2_row < 0 || ch2_col < 0) {
-        is_single_ = true;
-        tx_data.append("CH");
-        tx_data.append(QString::number(ch1_row).toUtf8());
-        tx_data.append(QString::number(ch1_col).toUtf8());
-        tx_data.append('\n');
-        rx_expected_len_ = RX_LEN_CH_SINGLE;
+    // restore the state the command method would have set
+    if (command == VmcProtocol::INFO && state_ != WAIT_FW_INFO) {
+        read_fw_info_retry_ = 0;
     }
-    else {
-        is_single_ = false;
-        tx_data.append("D");
-        tx_data.append(QString::number(ch1_row).toUtf8());
-        tx_data.append(QString::number(ch1_col).toUtf8());
-        tx_data.append(QString::number(ch2_row).toUtf8());
-        tx_data.append(QString::number(ch2_col).toUtf8());
-        tx_data.append('\n');
-        rx_expected_len_ = RX_LEN_CH_COMBINE;
+    else if (command == VmcProtocol::CHANNEL || command == VmcProtocol::CHANNEL_PAIR) {
+        exe_channel_retry_ = 0;
+    }
+    else if (command == VmcProtocol::CHANNEL_RETRY) {
+        exe_channel_retry_++;
     }
 
-    qDebug() << "[VMC] TX data:" << tx_data;
-
-    // change control state
-    state_ = WAIT_CH_OK;
-
-    // write data
-    this->clear();
-    this->write(tx_data);
-    this->flush();
-    //this->waitForBytesWritten(3000);
+    const VmcProtocol::CommandDescriptor &descriptor = VmcProtocol::commands[command];
+    state_ = State(descriptor.state);
+    rx_expected_len_ = descriptor.rx_len;
+    echo_len_ = tx_data.trimmed().length();
+}
 
-    // start reading timeout timer
-    tmr_wait_receive_->start(120 * 1000);
-    return true;
+void VMController::replayReceive(const QByteArray &rx_data)
+{
+    receiveChunk(rx_data);
 }
 
-bool VMController::executeChannelRetry()
+void VMController::replayTimeout()
 {
-    exe_channel_retry_++;
-    qDebug() << "[VMC] execute channel retry..." << exe_channel_retry_;
+    receiveTimeout();
+}
 
+bool VMController::sendRawData(QByteArray tx_data)
+{
     // check serial port is opened
     if (isOpened() == false) {
         qDebug() << "[VMC] device open failed";
         return false;
     }
 
-    // create tx data
-    QByteArray tx_data;
-    tx_data.append(CMD_CHRT);
-    tx_data.append('\n');
-
-    qDebug() << "[VMC] TX data:" << tx_data;
+    // sent once the poll in flight is answered
+    if (isPolling()) {
+        deferRequest(-1, tx_data);
+        return true;
+    }
 
-    // change control state
-    state_ = WAIT_CH_RETRY;
+    // raw commands are not tracked, the response is passed through, keep
+    // background polls away until it had time to arrive
+    tmr_wait_receive_->stop();
+    state_ = IDLE;
+    vend_parked_ = false;
+    hold_until_ms_ = qMax(hold_until_ms_, link_clock_.elapsed() + receive_timeout_ms_);
+    transmit(tx_data);
+    return true;
+}
 
-    // write data
-    this->clear();
-    this->write(tx_data);
-    this->flush();
-    //this->waitForBytesWritten(3000);
+bool VMController::getFirmwareInfos()
+{
+    read_fw_info_retry_ = 0;
+    qDebug() << "[VMC] get firmware information start...";
+    return startCommand(VmcProtocol::encode<VmcProtocol::INFO>());
+}
 
-    // start reading timeout timer
-    rx_expected_len_ = RX_LEN_CH_RETRY;
-    tmr_wait_receive_->start(120 * 1000);
-    return true;
+bool VMController::getTemperatureStatus()
+{
+    qDebug() << "[VMC] get temperature status start...";
+    return startCommand(VmcProtocol::encode<VmcProtocol::TPAL>());
 }
 
-bool VMController::checkCargoState()
+bool VMController::setCompressorSwitch(bool on_off)
 {
-    qDebug() << "[VMC] check cargo state...";
+    qDebug() << "[VMC] set compressor switch start...";
 
-    // check serial port is opened
-    if (isOpened() == false) {
-        qDebug() << "[VMC] device open failed";
+    VmcFrame frame = (on_off)? VmcProtocol::encode<VmcProtocol::CP_ON>() : VmcProtocol::encode<VmcProtocol::CP_OFF>();
+
+    // a poll in flight owns the port, the command follows it and the result
+    // comes with setCompressorSwitchResponse like for startCompressorSwitch
+    if (isPolling()) {
+        return startCommand(frame);
+    }
+    if (prepareCommand(frame) == false) {
         return false;
     }
 
-    // create tx data
-    QByteArray tx_data;
-    tx_data.append(CMD_CARS);
-    tx_data.append('\n');
+    // write data and wait for ready read
+    QByteArray rx_data;
+    rtt_state_ = state_;
+    rtt_start_us_ = link_clock_.nsecsElapsed() / 1000;
+    if (writeAndWaitForReadyRead(frame.bytes(), rx_expected_len_, &rx_data)) {
+        sampleResponseTime();
+        processResponse(rx_data);
+        exchangeFinished();
+    }
+    else {
+        // start receive timeout timer, the blocking wait is not a valid sample
+        startReceiveTimer(adaptiveTimeout(state_, receive_timeout_ms_));
+    }
+    return true;
+}
 
-    qDebug() << "[VMC] TX data:" << tx_data;
+bool VMController::startCompressorSwitch(bool on_off)
+{
+    qDebug() << "[VMC] start compressor switch...";
 
-    // change control state
-    state_ = WAIT_CARS;
+    // returns at once, the result comes with setCompressorSwitchResponse
+    if (on_off) {
+        return startCommand(VmcProtocol::encode<VmcProtocol::CP_ON>());
+    }
+    return startCommand(VmcProtocol::encode<VmcProtocol::CP_OFF>());
+}
 
-    // write data
-    this->clear();
-    this->write(tx_data);
-    this->flush();
-    //this->waitForBytesWritten(3000);
+bool VMController::setDoorSwitch(int numbering, bool on_off)
+{
+    qDebug() << "[VMC] set door" << numbering << "switch start...";
 
-    // start reading timeout timer
-    rx_expected_len_ = RX_LEN_CARS;
-    tmr_wait_receive_->start(30 * 1000);
-    return true;
+    if (on_off) {
+        return startCommand(VmcProtocol::encode<VmcProtocol::DOOR_ON>(numbering));
+    }
+    return startCommand(VmcProtocol::encode<VmcProtocol::DOOR_OFF>(numbering));
 }
 
-bool VMController::checkDoorState()
+bool VMController::executeChannel(int ch1_row, int ch1_col, int ch2_row, int ch2_col)
 {
-    qDebug() << "[VMC] check door state...";
+    exe_channel_retry_ = 0;
+    qDebug() << "[VMC] execute channel" << ch1_row << ch1_col << ch2_row << ch2_col << "start...";
 
-    // check serial port is opened
-    if (isOpened() == false) {
-        qDebug() << "[VMC] device open failed";
-        return false;
-    }
+    // a drop right after DONE joins the batch waiting for CARS/CDOS
+    bool continuing = (state_ == WAIT_CARS || vend_parked_);
 
-    // create tx data
-    QByteArray tx_data;
-    tx_data.append(CMD_CDOS);
-    tx_data.append('\n');
+    bool started = false;
+    if (ch2_row < 0 || ch2_col < 0) {
+        started = startCommand(VmcProtocol::encode<VmcProtocol::CHANNEL>(ch1_row, ch1_col));
+    }
+    else {
+        started = startCommand(VmcProtocol::encode<VmcProtocol::CHANNEL_PAIR>(ch1_row, ch1_col, ch2_row, ch2_col));
+    }
 
-    qDebug() << "[VMC] TX data:" << tx_data;
+    if (started && lane_profiler_ != nullptr) {
+        lane_profiler_->beginChannel(ch1_row, ch1_col, ch2_row, ch2_col, continuing);
+    }
+    return started;
+}
 
-    // change control state
-    state_ = WAIT_CDOS;
+bool VMController::executeChannelRetry()
+{
+    exe_channel_retry_++;
+    qDebug() << "[VMC] execute channel retry..." << exe_channel_retry_;
+    return startCommand(VmcProtocol::encode<VmcProtocol::CHANNEL_RETRY>());
+}
 
-    // write data
-    this->clear();
-    this->write(tx_data);
-    this->flush();
+bool VMController::checkCargoState()
+{
+    qDebug() << "[VMC] check cargo state...";
+    return startCommand(VmcProtocol::encode<VmcProtocol::CARGO_STATE>());
+}
 
-    // start reading timeout timer
-    rx_expected_len_ = RX_LEN_CDOS;
-    tmr_wait_receive_->start(30 * 1000);
-    return true;
+bool VMController::checkDoorState()
+{
+    qDebug() << "[VMC] check door state...";
+    return startCommand(VmcProtocol::encode<VmcProtocol::DOOR_STATE>());
 }
 
 void VMController::receiveTimeout()
 {
+    if (trace_ != nullptr) {
+        trace_->record(SerialTrace::TIMEOUT, QByteArray());
+    }
+    Metrics::incrementTimeout(state_);
+
+    // back off like TCP until a response is measured again
+    if (rtt_state_ >= 0) {
+        RttEstimator &rtt = rtt_[rtt_state_];
+        rtt.timeouts++;
+        rtt.backoff = qMin(rtt.backoff + 1, RTO_MAX_BACKOFF);
+        rtt_state_ = -1;
+    }
+
+    // background polls are not retried, the next slot asks again
+    if (poll_in_flight_ >= 0) {
+        PollCommand command = PollCommand(poll_in_flight_);
+        qDebug() << "[VMC] background poll timeout:" << rx_buffer_;
+        rx_buffer_.clear();
+        if (replay_mode_ == false) {
+            this->clear();
+        }
+
+        poll_slots_[command].timeouts++;
+        state_ = (vend_parked_)? WAIT_CARS : IDLE;
+        exchangeFinished();
+        emit pollResponse(command, false, QString());
+        return;
+    }
+
     if (state_ == WAIT_FW_INFO && read_fw_info_retry_ < 10) {
         read_fw_info_retry_++;
         qDebug() << "[VMC] get firmware information timeout" << read_fw_info_retry_;
 
-        QByteArray tx_data;
-        tx_data.append(CMD_INFO);
-        tx_data.append('\n');
+        static const VmcFrame frame = VmcProtocol::encode<VmcProtocol::INFO>();
+        transmit(frame.bytes(), false);
 
-        this->write(tx_data);
-        this->flush();
-        tmr_wait_receive_->start();
+        // a response to a retransmit is ambiguous, it is not measured
+        startReceiveTimer(adaptiveTimeout(state_, receive_timeout_ms_));
     }
     else {
         QString err_message = "[VMC] Timeout: ";
-        err_message.append(this->readAll());
+        err_message.append(rx_buffer_);
+        rx_buffer_.clear();
+        if (replay_mode_ == false) {
+            err_message.append(this->readAll());
+        }
 
-        emit timeoutWithState(err_message, state_);
+        // settle the link before the signal, a handler may send the next command
+        State timeout_state = state_;
+        if (lane_profiler_ != nullptr) {
+            lane_profiler_->phaseFinished(state_, link_clock_.nsecsElapsed() / 1000 - phase_start_us_, false, ERROR_TIMEOUT);
+        }
         state_ = ERROR_TIMEOUT;
-        this->clear();
+        if (replay_mode_ == false) {
+            this->clear();
+        }
+        exchangeFinished();
+        emit timeoutWithState(err_message, timeout_state);
     }
 }
 
 void VMController::rxDataReady()
 {
+    // VMController is the only reader of the port, so every chunk is seen here
+    QByteArray rx_chunk = this->readAll();
+    if (rx_chunk.isEmpty() == false) {
+        receiveChunk(rx_chunk);
+    }
+}
+
+void VMController::receiveChunk(const QByteArray &rx_chunk)
+{
+    if (trace_ != nullptr) {
+        trace_->record(SerialTrace::RX, rx_chunk);
+    }
+
+    // pass through data that no command is waiting for
+    if (holdsLink() == false) {
+        last_frame_us_ = LatencyTrace::now();
+        emit rawDataReceived(rx_chunk);
+        return;
+    }
+
     // wait until the expected length is ready
-    if (this->bytesAvailable() < rx_expected_len_) {
+    rx_buffer_.append(rx_chunk);
+    if (rx_buffer_.length() < rx_expected_len_) {
         return;
     }
 
     // stop reading timeout timer
     tmr_wait_receive_->stop();
+    last_frame_us_ = LatencyTrace::now();
+    sampleResponseTime();
 
-    // read all data
-    QByteArray rx_data = this->readAll();
-    QString sz_response = QString::fromUtf8(rx_data);
+    // clear tx and rx data before the response handlers may send again
+    QByteArray rx_data = rx_buffer_;
+    rx_buffer_.clear();
+    if (replay_mode_ == false) {
+        this->clear();
+    }
+
+    if (poll_in_flight_ >= 0) {
+        processPollResponse(rx_data);
+        return;
+    }
+    processResponse(rx_data);
+    exchangeFinished();
+}
+
+void VMController::processResponse(const QByteArray &rx_data)
+{
     qDebug() << "[VMC] RX data:" << rx_data;
 
-    // parse data according current state
-    switch (state_) {
+    const VmcProtocol::ResponseRule *rule = VmcProtocol::rule(state_);
+    if (rule == nullptr) {
+        return;
+    }
 
-    case WAIT_FW_INFO:
-        emit getFirmwareInfosResponse(sz_response);
-        state_ = IDLE;
-        break;
+    // an acknowledgment only, the result follows
+    if (VmcProtocol::isProgress(*rule, rx_data)) {
+        startReceiveTimer(rule->progress_timeout_ms);
+        return;
+    }
 
-    case WAIT_TP_INFO:
-        emit getTemperatureStatusResponse(sz_response);
-        state_ = IDLE;
+    // change state before the signal, so a handler may send the next command
+    bool result = VmcProtocol::isSuccess(*rule, rx_data);
+    if (result) {
+        state_ = State(rule->success_state);
+        if (rule->success_rx_len > 0) {
+            rx_expected_len_ = rule->success_rx_len;
+        }
+        if (rule->success_timeout_ms > 0) {
+            startReceiveTimer(rule->success_timeout_ms, true);
+        }
+    }
+    else {
+        int error_state = VmcProtocol::errorState(*rule, rx_data, echo_len_);
+        if (error_state >= 0) {
+            state_ = State(error_state);
+        }
+    }
+
+    // the next phase starts with this response
+    if (lane_profiler_ != nullptr && rule->notify == VmcProtocol::NOTIFY_CHANNEL) {
+        qint64 now_us = link_clock_.nsecsElapsed() / 1000;
+        lane_profiler_->phaseFinished(rule->state, now_us - phase_start_us_, result, state_);
+        phase_start_us_ = now_us;
+    }
+
+    switch (rule->notify) {
+
+    case VmcProtocol::NOTIFY_FW_INFO:
+        emit getFirmwareInfosResponse(QString::fromUtf8(rx_data));
         break;
 
-    case WAIT_CP_ONOFF:
-        emit setCompressorSwitchResponse((sz_response.indexOf("OK") > 0));
-        state_ = IDLE;
+    case VmcProtocol::NOTIFY_TEMPERATURE:
+        emit getTemperatureStatusResponse(QString::fromUtf8(rx_data));
         break;
 
-    case WAIT_DR_ONOFF:
-        emit setDoorSwitchResponse((sz_response.indexOf("OK") > 0));
-        state_ = IDLE;
+    case VmcProtocol::NOTIFY_COMPRESSOR:
+        emit setCompressorSwitchResponse(result);
         break;
 
-    case WAIT_CH_OK:
-        if (sz_response.indexOf("OK") < 0) {
-            state_ = ERROR_TIMEOUT;
-            emit executeChannelResponse(false, state_);
-        }
-        else {
-            state_ = WAIT_CH_OP;
-            rx_expected_len_ = 6;
-            tmr_wait_receive_->start(120 * 1000);
-        }
+    case VmcProtocol::NOTIFY_DOOR:
+        emit setDoorSwitchResponse(result);
         break;
 
-    case WAIT_CH_OP:
-        if (sz_response.indexOf("OP") < 0) {
-            if (sz_response.indexOf("DOOREE") >= 0) {
-                state_ = ERROR_DOOR;
-            }
-            else {
-                QString error_code = (is_single_)? QString(rx_data.mid(4)) : QString(rx_data.mid(5));
-                if (error_code == "EE02") {
-                    state_ = ERROR_DROP;
-                }
-                else if (error_code == "EE03") {
-                    state_ = ERROR_CARGO;
-                }
-            }
-            emit executeChannelResponse(false, state_);
-        }
-        else {
-            state_ = WAIT_CH_DONE;
-            rx_expected_len_ = 8;
-            emit executeChannelResponse(true, state_);
-            tmr_wait_receive_->start(120 * 1000);
+    case VmcProtocol::NOTIFY_CHANNEL:
+        if (result == false || rule->notify_success) {
+            emit executeChannelResponse(result, state_);
         }
         break;
 
-    case WAIT_CH_DONE:
-        if (sz_response.indexOf("DO") < 0) {
-            QString error_code = (is_single_)? QString(rx_data.mid(4)) : QString(rx_data.mid(5));
-            if (error_code == "EE01") {
-                state_ = WARNING_NOT_PICKUP;
-            }
-            else if (error_code == "EE04") {
-                state_ = ERROR_DOOR;
-            }
-            emit executeChannelResponse(false, state_);
-        }
-        else {
-            state_ = WAIT_CARS;
-            emit executeChannelResponse(true, state_);
-        }
+    default:
         break;
+    }
+}
 
-    case WAIT_CH_RETRY:
-        if (sz_response == "CHRT\r\n") {
-            tmr_wait_receive_->start(120 * 1000);
-        }
-        else if (sz_response.indexOf("DO") < 0) {
-            QString error_code = rx_data.mid(4);
-            if (error_code == "EE") {
-                state_ = WARNING_NOT_PICKUP;
-            }
-            else if (error_code == "NO") {
-                state_ = ERROR_DOOR;
-            }
-            emit executeChannelResponse(false, state_);
+void VMController::processPollResponse(const QByteArray &rx_data)
+{
+    PollCommand command = PollCommand(poll_in_flight_);
+    qDebug() << "[VMC] poll RX data:" << rx_data;
+
+    // background results only go to pollResponse, so vend listeners never
+    // see a CARS/CDOS answer they did not ask for
+    const VmcProtocol::ResponseRule *rule = VmcProtocol::rule(state_);
+    if (rule != nullptr && VmcProtocol::isProgress(*rule, rx_data)) {
+        startReceiveTimer(VMC_TIMEOUT_CHECK_MS);
+        return;
+    }
+
+    bool result = (rule == nullptr || VmcProtocol::isSuccess(*rule, rx_data));
+    if (state_ == WAIT_TP_INFO) {
+        result = (rx_data.length() == RX_LEN_TPAL);
+        if (result == false) {
+            Metrics::increment(Metrics::FRAME_ERRORS);
         }
-        else {
-            state_ = WAIT_CARS;
-            emit executeChannelResponse(true, state_);
+    }
+
+    poll_slots_[command].completed++;
+    state_ = (vend_parked_)? WAIT_CARS : IDLE;
+    exchangeFinished();
+    emit pollResponse(command, result, QString::fromUtf8(rx_data));
+}
+
+void VMController::schedulerTick()
+{
+    qint64 now_ms = link_clock_.elapsed();
+
+    // the link is free when no command, vend sequence or hold-off owns it
+    bool link_free = (this->isOpen() && holdsLink() == false && vend_active_ == false && now_ms >= hold_until_ms_);
+
+    // give this slot to the most overdue poll, the others keep waiting
+    int next = -1;
+    for (int i = 0; i < POLL_COUNT; i++) {
+        PollSlot &slot = poll_slots_[i];
+        if (slot.period_ms <= 0 || now_ms < slot.next_due_ms) {
+            continue;
         }
-        break;
 
-    case WAIT_CARS:
-        if (sz_response == "CARSOK") {
-            tmr_wait_receive_->start(120 * 1000);
+        // whole periods without a free slot are skipped, not made up later
+        qint64 missed = (now_ms - slot.next_due_ms) / slot.period_ms;
+        if (missed > 0) {
+            slot.skipped += missed;
+            slot.next_due_ms += missed * slot.period_ms;
+            emit pollSkipped(i, int(missed));
         }
-        else if (sz_response.indexOf("CAGOOK") < 0) {
-            state_ = WARNING_NOT_PICKUP;
-            emit executeChannelResponse(false, state_);
+
+        if (link_free && (next < 0 || slot.next_due_ms < poll_slots_[next].next_due_ms)) {
+            next = i;
         }
-        else {
-            state_ = WAIT_CDOS;
-            emit executeChannelResponse(true, state_);
+    }
+
+    if (next >= 0) {
+        issuePoll(PollCommand(next));
+    }
+}
+
+void VMController::issuePoll(PollCommand command)
+{
+    // encoded once, a poll only copies the frame to the port
+    static const VmcFrame frames[POLL_COUNT] = {
+        VmcProtocol::encode<VmcProtocol::INFO>(),
+        VmcProtocol::encode<VmcProtocol::TPAL>(),
+        VmcProtocol::encode<VmcProtocol::CARGO_STATE>(),
+        VmcProtocol::encode<VmcProtocol::DOOR_STATE>()
+    };
+    const VmcFrame &frame = frames[command];
+    const VmcProtocol::CommandDescriptor &descriptor = VmcProtocol::commands[frame.command];
+
+    PollSlot &slot = poll_slots_[command];
+    slot.next_due_ms += slot.period_ms;
+    slot.issued++;
+
+    // change control state
+    poll_in_flight_ = command;
+    state_ = State(descriptor.state);
+    rx_expected_len_ = descriptor.rx_len;
+    echo_len_ = frame.length - 1;
+
+    // write data
+    transmit(frame.bytes());
+
+    // a background poll never holds the link longer than a short command
+    startReceiveTimer(VMC_TIMEOUT_RECEIVE, true);
+    emit pollIssued(command);
+}
+
+void VMController::beginVend(bool first_step)
+{
+    vend_active_ = true;
+    vend_parked_ = false;
+
+    // time the customer waited for the link, counted once per vend
+    if (first_step) {
+        qint64 defer_us = (deferred_since_us_ >= 0)? link_clock_.nsecsElapsed() / 1000 - deferred_since_us_ : 0;
+        vend_count_++;
+        vend_defer_total_us_ += defer_us;
+        vend_defer_max_us_ = qMax(vend_defer_max_us_, defer_us);
+    }
+}
+
+bool VMController::isPolling() const
+{
+    return poll_in_flight_ >= 0 && replay_mode_ == false;
+}
+
+void VMController::deferRequest(int command, const QByteArray &tx_data)
+{
+    // the latest request wins, as it would on a free link
+    if (deferred_) {
+        qDebug() << "[VMC] deferred request replaced";
+    }
+    else {
+        deferred_since_us_ = link_clock_.nsecsElapsed() / 1000;
+    }
+    qDebug() << "[VMC] background poll" << poll_in_flight_ << "in flight, request deferred";
+    poll_slots_[poll_in_flight_].deferred++;
+    deferred_ = true;
+    deferred_command_ = command;
+    deferred_tx_ = tx_data;
+}
+
+void VMController::sendDeferred()
+{
+    if (deferred_ == false) {
+        return;
+    }
+
+    deferred_ = false;
+    if (deferred_command_ < 0) {
+        sendRawData(deferred_tx_);
+    }
+    else {
+        VmcFrame frame;
+        frame.command = deferred_command_;
+        frame.length = qMin(deferred_tx_.size(), int(sizeof(frame.data)));
+        memcpy(frame.data, deferred_tx_.constData(), frame.length);
+        if (startCommand(frame) == false) {
+            qDebug() << "[VMC] deferred command failed";
         }
-        break;
+    }
+    deferred_tx_.clear();
+    deferred_since_us_ = -1;
+}
 
-    case WAIT_CDOS:
-        if (sz_response == "CDOSOK") {
-            tmr_wait_receive_->start(120 * 1000);
+void VMController::exchangeFinished()
+{
+    // multi-part responses keep the link reserved, a vend parked after DONE
+    // does not, it only gets the hold-off below
+    if (holdsLink()) {
+        if (state_ != WAIT_CARS || tmr_wait_receive_->isActive() || poll_in_flight_ >= 0) {
+            return;
         }
-        else if (sz_response.indexOf("DOOREE") >= 0) {
-            state_ = ERROR_DOOR;
-            emit executeChannelResponse(false, state_);
+        vend_parked_ = true;
+    }
+
+    qint64 now_us = link_clock_.nsecsElapsed() / 1000;
+    if (busy_since_us_ >= 0) {
+        if (poll_in_flight_ >= 0) {
+            background_busy_us_ += now_us - busy_since_us_;
         }
         else {
-            state_ = IDLE;
-            emit executeChannelResponse(true, state_);
+            foreground_busy_us_ += now_us - busy_since_us_;
         }
-        break;
+        busy_since_us_ = -1;
+    }
+    poll_in_flight_ = -1;
 
-    default:
-        break;
+    // leave room for a retry or the next step of the vend application
+    if (vend_active_) {
+        vend_active_ = false;
+        hold_until_ms_ = now_us / 1000 + VEND_HOLD_OFF_MS;
     }
 
-    // clear tx and rx data
-    this->clear();
+    // the link is free, a command that waited for a poll goes first
+    sendDeferred();
 }
 
 bool VMController::isOpened()
@@ -493,6 +811,132 @@ bool VMController::isOpened()
     return this->isOpen();
 }
 
+bool VMController::isWaiting() const
+{
+    return state_ >= WAIT_FW_INFO;
+}
+
+bool VMController::holdsLink() const
+{
+    return isWaiting() && vend_parked_ == false;
+}
+
+bool VMController::prepareCommand(const VmcFrame &frame)
+{
+    const VmcProtocol::CommandDescriptor &descriptor = VmcProtocol::commands[frame.command];
+
+    // check serial port is opened
+    if (isOpened() == false) {
+        qDebug() << "[VMC] device open failed";
+        return false;
+    }
+
+    // a vend sequence holds background polls until it is over
+    if (descriptor.vend) {
+        beginVend(frame.command == VmcProtocol::CHANNEL || frame.command == VmcProtocol::CHANNEL_PAIR);
+    }
+    else {
+        vend_parked_ = false;
+    }
+
+    // change control state
+    state_ = State(descriptor.state);
+    rx_expected_len_ = descriptor.rx_len;
+    echo_len_ = frame.length - 1;
+    return true;
+}
+
+bool VMController::startCommand(const VmcFrame &frame)
+{
+    // a poll in flight is answered first, the command follows it
+    if (isPolling()) {
+        deferRequest(frame.command, QByteArray(frame.data, frame.length));
+        return true;
+    }
+    if (prepareCommand(frame) == false) {
+        return false;
+    }
+
+    qDebug() << "[VMC] TX data:" << frame.bytes();
+
+    // write data
+    transmit(frame.bytes());
+    phase_start_us_ = link_clock_.nsecsElapsed() / 1000;
+
+    // start receive timeout timer
+    startReceiveTimer(VmcProtocol::commands[frame.command].timeout_ms, true);
+    return true;
+}
+
+void VMController::startReceiveTimer(int timeout_ms, bool measure)
+{
+    int interval_ms = (timeout_ms > 0)? timeout_ms : receive_timeout_ms_;
+
+    // measure the response this timer waits for
+    rtt_state_ = -1;
+    if (measure) {
+        rtt_state_ = state_;
+        rtt_start_us_ = link_clock_.nsecsElapsed() / 1000;
+        interval_ms = adaptiveTimeout(state_, interval_ms);
+    }
+
+    // always pass the interval, start(msec) would keep a long vend timeout
+    // for the short commands after it
+    tmr_wait_receive_->start(interval_ms);
+}
+
+void VMController::sampleResponseTime()
+{
+    if (rtt_state_ < 0 || rtt_state_ != state_) {
+        rtt_state_ = -1;
+        return;
+    }
+
+    // RFC 6298 smoothing, alpha 1/8 and beta 1/4
+    qint64 sample_us = link_clock_.nsecsElapsed() / 1000 - rtt_start_us_;
+    RttEstimator &rtt = rtt_[rtt_state_];
+    if (rtt.samples == 0) {
+        rtt.srtt_us = sample_us;
+        rtt.rttvar_us = sample_us / 2;
+    }
+    else {
+        rtt.rttvar_us = (3 * rtt.rttvar_us + qAbs(rtt.srtt_us - sample_us)) / 4;
+        rtt.srtt_us = (7 * rtt.srtt_us + sample_us) / 8;
+    }
+    rtt.samples++;
+    rtt.backoff = 0;
+    rtt_state_ = -1;
+}
+
+void VMController::transmit(const QByteArray &tx_data, bool clear_buffers)
+{
+    if (trace_ != nullptr) {
+        trace_->record(SerialTrace::TX, tx_data);
+    }
+
+    // the link stays reserved until the command is answered or times out
+    if (busy_since_us_ < 0 && isWaiting()) {
+        busy_since_us_ = link_clock_.nsecsElapsed() / 1000;
+    }
+    // only a TPAL request starts a sample trace
+    if (tx_data.startsWith(CMD_TPAL)) {
+        last_tpal_tx_us_ = LatencyTrace::now();
+    }
+
+    // the replay driver feeds traffic without a port
+    if (replay_mode_) {
+        return;
+    }
+
+    if (clear_buffers) {
+        rx_buffer_.clear();
+        this->clear();
+    }
+    this->write(tx_data);
+    this->flush();
+    //this->waitForBytesWritten(3000);
+}
+
 bool VMController::writeAndWaitForReadyRead(QByteArray tx_data, int expected_len, QByteArray *rx_data)
 {
     // disconnect temporarily for blocking waiting
@@ -501,19 +945,24 @@ bool VMController::writeAndWaitForReadyRead(QByteArray tx_data, int expected_len
     qDebug() << "[VMC] TX data:" << tx_data;
 
     // write data
-    this->clear();
-    this->write(tx_data);
-    this->flush();
-    //this->waitForBytesWritten(3000);
+    transmit(tx_data);
 
     // wait and read all data
     this->waitForReadyRead(3000);
-    rx_data->append(this->readAll());
+    QByteArray rx_chunk = this->readAll();
+    rx_data->append(rx_chunk);
+    if (trace_ != nullptr && rx_chunk.isEmpty() == false) {
+        trace_->record(SerialTrace::RX, rx_chunk);
+    }
 
     int count = 0;
     while (rx_data->length() < expected_len && count < 30) {
         this->waitForReadyRead(100);
-        rx_data->append(this->readAll());
+        rx_chunk = this->readAll();
+        rx_data->append(rx_chunk);
+        if (trace_ != nullptr && rx_chunk.isEmpty() == false) {
+            trace_->record(SerialTrace::RX, rx_chunk);
+        }
         count++;
     }
 
@@ -525,6 +974,12 @@ bool VMController::writeAndWaitForReadyRead(QByteArray tx_data, int expected_len
     // check data is valid
     if (rx_data->length() != expected_len) {
         qDebug() << "[VMC] RX data's length is invalid" << rx_data->length();
+        Metrics::increment(Metrics::FRAME_ERRORS);
+
+        // keep a short response so the asynchronous path can complete it
+        if (rx_data->length() < expected_len) {
+            rx_buffer_ = *rx_data;
+        }
         return false;
     }
     return true;
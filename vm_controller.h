@@ -4,6 +4,8 @@
 #include <QSerialPort>
 #include <QTimer>
 #include <QString>
+#include <QElapsedTimer>
+#include <QJsonObject>
 
 #define CMD_INFO    "VMIF"
 #define CMD_TPAL    "TPAL"
@@ -23,6 +25,15 @@
 #define RX_LEN_CARS         6
 #define RX_LEN_CDOS         6
 
+#define SLOT_LENGTH_MS          100
+#define VEND_HOLD_OFF_MS        3000
+#define RTO_MIN_SAMPLES         4
+#define RTO_MAX_BACKOFF         6
+
+class SerialTrace;
+class LaneProfiler;
+struct VmcFrame;
+
 class VMController : public QSerialPort
 {
     Q_OBJECT
@@ -47,15 +58,65 @@ public:
         WAIT_CDOS
     };
 
+    enum PollCommand {
+        POLL_INFO,
+        POLL_TPAL,
+        POLL_CARS,
+        POLL_CDOS,
+        POLL_COUNT
+    };
+
 public:
     VMController(QObject *parent = nullptr);
     ~VMController();
 
     void setReceiveTimeout(int timeout);
 
+    // per state timeouts from the observed response times (SRTT + 4 RTTVAR),
+    // between the floor of the protocol table and the fixed timeout; the
+    // fixed timeout is the one of the command that enters the state
+    void setAdaptiveTimeouts(bool enabled);
+    int adaptiveTimeout(int state, int fixed_ms) const;
+    int fixedTimeout(int state) const;
+    State state() const;
+    static const char *stateName(int state);
+    bool isBusy() const;
+
+    // LatencyTrace::now() of the latest TPAL transmit and completed response
+    qint64 lastTpalTransmitTime() const;
+    qint64 lastFrameTime() const;
+
+    // record every TX/RX chunk into a binary trace
+    bool startRecording(QString file_path);
+    void stopRecording();
+
+    // time every vend phase per lane, the profiler is not owned
+    void setLaneProfiler(LaneProfiler *profiler);
+
+    // feed recorded traffic through the parser without a port
+    void setReplayMode(bool enabled);
+    void replayTransmit(const QByteArray &tx_data);
+    void replayReceive(const QByteArray &rx_data);
+    void replayTimeout();
+
+    // time-division scheduler for background polls, one poll per slot and
+    // none while a vend sequence holds the link
+    void setSlotLength(int msecs);
+    void setPollPeriod(PollCommand command, int msecs);
+    int pollPeriod(PollCommand command) const;
+    bool isVendActive() const;
+
+    // share of wall time the link was reserved by a command
+    double linkUtilization() const;
+    QJsonObject linkStatistics() const;
+    void resetLinkStatistics();
+
+    bool sendRawData(QByteArray tx_data);
+
     bool getFirmwareInfos();
     bool getTemperatureStatus();
     bool setCompressorSwitch(bool on_off);
+    bool startCompressorSwitch(bool on_off);
     bool setDoorSwitch(int numbering, bool on_off);
     bool executeChannel(int ch1_row, int ch1_col, int ch2_row = -1, int ch2_col = -1);
     bool executeChannelRetry();
@@ -69,23 +130,101 @@ Q_SIGNALS:
     void setCompressorSwitchResponse(bool result);
     void setDoorSwitchResponse(bool result);
     void executeChannelResponse(bool result, int state);
+    void rawDataReceived(QByteArray rx_data);
+    void pollIssued(int command);
+    void pollSkipped(int command, int missed);
+    void pollResponse(int command, bool result, QString response);
 
 private slots:
     void receiveTimeout();
     void rxDataReady();
+    void schedulerTick();
 
 private:
     bool isOpened();
+    bool isWaiting() const;
+    bool holdsLink() const;
+    bool prepareCommand(const VmcFrame &frame);
+    bool startCommand(const VmcFrame &frame);
+    void startReceiveTimer(int timeout_ms, bool measure = false);
+    void sampleResponseTime();
+    void transmit(const QByteArray &tx_data, bool clear_buffers = true);
+    void receiveChunk(const QByteArray &rx_chunk);
+    void processResponse(const QByteArray &rx_data);
+    void processPollResponse(const QByteArray &rx_data);
+    void issuePoll(PollCommand command);
+    bool isPolling() const;
+    void deferRequest(int command, const QByteArray &tx_data);
+    void sendDeferred();
+    void beginVend(bool first_step);
+    void exchangeFinished();
     bool writeAndWaitForReadyRead(QByteArray tx_data, int expected_len, QByteArray *rx_data);
 
 private:
     State state_;
 
-    bool is_single_;
+    int echo_len_;
     int rx_expected_len_;
+    int receive_timeout_ms_;
     int read_fw_info_retry_;
     int exe_channel_retry_;
     QTimer *tmr_wait_receive_;
+    QByteArray rx_buffer_;
+
+    SerialTrace *trace_ = nullptr;
+    LaneProfiler *lane_profiler_ = nullptr;
+    qint64 phase_start_us_ = 0;
+    bool replay_mode_ = false;
+
+    // background poll slots
+    struct PollSlot {
+        int period_ms = 0;
+        qint64 next_due_ms = 0;
+        qint64 issued = 0;
+        qint64 completed = 0;
+        qint64 skipped = 0;
+        qint64 timeouts = 0;
+        qint64 deferred = 0;        // requests that waited for this poll
+    };
+    PollSlot poll_slots_[POLL_COUNT];
+    QTimer *tmr_slot_;
+    int poll_in_flight_ = -1;
+    bool vend_active_ = false;
+    bool vend_parked_ = false;      // DONE received, the application sends CARS
+    qint64 hold_until_ms_ = 0;
+
+    // a request made while a poll is in flight, sent once the poll is
+    // answered or times out; command -1 is raw data
+    bool deferred_ = false;
+    int deferred_command_ = -1;
+    QByteArray deferred_tx_;
+    qint64 deferred_since_us_ = -1;
+
+    // link utilization
+    QElapsedTimer link_clock_;
+    qint64 stats_since_us_ = 0;
+    qint64 busy_since_us_ = -1;
+    qint64 foreground_busy_us_ = 0;
+    qint64 background_busy_us_ = 0;
+    qint64 vend_count_ = 0;
+    qint64 vend_defer_total_us_ = 0;
+    qint64 vend_defer_max_us_ = 0;
+
+    // response time estimators, one per waiting state
+    struct RttEstimator {
+        qint64 srtt_us = 0;
+        qint64 rttvar_us = 0;
+        qint64 samples = 0;
+        qint64 timeouts = 0;
+        int backoff = 0;
+    };
+    RttEstimator rtt_[WAIT_CDOS + 1];
+    bool adaptive_timeouts_ = true;
+    int rtt_state_ = -1;
+    qint64 rtt_start_us_ = 0;
+
+    qint64 last_tpal_tx_us_ = -1;
+    qint64 last_frame_us_ = -1;
 };
 
 #endif // VM_CONTROLLER_H
@@ -0,0 +1,311 @@
+#include "vmc_emulator.h"
+
+#include <QSocketNotifier>
+#include <QRandomGenerator>
+#include <QTimer>
+#include <QDebug>
+
+#ifdef Q_OS_UNIX
+#include <fcntl.h>
+#include <stdlib.h>
+#include <termios.h>
+#include <unistd.h>
+#endif
+
+#include "vm_controller.h"
+
+VmcEmulator::VmcEmulator(QObject *parent)
+    : QObject(parent)
+{
+    for (int i = 0; i < 8; i++) {
+        temperature_[i] = 4.0f + i * 0.5f;
+    }
+}
+
+VmcEmulator::~VmcEmulator()
+{
+    stop();
+}
+
+QString VmcEmulator::portName() const
+{
+    return port_name_;
+}
+
+void VmcEmulator::setLatency(int min_ms, int max_ms)
+{
+    latency_min_ = qMax(0, min_ms);
+    latency_max_ = qMax(latency_min_, max_ms);
+}
+
+void VmcEmulator::setOperationDelay(int ms)
+{
+    operation_delay_ = qMax(0, ms);
+}
+
+void VmcEmulator::setFragmentation(int fragment_size, int fragment_delay_ms)
+{
+    fragment_size_ = qMax(0, fragment_size);
+    fragment_delay_ = qMax(0, fragment_delay_ms);
+}
+
+void VmcEmulator::setDropRate(double rate)
+{
+    drop_rate_ = rate;
+}
+
+void VmcEmulator::setCorruptRate(double rate)
+{
+    corrupt_rate_ = rate;
+}
+
+void VmcEmulator::setChannelError(QByteArray error_code)
+{
+    channel_error_ = error_code;
+}
+
+void VmcEmulator::setDoorOpened(bool opened)
+{
+    door_opened_ = opened;
+}
+
+int VmcEmulator::commandCount() const
+{
+    return command_count_;
+}
+
+bool VmcEmulator::start()
+{
+#ifdef Q_OS_UNIX
+    if (master_fd_ >= 0) {
+        return true;
+    }
+
+    // create the pseudo terminal pair
+    master_fd_ = ::posix_openpt(O_RDWR | O_NOCTTY);
+    if (master_fd_ < 0 || ::grantpt(master_fd_) != 0 || ::unlockpt(master_fd_) != 0) {
+        qDebug() << "[VMC-EMU] create pty failed";
+        stop();
+        return false;
+    }
+    port_name_ = QString::fromLocal8Bit(::ptsname(master_fd_));
+
+    // hold the slave side open so the master never reads EIO while
+    // VMController is closed, and switch it to raw mode to disable echo
+    slave_fd_ = ::open(::ptsname(master_fd_), O_RDWR | O_NOCTTY);
+    if (slave_fd_ < 0) {
+        qDebug() << "[VMC-EMU] open pty slave failed";
+        stop();
+        return false;
+    }
+    struct termios tio;
+    ::tcgetattr(slave_fd_, &tio);
+    ::cfmakeraw(&tio);
+    ::tcsetattr(slave_fd_, TCSANOW, &tio);
+    ::fcntl(master_fd_, F_SETFL, ::fcntl(master_fd_, F_GETFL) | O_NONBLOCK);
+
+    notifier_ = new QSocketNotifier(master_fd_, QSocketNotifier::Read, this);
+    connect(notifier_, SIGNAL(activated(int)), this, SLOT(masterReadyRead()));
+
+    clock_.start();
+    next_free_ms_ = 0;
+    qDebug() << "[VMC-EMU] listening on" << port_name_;
+    return true;
+#else
+    qDebug() << "[VMC-EMU] pseudo terminal is not supported on this platform";
+    return false;
+#endif
+}
+
+void VmcEmulator::stop()
+{
+#ifdef Q_OS_UNIX
+    if (notifier_ != nullptr) {
+        notifier_->setEnabled(false);
+        delete notifier_;
+        notifier_ = nullptr;
+    }
+    if (slave_fd_ >= 0) {
+        ::close(slave_fd_);
+        slave_fd_ = -1;
+    }
+    if (master_fd_ >= 0) {
+        ::close(master_fd_);
+        master_fd_ = -1;
+    }
+#endif
+    port_name_.clear();
+    rx_buffer_.clear();
+}
+
+void VmcEmulator::masterReadyRead()
+{
+#ifdef Q_OS_UNIX
+    char buffer[256];
+    ssize_t length = ::read(master_fd_, buffer, sizeof(buffer));
+    if (length <= 0) {
+        return;
+    }
+    rx_buffer_.append(buffer, int(length));
+
+    // commands are terminated by '\n'
+    int index;
+    while ((index = rx_buffer_.indexOf('\n')) >= 0) {
+        QByteArray cmd = rx_buffer_.left(index).trimmed();
+        rx_buffer_.remove(0, index + 1);
+        if (cmd.isEmpty() == false) {
+            handleCommand(cmd);
+        }
+    }
+#endif
+}
+
+void VmcEmulator::handleCommand(const QByteArray &cmd)
+{
+    command_count_++;
+
+    if (cmd == CMD_INFO) {
+        respond(QByteArray(CMD_INFO) + "V1.00");
+    }
+    else if (cmd == CMD_TPAL) {
+        respond(temperatureFrame());
+    }
+    else if (cmd == CMD_CPON || cmd == CMD_CPOFF) {
+        compressor_on_ = (cmd == CMD_CPON);
+        respond(cmd + "OK");
+    }
+    else if (cmd == CMD_CHRT) {
+        respond("CHRT\r\n");
+        if (channel_error_ == "EE01") {
+            respond("CHRTEE", operation_delay_);
+        }
+        else if (channel_error_ == "EE04") {
+            respond("CHRTNO", operation_delay_);
+        }
+        else {
+            respond("CHRTDO", operation_delay_);
+        }
+    }
+    else if (cmd == CMD_CARS) {
+        respond("CARSOK");
+        respond((channel_error_ == "EE01")? "CAGOEE" : "CAGOOK", operation_delay_);
+    }
+    else if (cmd == CMD_CDOS) {
+        respond("CDOSOK");
+        respond((door_opened_)? "DOOREE" : "DOOROK", operation_delay_);
+    }
+    else if (cmd.startsWith("CH") && cmd.length() == 4) {
+        handleChannel(cmd);
+    }
+    else if (cmd.startsWith("D") && cmd.length() == 5) {
+        handleChannel(cmd);
+    }
+    else if (cmd.startsWith("C") && (cmd.endsWith("ON") || cmd.endsWith("OF"))) {
+        respond(cmd + "OK");
+    }
+    else {
+        qDebug() << "[VMC-EMU] unknown command:" << cmd;
+    }
+}
+
+void VmcEmulator::handleChannel(const QByteArray &prefix)
+{
+    // accepted, operating, then done or an EE error code
+    respond(prefix + "OK");
+
+    if (door_opened_) {
+        respond("DOOREE", operation_delay_);
+        return;
+    }
+    if (channel_error_ == "EE02" || channel_error_ == "EE03") {
+        respond(prefix + channel_error_, operation_delay_);
+        return;
+    }
+    respond(prefix + "OP", operation_delay_);
+
+    if (channel_error_ == "EE01" || channel_error_ == "EE04") {
+        respond(prefix + channel_error_, operation_delay_);
+        return;
+    }
+    respond(prefix + "DONE", operation_delay_);
+}
+
+void VmcEmulator::respond(const QByteArray &data, int extra_delay_ms)
+{
+    // fault injection: lost or garbled response
+    if (chance(drop_rate_)) {
+        qDebug() << "[VMC-EMU] drop response:" << data;
+        return;
+    }
+    QByteArray tx_data = data;
+    if (chance(corrupt_rate_) && tx_data.isEmpty() == false) {
+        tx_data[int(QRandomGenerator::global()->bounded(tx_data.length()))] = '?';
+    }
+
+    // schedule after the previous response so the byte order is kept
+    int latency = latency_min_;
+    if (latency_max_ > latency_min_) {
+        latency += int(QRandomGenerator::global()->bounded(latency_max_ - latency_min_ + 1));
+    }
+    qint64 now = clock_.elapsed();
+    qint64 due = qMax(now + latency, next_free_ms_) + extra_delay_ms;
+
+    // split into fragments to exercise partial reads
+    int step = (fragment_size_ > 0)? fragment_size_ : tx_data.length();
+    for (int offset = 0; offset < tx_data.length(); offset += step) {
+        QByteArray fragment = tx_data.mid(offset, step);
+        QTimer::singleShot(int(due - now), this, [this, fragment]() { writeMaster(fragment); });
+        if (offset + step < tx_data.length()) {
+            due += fragment_delay_;
+        }
+    }
+    next_free_ms_ = due;
+}
+
+void VmcEmulator::writeMaster(const QByteArray &data)
+{
+#ifdef Q_OS_UNIX
+    if (master_fd_ >= 0) {
+        ssize_t written = ::write(master_fd_, data.constData(), size_t(data.length()));
+        Q_UNUSED(written);
+    }
+#else
+    Q_UNUSED(data);
+#endif
+}
+
+QByteArray VmcEmulator::temperatureFrame()
+{
+    // drift toward the setpoint while the compressor runs, warm up otherwise
+    for (int i = 0; i < 8; i++) {
+        float drift = (compressor_on_)? -0.1f : 0.1f;
+        if (door_opened_) {
+            drift += 0.3f;
+        }
+        float noise = float(QRandomGenerator::global()->bounded(21) - 10) / 100.0f;
+        temperature_[i] = qBound(-40.0f, temperature_[i] + drift + noise, 60.0f);
+    }
+
+    // TP01+04.0 ... TP08+07.5CP1FN1DR0
+    QByteArray frame;
+    frame.reserve(RX_LEN_TPAL);
+    char value[8];
+    for (int i = 0; i < 8; i++) {
+        qsnprintf(value, sizeof(value), "%+05.1f", double(temperature_[i]));
+        frame.append("TP0");
+        frame.append(char('1' + i));
+        frame.append(value, 5);
+    }
+    frame.append("CP");
+    frame.append((compressor_on_)? '1' : '0');
+    frame.append("FN");
+    frame.append((fan_on_)? '1' : '0');
+    frame.append("DR");
+    frame.append((door_opened_)? '1' : '0');
+    return frame;
+}
+
+bool VmcEmulator::chance(double rate) const
+{
+    return rate > 0 && QRandomGenerator::global()->generateDouble() < rate;
+}
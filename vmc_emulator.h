@@ -0,0 +1,79 @@
+#ifndef VMC_EMULATOR_H
+#define VMC_EMULATOR_H
+
+#include <QObject>
+#include <QByteArray>
+#include <QElapsedTimer>
+
+class QSocketNotifier;
+
+// Emulates the VMC board behind a pseudo terminal, so VMController can be
+// opened on portName() and exercised without a real cabinet.
+class VmcEmulator : public QObject
+{
+    Q_OBJECT
+
+public:
+    VmcEmulator(QObject *parent = nullptr);
+    ~VmcEmulator();
+
+    QString portName() const;
+
+    // response timing
+    void setLatency(int min_ms, int max_ms);
+    void setOperationDelay(int ms);
+    void setFragmentation(int fragment_size, int fragment_delay_ms);
+
+    // fault injection, rates are probabilities per response
+    void setDropRate(double rate);
+    void setCorruptRate(double rate);
+    void setChannelError(QByteArray error_code);
+    void setDoorOpened(bool opened);
+
+    int commandCount() const;
+
+public slots:
+    bool start();
+    void stop();
+
+private slots:
+    void masterReadyRead();
+
+private:
+    void handleCommand(const QByteArray &cmd);
+    void handleChannel(const QByteArray &prefix);
+    void respond(const QByteArray &data, int extra_delay_ms = 0);
+    void writeMaster(const QByteArray &data);
+    QByteArray temperatureFrame();
+    bool chance(double rate) const;
+
+private:
+    int master_fd_ = -1;
+    int slave_fd_ = -1;
+    QString port_name_;
+    QSocketNotifier *notifier_ = nullptr;
+    QByteArray rx_buffer_;
+
+    // timing and fault configuration
+    int latency_min_ = 5;
+    int latency_max_ = 20;
+    int operation_delay_ = 500;
+    int fragment_size_ = 0;
+    int fragment_delay_ = 0;
+    double drop_rate_ = 0;
+    double corrupt_rate_ = 0;
+    QByteArray channel_error_;
+
+    // keep responses in order when latency is random
+    QElapsedTimer clock_;
+    qint64 next_free_ms_ = 0;
+
+    // simulated cabinet state
+    float temperature_[8];
+    bool compressor_on_ = true;
+    bool fan_on_ = true;
+    bool door_opened_ = false;
+    int command_count_ = 0;
+};
+
+#endif // VMC_EMULATOR_H
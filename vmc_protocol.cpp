@@ -0,0 +1,107 @@
+#include "vmc_protocol.h"
+
+// storage for the tables, the initializers are in the header
+constexpr VmcProtocol::CommandDescriptor VmcProtocol::commands[];
+constexpr VmcProtocol::ResponseRule VmcProtocol::rules[];
+
+static int appendText(char *data, int length, const char *text)
+{
+    while (*text != '\0') {
+        data[length++] = *text++;
+    }
+    return length;
+}
+
+static int appendNumber(char *data, int length, int value)
+{
+    char digits[VMC_ARG_DIGITS];
+    int count = 0;
+
+    // rows and columns are small, larger values do not fit the frame
+    value = qBound(0, value, 999);
+    do {
+        digits[count++] = char('0' + value % 10);
+        value /= 10;
+    } while (value > 0 && count < VMC_ARG_DIGITS);
+
+    while (count > 0) {
+        data[length++] = digits[--count];
+    }
+    return length;
+}
+
+VmcFrame VmcProtocol::encodeFrame(const CommandDescriptor &descriptor, const int *args)
+{
+    VmcFrame frame;
+    frame.command = descriptor.command;
+    frame.length = appendText(frame.data, 0, descriptor.prefix);
+    for (int i = 0; i < descriptor.arg_count; i++) {
+        frame.length = appendNumber(frame.data, frame.length, args[i]);
+    }
+    frame.length = appendText(frame.data, frame.length, descriptor.suffix);
+    frame.data[frame.length++] = '\n';
+    return frame;
+}
+
+int VmcProtocol::classify(const QByteArray &tx_data)
+{
+    QByteArray cmd = tx_data.trimmed();
+
+    for (int i = 0; i < COMMAND_COUNT; i++) {
+        const CommandDescriptor &descriptor = commands[i];
+        int prefix_len = textLength(descriptor.prefix);
+        int suffix_len = textLength(descriptor.suffix);
+        if (cmd.startsWith(descriptor.prefix) == false || cmd.endsWith(descriptor.suffix) == false) {
+            continue;
+        }
+
+        // the arguments are digits only, at least one per argument
+        int args_len = cmd.length() - prefix_len - suffix_len;
+        bool digits = (args_len >= descriptor.arg_count && args_len <= descriptor.arg_count * VMC_ARG_DIGITS);
+        for (int j = prefix_len; digits && j < prefix_len + args_len; j++) {
+            digits = (cmd.at(j) >= '0' && cmd.at(j) <= '9');
+        }
+        if (digits) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+const VmcProtocol::ResponseRule *VmcProtocol::rule(int state)
+{
+    if (state < VMController::WAIT_FW_INFO || state > VMController::WAIT_CDOS) {
+        return nullptr;
+    }
+    return &rules[state - VMController::WAIT_FW_INFO];
+}
+
+bool VmcProtocol::isProgress(const ResponseRule &rule, const QByteArray &rx_data)
+{
+    return (rule.progress != nullptr && rx_data == rule.progress);
+}
+
+bool VmcProtocol::isSuccess(const ResponseRule &rule, const QByteArray &rx_data)
+{
+    if (rule.success != nullptr && rx_data.indexOf(rule.success) < rule.success_from) {
+        return false;
+    }
+    if (rule.failure != nullptr && rx_data.indexOf(rule.failure) >= 0) {
+        return false;
+    }
+    return true;
+}
+
+int VmcProtocol::errorState(const ResponseRule &rule, const QByteArray &rx_data, int echo_len)
+{
+    for (const ErrorPattern &error : rule.errors) {
+        if (error.pattern == nullptr) {
+            break;
+        }
+        if ((error.match == CONTAINS && rx_data.indexOf(error.pattern) >= 0)
+                || (error.match == ERROR_CODE && rx_data.mid(echo_len) == error.pattern)) {
+            return error.state;
+        }
+    }
+    return rule.error_state;
+}
@@ -0,0 +1,197 @@
+#ifndef VMC_PROTOCOL_H
+#define VMC_PROTOCOL_H
+
+#include <QByteArray>
+
+#include "vm_controller.h"
+
+#define VMC_TIMEOUT_RECEIVE     0               // VMController::setReceiveTimeout, 3 s by default
+#define VMC_TIMEOUT_CHECK_MS    (30 * 1000)
+#define VMC_TIMEOUT_VEND_MS     (120 * 1000)
+
+// adaptive timeout floors, see VMController::adaptiveTimeout
+#define VMC_RTO_BOARD_MS        500             // answered by the board itself
+
+#define VMC_FRAME_SIZE          16
+#define VMC_ARG_DIGITS          3
+
+// encoded command, built in place without allocating
+struct VmcFrame
+{
+    int command;
+    char data[VMC_FRAME_SIZE];
+    int length;
+
+    // shares data, the frame must outlive the returned array
+    QByteArray bytes() const { return QByteArray::fromRawData(data, length); }
+};
+
+// Every VMC command and every response state is declared once in the tables
+// below. VMController sends and parses through them, so adding a command
+// means adding a row here instead of another method and switch case.
+class VmcProtocol
+{
+public:
+    enum Command {
+        INFO,
+        TPAL,
+        CP_ON,
+        CP_OFF,
+        DOOR_ON,
+        DOOR_OFF,
+        CHANNEL,
+        CHANNEL_PAIR,
+        CHANNEL_RETRY,
+        CARGO_STATE,
+        DOOR_STATE,
+        COMMAND_COUNT
+    };
+
+    // signal raised for a parsed response
+    enum Notify {
+        NOTIFY_FW_INFO,
+        NOTIFY_TEMPERATURE,
+        NOTIFY_COMPRESSOR,
+        NOTIFY_DOOR,
+        NOTIFY_CHANNEL
+    };
+
+    enum Match {
+        CONTAINS,       // pattern anywhere in the response
+        ERROR_CODE      // the response after the echoed command equals the pattern
+    };
+
+    // <prefix><arguments><suffix>\n
+    struct CommandDescriptor {
+        int command;
+        const char *prefix;
+        int arg_count;          // decimal arguments after the prefix
+        const char *suffix;
+        int state;              // VMController::State while waiting
+        int rx_len;
+        int timeout_ms;
+        bool vend;              // part of a vend sequence, holds background polls
+    };
+
+    struct ErrorPattern {
+        int match;
+        const char *pattern;
+        int state;
+    };
+
+    // how a waiting state treats the response it receives
+    struct ResponseRule {
+        int state;
+        int notify;
+        int rto_min_ms;             // 0 always uses the fixed timeout
+        const char *progress;       // exact acknowledgment, keep waiting
+        int progress_timeout_ms;
+        const char *success;        // must appear at success_from or later
+        int success_from;
+        const char *failure;        // must not appear
+        int success_state;
+        int success_rx_len;         // 0 keeps the expected length
+        int success_timeout_ms;     // 0 does not restart the timer
+        bool notify_success;
+        int error_state;            // -1 keeps the current state
+        ErrorPattern errors[3];     // first match wins over error_state
+    };
+
+    static constexpr CommandDescriptor commands[COMMAND_COUNT] = {
+        { INFO,          CMD_INFO, 0, "",   VMController::WAIT_FW_INFO,  RX_LEN_INFO,       VMC_TIMEOUT_RECEIVE,  false },
+        { TPAL,          CMD_TPAL, 0, "",   VMController::WAIT_TP_INFO,  RX_LEN_TPAL,       VMC_TIMEOUT_RECEIVE,  false },
+        { CP_ON,         CMD_CPON, 0, "",   VMController::WAIT_CP_ONOFF, RX_LEN_CP_ONOFF,   VMC_TIMEOUT_RECEIVE,  false },
+        { CP_OFF,        CMD_CPOFF, 0, "",  VMController::WAIT_CP_ONOFF, RX_LEN_CP_ONOFF,   VMC_TIMEOUT_RECEIVE,  false },
+        { DOOR_ON,       "C",      1, "ON", VMController::WAIT_DR_ONOFF, RX_LEN_DR_ONOFF,   VMC_TIMEOUT_RECEIVE,  false },
+        { DOOR_OFF,      "C",      1, "OF", VMController::WAIT_DR_ONOFF, RX_LEN_DR_ONOFF,   VMC_TIMEOUT_RECEIVE,  false },
+        { CHANNEL,       "CH",     2, "",   VMController::WAIT_CH_OK,    RX_LEN_CH_SINGLE,  VMC_TIMEOUT_VEND_MS,  true },
+        { CHANNEL_PAIR,  "D",      4, "",   VMController::WAIT_CH_OK,    RX_LEN_CH_COMBINE, VMC_TIMEOUT_VEND_MS,  true },
+        { CHANNEL_RETRY, CMD_CHRT, 0, "",   VMController::WAIT_CH_RETRY, RX_LEN_CH_RETRY,   VMC_TIMEOUT_VEND_MS,  true },
+        { CARGO_STATE,   CMD_CARS, 0, "",   VMController::WAIT_CARS,     RX_LEN_CARS,       VMC_TIMEOUT_CHECK_MS, true },
+        { DOOR_STATE,    CMD_CDOS, 0, "",   VMController::WAIT_CDOS,     RX_LEN_CDOS,       VMC_TIMEOUT_CHECK_MS, true }
+    };
+
+    // one rule per waiting state, in VMController::State order
+    static constexpr ResponseRule rules[VMController::WAIT_CDOS - VMController::WAIT_FW_INFO + 1] = {
+        // firmware information and temperature status are passed through
+        { VMController::WAIT_FW_INFO, NOTIFY_FW_INFO, VMC_RTO_BOARD_MS, nullptr, 0, nullptr, 0, nullptr,
+          VMController::IDLE, 0, 0, true, VMController::IDLE, {} },
+        { VMController::WAIT_TP_INFO, NOTIFY_TEMPERATURE, VMC_RTO_BOARD_MS, nullptr, 0, nullptr, 0, nullptr,
+          VMController::IDLE, 0, 0, true, VMController::IDLE, {} },
+
+        // <command>OK, an OK without the echo is not accepted
+        { VMController::WAIT_CP_ONOFF, NOTIFY_COMPRESSOR, VMC_RTO_BOARD_MS, nullptr, 0, "OK", 1, nullptr,
+          VMController::IDLE, 0, 0, true, VMController::IDLE, {} },
+        { VMController::WAIT_DR_ONOFF, NOTIFY_DOOR, VMC_RTO_BOARD_MS, nullptr, 0, "OK", 1, nullptr,
+          VMController::IDLE, 0, 0, true, VMController::IDLE, {} },
+
+        // vend sequence: OK, OP (dropping), DO (done), then CARS and CDOS;
+        // a channel command must not be repeated, a late answer would be
+        // taken for the next command, so OK, OP and DO keep their fixed
+        // timeouts like the retry and the pickup after CARSOK/CDOSOK
+        { VMController::WAIT_CH_OK, NOTIFY_CHANNEL, 0, nullptr, 0, "OK", 0, nullptr,
+          VMController::WAIT_CH_OP, 6, VMC_TIMEOUT_VEND_MS, false, VMController::ERROR_TIMEOUT, {} },
+        { VMController::WAIT_CH_OP, NOTIFY_CHANNEL, 0, nullptr, 0, "OP", 0, nullptr,
+          VMController::WAIT_CH_DONE, 8, VMC_TIMEOUT_VEND_MS, true, -1,
+          { { CONTAINS, "DOOREE", VMController::ERROR_DOOR },
+            { ERROR_CODE, "EE02", VMController::ERROR_DROP },
+            { ERROR_CODE, "EE03", VMController::ERROR_CARGO } } },
+        { VMController::WAIT_CH_DONE, NOTIFY_CHANNEL, 0, nullptr, 0, "DO", 0, nullptr,
+          VMController::WAIT_CARS, 0, 0, true, -1,
+          { { ERROR_CODE, "EE01", VMController::WARNING_NOT_PICKUP },
+            { ERROR_CODE, "EE04", VMController::ERROR_DOOR } } },
+        { VMController::WAIT_CH_RETRY, NOTIFY_CHANNEL, 0, "CHRT\r\n", VMC_TIMEOUT_VEND_MS, "DO", 0, nullptr,
+          VMController::WAIT_CARS, 0, 0, true, -1,
+          { { ERROR_CODE, "EE", VMController::WARNING_NOT_PICKUP },
+            { ERROR_CODE, "NO", VMController::ERROR_DOOR } } },
+        { VMController::WAIT_CARS, NOTIFY_CHANNEL, VMC_RTO_BOARD_MS, "CARSOK", VMC_TIMEOUT_VEND_MS, "CAGOOK", 0, nullptr,
+          VMController::WAIT_CDOS, 0, 0, true, VMController::WARNING_NOT_PICKUP, {} },
+        { VMController::WAIT_CDOS, NOTIFY_CHANNEL, VMC_RTO_BOARD_MS, "CDOSOK", VMC_TIMEOUT_VEND_MS, nullptr, 0, "DOOREE",
+          VMController::IDLE, 0, 0, true, VMController::ERROR_DOOR, {} }
+    };
+
+    // the argument count is checked against the table at compile time
+    template <Command C, typename... Args>
+    static VmcFrame encode(Args... args)
+    {
+        static_assert(int(sizeof...(Args)) == commands[C].arg_count, "argument count does not match the protocol table");
+        const int values[] = { int(args)..., 0 };
+        return encodeFrame(commands[C], values);
+    }
+
+    // command of a transmitted line, -1 if it is not in the table
+    static int classify(const QByteArray &tx_data);
+
+    // nullptr for states that do not wait for a response
+    static const ResponseRule *rule(int state);
+
+    static bool isProgress(const ResponseRule &rule, const QByteArray &rx_data);
+    static bool isSuccess(const ResponseRule &rule, const QByteArray &rx_data);
+    static int errorState(const ResponseRule &rule, const QByteArray &rx_data, int echo_len);
+
+    // compile time checks of the tables
+    static constexpr int textLength(const char *text)
+    {
+        return (*text == '\0')? 0 : 1 + textLength(text + 1);
+    }
+    static constexpr bool commandsValid(int i)
+    {
+        return i >= COMMAND_COUNT
+            || (commands[i].command == i
+                && textLength(commands[i].prefix) + commands[i].arg_count * VMC_ARG_DIGITS + textLength(commands[i].suffix) + 1 <= VMC_FRAME_SIZE
+                && commandsValid(i + 1));
+    }
+    static constexpr bool rulesValid(int i)
+    {
+        return i >= int(sizeof(rules) / sizeof(rules[0]))
+            || (rules[i].state == VMController::WAIT_FW_INFO + i && rulesValid(i + 1));
+    }
+
+private:
+    static VmcFrame encodeFrame(const CommandDescriptor &descriptor, const int *args);
+};
+
+static_assert(VmcProtocol::commandsValid(0), "protocol commands out of order or longer than VMC_FRAME_SIZE");
+static_assert(VmcProtocol::rulesValid(0), "protocol rules do not follow VMController::State");
+
+#endif // VMC_PROTOCOL_H
@@ -0,0 +1,188 @@
+#include "vmc_stress_test.h"
+
+#include <QTimer>
+#include <QJsonObject>
+#include <QJsonDocument>
+#include <QTextStream>
+#include <QDebug>
+
+#include "vm_controller.h"
+
+VmcStressTest::VmcStressTest(QObject *parent)
+    : QObject(parent)
+{
+    vm_controller_ = new VMController(this);
+    connect(vm_controller_, SIGNAL(getFirmwareInfosResponse(QString)), this, SLOT(firmwareInfosResponse(QString)));
+    connect(vm_controller_, SIGNAL(getTemperatureStatusResponse(QString)), this, SLOT(temperatureStatusResponse(QString)));
+    connect(vm_controller_, SIGNAL(setCompressorSwitchResponse(bool)), this, SLOT(compressorSwitchResponse(bool)));
+    connect(vm_controller_, SIGNAL(executeChannelResponse(bool,int)), this, SLOT(channelResponse(bool,int)));
+    connect(vm_controller_, SIGNAL(timeoutWithState(QString,int)), this, SLOT(timeoutWithState(QString,int)));
+}
+
+VmcStressTest::~VmcStressTest()
+{
+
+}
+
+void VmcStressTest::setPollPeriod(int msecs)
+{
+    poll_period_ms_ = msecs;
+}
+
+bool VmcStressTest::start(QString port_name, int duration_sec, bool with_vend)
+{
+    vm_controller_->setPortName(port_name);
+    if (vm_controller_->open(QIODevice::ReadWrite) == false) {
+        qDebug() << "[STRESS] open" << port_name << "failed";
+        return false;
+    }
+
+    duration_sec_ = duration_sec;
+    with_vend_ = with_vend;
+    step_ = 0;
+    clock_.start();
+    vm_controller_->resetLinkStatistics();
+    if (poll_period_ms_ > 0) {
+        vm_controller_->setPollPeriod(VMController::POLL_TPAL, poll_period_ms_);
+    }
+
+    qDebug() << "[STRESS] start on" << port_name << "for" << duration_sec << "seconds";
+    QTimer::singleShot(0, this, SLOT(nextCommand()));
+    return true;
+}
+
+void VmcStressTest::nextCommand()
+{
+    // stop issuing commands when the duration is over
+    if (clock_.elapsed() >= duration_sec_ * 1000) {
+        vm_controller_->setPollPeriod(VMController::POLL_TPAL, 0);
+        report();
+        emit finished();
+        return;
+    }
+
+    int step_count = (with_vend_)? 6 : 5;
+    int step = step_++ % step_count;
+
+    waiting_ = true;
+    command_clock_.start();
+
+    bool started = false;
+    switch (step) {
+    case 0:
+        started = vm_controller_->getFirmwareInfos();
+        break;
+    case 1:
+    case 3:
+        started = vm_controller_->getTemperatureStatus();
+        break;
+    case 2:
+        started = vm_controller_->setCompressorSwitch(true);
+        break;
+    case 4:
+        started = vm_controller_->setCompressorSwitch(false);
+        break;
+    default:
+        started = vm_controller_->executeChannel(1, 1);
+        break;
+    }
+
+    if (started == false) {
+        commandDone(false);
+    }
+}
+
+void VmcStressTest::firmwareInfosResponse(QString infos)
+{
+    commandDone(infos.startsWith(CMD_INFO));
+}
+
+void VmcStressTest::temperatureStatusResponse(QString status)
+{
+    commandDone(status.length() == RX_LEN_TPAL);
+}
+
+void VmcStressTest::compressorSwitchResponse(bool result)
+{
+    commandDone(result);
+}
+
+void VmcStressTest::channelResponse(bool result, int state)
+{
+    if (result == false) {
+        commandDone(false);
+        return;
+    }
+
+    // walk the vend sequence the same way the vending application does
+    switch (state) {
+    case VMController::WAIT_CARS:
+        vm_controller_->checkCargoState();
+        break;
+    case VMController::WAIT_CDOS:
+        vm_controller_->checkDoorState();
+        break;
+    case VMController::IDLE:
+        vends_++;
+        commandDone(true);
+        break;
+    default:
+        break;
+    }
+}
+
+void VmcStressTest::timeoutWithState(QString err_msg, int state)
+{
+    Q_UNUSED(err_msg);
+    timeouts_++;
+    timeouts_by_state_[state]++;
+    commandDone(false);
+}
+
+void VmcStressTest::commandDone(bool success)
+{
+    if (waiting_ == false) {
+        return;
+    }
+    waiting_ = false;
+
+    qint64 latency_us = command_clock_.nsecsElapsed() / 1000;
+    commands_++;
+    total_latency_us_ += latency_us;
+    max_latency_us_ = qMax(max_latency_us_, latency_us);
+    if (success == false) {
+        failures_++;
+    }
+
+    // issue the next command from the event loop, not from inside the callback
+    QTimer::singleShot(0, this, SLOT(nextCommand()));
+}
+
+void VmcStressTest::report()
+{
+    double elapsed_sec = clock_.elapsed() / 1000.0;
+
+    QJsonObject timeouts_obj;
+    foreach (int state, timeouts_by_state_.keys()) {
+        timeouts_obj.insert(QString::number(state), timeouts_by_state_.value(state));
+    }
+
+    QJsonObject result_obj;
+    result_obj.insert("elapsed_sec", elapsed_sec);
+    result_obj.insert("commands", double(commands_));
+    result_obj.insert("commands_per_sec", (elapsed_sec > 0)? commands_ / elapsed_sec : 0.0);
+    result_obj.insert("failures", double(failures_));
+    result_obj.insert("timeouts", double(timeouts_));
+    result_obj.insert("timeout_rate", (commands_ > 0)? double(timeouts_) / commands_ : 0.0);
+    result_obj.insert("timeouts_by_state", timeouts_obj);
+    result_obj.insert("vends", double(vends_));
+    result_obj.insert("avg_latency_ms", (commands_ > 0)? total_latency_us_ / 1000.0 / commands_ : 0.0);
+    result_obj.insert("max_latency_ms", max_latency_us_ / 1000.0);
+    result_obj.insert("link", vm_controller_->linkStatistics());
+
+    qDebug() << "[STRESS]" << commands_ << "commands," << timeouts_ << "timeouts in" << elapsed_sec << "s";
+
+    QTextStream out(stdout);
+    out << QJsonDocument(result_obj).toJson(QJsonDocument::Compact) << "\n";
+    out.flush();
+}
@@ -0,0 +1,61 @@
+#ifndef VMC_STRESS_TEST_H
+#define VMC_STRESS_TEST_H
+
+#include <QObject>
+#include <QElapsedTimer>
+#include <QMap>
+
+class VMController;
+
+// Drives the real VMController against a port (normally the emulator pty)
+// and reports commands/sec, latency and timeout rates.
+class VmcStressTest : public QObject
+{
+    Q_OBJECT
+
+public:
+    VmcStressTest(QObject *parent = nullptr);
+    ~VmcStressTest();
+
+    bool start(QString port_name, int duration_sec, bool with_vend = false);
+
+    // run TPAL background polls through the slot scheduler meanwhile
+    void setPollPeriod(int msecs);
+
+Q_SIGNALS:
+    void finished();
+
+private slots:
+    void nextCommand();
+    void firmwareInfosResponse(QString infos);
+    void temperatureStatusResponse(QString status);
+    void compressorSwitchResponse(bool result);
+    void channelResponse(bool result, int state);
+    void timeoutWithState(QString err_msg, int state);
+
+private:
+    void commandDone(bool success);
+    void report();
+
+private:
+    VMController *vm_controller_;
+
+    int duration_sec_ = 0;
+    bool with_vend_ = false;
+    int poll_period_ms_ = 0;
+    int step_ = 0;
+    bool waiting_ = false;
+
+    QElapsedTimer clock_;
+    QElapsedTimer command_clock_;
+
+    qint64 commands_ = 0;
+    qint64 failures_ = 0;
+    qint64 timeouts_ = 0;
+    qint64 vends_ = 0;
+    qint64 total_latency_us_ = 0;
+    qint64 max_latency_us_ = 0;
+    QMap<int, int> timeouts_by_state_;
+};
+
+#endif // VMC_STRESS_TEST_H
@@ -0,0 +1,166 @@
+#include "windowed_stats.h"
+
+#include "telemetry_payload.h"
+
+double WindowSummary::variance(int channel) const
+{
+    return (count > 0)? m2[channel] / count : 0.0;
+}
+
+WindowedStats::WindowedStats()
+{
+    length_ms_[WINDOW_SHORT] = 60 * 1000;
+    length_ms_[WINDOW_MEDIUM] = 15 * 60 * 1000;
+    length_ms_[WINDOW_LONG] = 60 * 60 * 1000;
+    for (int i = 0; i < TP_CHANNEL_COUNT; i++) {
+        threshold_[i] = 0;
+    }
+}
+
+WindowedStats::~WindowedStats()
+{
+
+}
+
+void WindowedStats::setLength(Window window, int secs)
+{
+    length_ms_[window] = qMax(1, secs) * 1000;
+    open_[window] = WindowSummary();
+    closed_ready_[window] = false;
+}
+
+int WindowedStats::length(Window window) const
+{
+    return length_ms_[window] / 1000;
+}
+
+int WindowedStats::find(int secs) const
+{
+    for (int i = 0; i < WINDOW_COUNT; i++) {
+        if (length_ms_[i] == secs * 1000) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+void WindowedStats::setThreshold(int channel, float threshold)
+{
+    if (channel < 0 || channel >= TP_CHANNEL_COUNT) {
+        return;
+    }
+    threshold_[channel] = threshold;
+    has_threshold_[channel] = true;
+}
+
+void WindowedStats::clearThresholds()
+{
+    for (int i = 0; i < TP_CHANNEL_COUNT; i++) {
+        has_threshold_[i] = false;
+        last_above_[i] = false;
+    }
+}
+
+void WindowedStats::add(const TemperatureSample &sample)
+{
+    qint64 now = sample.timestamp;
+
+    for (int w = 0; w < WINDOW_COUNT; w++) {
+        WindowSummary &open = open_[w];
+
+        // the first sample past the end closes the window, a clock step
+        // back drops it
+        if (open.start_ms >= 0 && now >= open.end_ms) {
+            addAbove(&open, open.end_ms);
+            closed_[w] = open;
+            closed_ready_[w] = true;
+            open.start_ms = -1;
+        }
+        else if (open.start_ms >= 0 && now < open.start_ms) {
+            open.start_ms = -1;
+        }
+
+        if (open.start_ms < 0) {
+            open = WindowSummary();
+            open.start_ms = now - now % length_ms_[w];
+            open.end_ms = open.start_ms + length_ms_[w];
+        }
+
+        addAbove(&open, now);
+        open.count++;
+        for (int i = 0; i < TP_CHANNEL_COUNT; i++) {
+            double value = sample.temperature[i];
+            double delta = value - open.mean[i];
+            open.mean[i] += delta / open.count;
+            open.m2[i] += delta * (value - open.mean[i]);
+            open.min[i] = (open.count == 1)? sample.temperature[i] : qMin(open.min[i], sample.temperature[i]);
+            open.max[i] = (open.count == 1)? sample.temperature[i] : qMax(open.max[i], sample.temperature[i]);
+        }
+        if (sample.state & SAMPLE_STATE_CP) {
+            open.cp_on++;
+        }
+        if (sample.state & SAMPLE_STATE_FN) {
+            open.fn_on++;
+        }
+        if (sample.state & SAMPLE_STATE_DOOR) {
+            open.door_open++;
+        }
+    }
+
+    last_timestamp_ = now;
+    for (int i = 0; i < TP_CHANNEL_COUNT; i++) {
+        last_above_[i] = has_threshold_[i] && sample.temperature[i] > threshold_[i];
+    }
+}
+
+bool WindowedStats::takeSummary(Window window, WindowSummary *summary)
+{
+    if (closed_ready_[window] == false) {
+        return false;
+    }
+    *summary = closed_[window];
+    closed_ready_[window] = false;
+    return true;
+}
+
+const WindowSummary &WindowedStats::current(Window window) const
+{
+    return open_[window];
+}
+
+void WindowedStats::toPayload(const WindowSummary &summary, TelemetryPayload *payload)
+{
+    // mean keeps the original field names like the sampler aggregate
+    payload->clear();
+    for (int i = 0; i < TP_CHANNEL_COUNT; i++) {
+        payload->setTemperature(TelemetryPayload::Field(TelemetryPayload::TEMPERATURE + i), summary.mean[i]);
+        payload->setTemperature(TelemetryPayload::Field(TelemetryPayload::TEMPERATURE_MIN + i), summary.min[i]);
+        payload->setTemperature(TelemetryPayload::Field(TelemetryPayload::TEMPERATURE_MAX + i), summary.max[i]);
+        payload->setDecimal(TelemetryPayload::Field(TelemetryPayload::TEMPERATURE_VAR + i), summary.variance(i), 3);
+        payload->setDecimal(TelemetryPayload::Field(TelemetryPayload::TEMPERATURE_ABOVE + i), summary.above_ms[i] / 1000.0, 1);
+    }
+    if (summary.count > 0) {
+        payload->setDecimal(TelemetryPayload::CP_RATIO,   double(summary.cp_on) / summary.count, 3);
+        payload->setDecimal(TelemetryPayload::FN_RATIO,   double(summary.fn_on) / summary.count, 3);
+        payload->setDecimal(TelemetryPayload::DOOR_RATIO, double(summary.door_open) / summary.count, 3);
+    }
+    payload->setNumber(TelemetryPayload::SAMPLE_COUNT, summary.count);
+    payload->setNumber(TelemetryPayload::WINDOW_START, summary.start_ms / 1000);
+    payload->setNumber(TelemetryPayload::WINDOW_SEC, (summary.end_ms - summary.start_ms) / 1000);
+}
+
+void WindowedStats::addAbove(WindowSummary *summary, qint64 until_ms) const
+{
+    if (last_timestamp_ < 0) {
+        return;
+    }
+    qint64 from_ms = qMax(last_timestamp_, summary->start_ms);
+    if (until_ms <= from_ms) {
+        return;
+    }
+    for (int i = 0; i < TP_CHANNEL_COUNT; i++) {
+        if (last_above_[i]) {
+            summary->above_ms[i] += until_ms - from_ms;
+        }
+    }
+}
@@ -0,0 +1,77 @@
+#ifndef WINDOWED_STATS_H
+#define WINDOWED_STATS_H
+
+#include "sample_store.h"
+
+class TelemetryPayload;
+
+// running statistics of one window, variance is kept as Welford's M2
+struct WindowSummary
+{
+    qint64 start_ms = -1;
+    qint64 end_ms = -1;
+    int count = 0;
+    float min[TP_CHANNEL_COUNT] = {};
+    float max[TP_CHANNEL_COUNT] = {};
+    double mean[TP_CHANNEL_COUNT] = {};
+    double m2[TP_CHANNEL_COUNT] = {};
+    qint64 above_ms[TP_CHANNEL_COUNT] = {};     // time above the channel threshold
+    int cp_on = 0;
+    int fn_on = 0;
+    int door_open = 0;
+
+    double variance(int channel) const;
+};
+
+// Min/max/mean/variance and time above threshold per TP channel over
+// tumbling windows aligned to the epoch (1 min, 15 min and 1 h by default).
+// Every sample updates each window in O(1), a window is closed by the first
+// sample past its end, so only its summary needs to be uploaded.
+class WindowedStats
+{
+public:
+    enum Window {
+        WINDOW_SHORT,
+        WINDOW_MEDIUM,
+        WINDOW_LONG,
+        WINDOW_COUNT
+    };
+
+    WindowedStats();
+    ~WindowedStats();
+
+    // restarts the window
+    void setLength(Window window, int secs);
+    int length(Window window) const;
+    int find(int secs) const;       // window of that length or -1
+
+    // channel is 0-based, time above is only counted for channels with one
+    void setThreshold(int channel, float threshold);
+    void clearThresholds();
+
+    void add(const TemperatureSample &sample);
+
+    // the newest closed window, each one is returned once
+    bool takeSummary(Window window, WindowSummary *summary);
+    const WindowSummary &current(Window window) const;
+
+    static void toPayload(const WindowSummary &summary, TelemetryPayload *payload);
+
+private:
+    void addAbove(WindowSummary *summary, qint64 until_ms) const;
+
+private:
+    int length_ms_[WINDOW_COUNT];
+    WindowSummary open_[WINDOW_COUNT];
+    WindowSummary closed_[WINDOW_COUNT];
+    bool closed_ready_[WINDOW_COUNT] = {};
+
+    float threshold_[TP_CHANNEL_COUNT];
+    bool has_threshold_[TP_CHANNEL_COUNT] = {};
+
+    // the previous sample holds until the next one
+    qint64 last_timestamp_ = -1;
+    bool last_above_[TP_CHANNEL_COUNT] = {};
+};
+
+#endif // WINDOWED_STATS_H